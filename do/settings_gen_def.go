@@ -103,6 +103,9 @@ var (
 			"if true, TextColor and BackgroundColor of the document will be swapped"),
 		mkField("HideScrollbars", Bool, false,
 			"if true, hides the scrollbars but retains ability to scroll"),
+		mkField("RenderCacheMemoryPercent", Int, 10,
+			"how much of physical memory (in percent) can be used for caching rendered pages. "+
+				"valid values are between 1 and 50").setExpert().setVersion("3.6"),
 	}
 
 	comicBookUI = []*Field{
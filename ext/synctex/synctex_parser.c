@@ -743,21 +743,15 @@ static void synctex_reader_free(synctex_reader_p reader) {
     }
 }
 /*
+ *  Sets up reading from an already opened (possibly compressed) synctex file.
+ *  The reader takes ownership of file and synctex.
  *  Return reader on success.
  *  Deallocate reader and return NULL on failure.
  */
-static synctex_reader_p synctex_reader_init_with_output_file(synctex_reader_p reader, const char * output, const char * build_directory) {
+static synctex_reader_p synctex_reader_init_with_file(synctex_reader_p reader, gzFile file, char * synctex, const char * output) {
     if (reader) {
-        /*  now open the synctex file */
-        synctex_open_s open = _synctex_open_v2(output,build_directory,0,synctex_ADD_QUOTES);
-        if (open.status<SYNCTEX_STATUS_OK) {
-            open = _synctex_open_v2(output,build_directory,0,synctex_DONT_ADD_QUOTES);
-            if (open.status<SYNCTEX_STATUS_OK) {
-                return NULL;
-            }
-        }
-        reader->synctex = open.synctex;
-        reader->file = open.file;
+        reader->synctex = synctex;
+        reader->file = file;
         /*  make a private copy of output */
         if (NULL == (reader->output = (char *)_synctex_malloc(strlen(output)+1))){
             _synctex_error("!  synctex_scanner_new_with_output_file: Memory problem (2), reader's output is not reliable.");
@@ -790,6 +784,24 @@ static synctex_reader_p synctex_reader_init_with_output_file(synctex_reader_p re
     }
     return reader;
 }
+/*
+ *  Return reader on success.
+ *  Deallocate reader and return NULL on failure.
+ */
+static synctex_reader_p synctex_reader_init_with_output_file(synctex_reader_p reader, const char * output, const char * build_directory) {
+    if (reader) {
+        /*  now open the synctex file */
+        synctex_open_s open = _synctex_open_v2(output,build_directory,0,synctex_ADD_QUOTES);
+        if (open.status<SYNCTEX_STATUS_OK) {
+            open = _synctex_open_v2(output,build_directory,0,synctex_DONT_ADD_QUOTES);
+            if (open.status<SYNCTEX_STATUS_OK) {
+                return NULL;
+            }
+        }
+        return synctex_reader_init_with_file(reader,open.file,open.synctex,output);
+    }
+    return reader;
+}
 
 #   if defined(SYNCTEX_USE_HANDLE)
 #       define SYNCTEX_DECLARE_HANDLE synctex_node_p handle;
@@ -6067,6 +6079,32 @@ synctex_scanner_p synctex_scanner_new_with_output_file(const char * output, cons
     return NULL;
 }
 
+#if defined(_WIN32)
+/*  SumatraPDF: gzopen() needs an ANSI path, which fails for paths with
+ *  characters outside of the current code page. This opens the given
+ *  .synctex or .synctex.gz file with a unicode path instead. zlib
+ *  uncompresses it while parsing so there's no need for a temporary file. */
+synctex_scanner_p synctex_scanner_new_with_synctex_file_w(const wchar_t * synctex, const char * output, int parse) {
+    gzFile file = NULL;
+    synctex_scanner_p scanner = synctex_scanner_new();
+    if (NULL == scanner) {
+        _synctex_error("malloc problem");
+        return NULL;
+    }
+    if (NULL == (file = gzopen_w(synctex, "rb"))) {
+        synctex_scanner_free(scanner);
+        return NULL;
+    }
+    /*  a bigger buffer speeds up reading large files */
+    gzbuffer(file, 1<<16);
+    if (synctex_reader_init_with_file(scanner->reader, file, NULL, output)) {
+        return parse? synctex_scanner_parse(scanner):scanner;
+    }
+    synctex_scanner_free(scanner);
+    return NULL;
+}
+#endif
+
 /*  The scanner destructor
  */
 int synctex_scanner_free(synctex_scanner_p scanner) {
@@ -51,6 +51,9 @@
 #   define __SYNCTEX_PARSER__
 
 #include "synctex_version.h"
+#if defined(_WIN32)
+#include <stddef.h> /* wchar_t */
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -109,6 +112,15 @@ extern "C" {
      *      of an error or non existent file.
      */
     synctex_scanner_p synctex_scanner_new_with_output_file(const char * output, const char * build_directory, int parse);
+
+#if defined(_WIN32)
+    /**
+     *  SumatraPDF: same as synctex_scanner_new_with_output_file
+     *  but opens the given .synctex or .synctex.gz file with a unicode path.
+     *  - argument output: the output file the synctex file belongs to.
+     */
+    synctex_scanner_p synctex_scanner_new_with_synctex_file_w(const wchar_t * synctex, const char * output, int parse);
+#endif
     
     /**
      *  Designated method to delete a synctex scanner object,
@@ -67,6 +67,13 @@ static bool _7z_parse_entry(ar_archive *ar, off64_t offset)
     ar->entry_offset_next = offset + 1;
     ar->entry_size_uncompressed = (size_t)item->Size;
     ar->entry_filetime = item->MTimeDefined ? (time64_t)(item->MTime.Low | ((time64_t)item->MTime.High << 32)) : 0;
+    ar->entry_solid = false;
+    if (_7z->data.FileIndexToFolderIndexMap[offset] != (UInt32)-1) {
+        /* all files of a folder are compressed as a single block */
+        UInt32 folderIndex = _7z->data.FileIndexToFolderIndexMap[offset];
+        UInt32 nextFileIndex = folderIndex + 1 < _7z->data.db.NumFolders ? _7z->data.FolderStartFileIndex[folderIndex + 1] : _7z->data.db.NumFiles;
+        ar->entry_solid = nextFileIndex - _7z->data.FolderStartFileIndex[folderIndex] > 1;
+    }
 
     free(_7z->entry_name);
     _7z->entry_name = NULL;
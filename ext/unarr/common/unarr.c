@@ -80,6 +80,11 @@ time64_t ar_entry_get_filetime(ar_archive *ar)
     return ar->entry_filetime;
 }
 
+bool ar_entry_is_solid(ar_archive *ar)
+{
+    return ar->entry_solid;
+}
+
 bool ar_entry_uncompress(ar_archive *ar, void *buffer, size_t count)
 {
     return ar->uncompress(ar, buffer, count);
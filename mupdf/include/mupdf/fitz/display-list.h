@@ -139,4 +139,15 @@ fz_image *fz_new_image_from_display_list(fz_context *ctx, float w, float h, fz_d
 */
 int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list);
 
+/**
+	Approximate number of bytes used by the display list itself
+	(not counting resources like images and fonts it references).
+*/
+size_t fz_display_list_size(fz_context *ctx, const fz_display_list *list);
+
+/**
+	Internal destructor exposed for fz_store integration.
+*/
+void fz_drop_display_list_imp(fz_context *ctx, fz_storable *list);
+
 #endif
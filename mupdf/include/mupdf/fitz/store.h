@@ -410,6 +410,27 @@ void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const f
 */
 void fz_debug_store(fz_context *ctx, fz_output *out);
 
+/**
+	SumatraPDF: per-owner accounting for a store shared by several
+	documents. Items are owned by the user context (see
+	fz_set_user_context) of the context which stored them.
+
+	The callbacks are called with the alloc lock held and must not
+	call back into fitz.
+*/
+typedef void (fz_store_enumerate_fn)(void *arg, void *owner, const char *type, size_t size);
+
+/**
+	Call fn for every item in the store, most recently used first.
+*/
+void fz_enumerate_store(fz_context *ctx, fz_store_enumerate_fn *fn, void *arg);
+
+/**
+	Call fn for every item evicted from the store to make space
+	for new items.
+*/
+void fz_set_store_evict_callback(fz_context *ctx, fz_store_enumerate_fn *fn, void *arg);
+
 /**
 	Increment the defer reap count.
 
@@ -453,6 +453,10 @@ struct pdf_document
 	pdf_rev_page_map *rev_page_map;
 	pdf_obj **fwd_page_map;
 	int page_tree_broken;
+	/* SumatraPDF: look up pages by walking the page tree instead of loading
+	   all of it, so that a linearized file's first page can be shown before
+	   the rest of the page tree has been read */
+	int defer_page_tree;
 
 	int repair_attempted;
 	int repair_in_progress;
@@ -1545,7 +1545,7 @@ fz_new_list_device(fz_context *ctx, fz_display_list *list)
 	return &dev->super;
 }
 
-static void
+void
 fz_drop_display_list_imp(fz_context *ctx, fz_storable *list_)
 {
 	fz_display_list *list = (fz_display_list *)list_;
@@ -1699,6 +1699,11 @@ int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list)
 	return !list || list->len == 0;
 }
 
+size_t fz_display_list_size(fz_context *ctx, const fz_display_list *list)
+{
+	return list ? sizeof(*list) + list->max * sizeof(fz_display_node) : 0;
+}
+
 void
 fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_rect scissor, fz_cookie *cookie)
 {
@@ -36,6 +36,8 @@ typedef struct fz_item
 	struct fz_item *prev;
 	fz_store *store;
 	const fz_store_type *type;
+	/* SumatraPDF: user context of the context that stored the item */
+	void *owner;
 } fz_item;
 
 /* Every entry in fz_store is protected by the alloc lock */
@@ -59,8 +61,19 @@ struct fz_store
 	int defer_reap_count;
 	int needs_reaping;
 	int scavenging;
+
+	/* SumatraPDF: called for items evicted to make space */
+	fz_store_enumerate_fn *evict_fn;
+	void *evict_arg;
 };
 
+static void
+notify_evicted(fz_store *store, fz_item *item)
+{
+	if (store->evict_fn)
+		store->evict_fn(store->evict_arg, item->owner, item->type->name, item->size);
+}
+
 void
 fz_new_store_context(fz_context *ctx, size_t max)
 {
@@ -82,6 +95,8 @@ fz_new_store_context(fz_context *ctx, size_t max)
 	store->max = max;
 	store->defer_reap_count = 0;
 	store->needs_reaping = 0;
+	store->evict_fn = NULL;
+	store->evict_arg = NULL;
 	ctx->store = store;
 }
 
@@ -349,6 +364,7 @@ ensure_space(fz_context *ctx, size_t tofree)
 		if (item->val->refs != 1)
 			continue;
 
+		notify_evicted(store, item);
 		store->size -= item->size;
 
 		/* Unlink from the linked list */
@@ -474,6 +490,7 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 	item->next = item;
 	item->prev = item;
 	item->type = type;
+	item->owner = ctx->user;
 
 	/* If we can index it fast, put it into the hash table. This serves
 	 * to check whether we have one there already. */
@@ -852,6 +869,7 @@ scavenge(fz_context *ctx, size_t tofree)
 			FZ_LOG_DUMP_STORE(ctx, "Before scavenge:\n");
 		}
 		freed += largest->size;
+		notify_evicted(store, largest);
 		evict(ctx, largest); /* Drops then retakes lock */
 	}
 	while (freed < tofree);
@@ -1074,6 +1092,33 @@ void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const f
 	}
 }
 
+void fz_enumerate_store(fz_context *ctx, fz_store_enumerate_fn *fn, void *arg)
+{
+	fz_store *store = ctx->store;
+	fz_item *item;
+
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (item = store->head; item; item = item->next)
+		fn(arg, item->owner, item->type->name, item->size);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+void fz_set_store_evict_callback(fz_context *ctx, fz_store_enumerate_fn *fn, void *arg)
+{
+	fz_store *store = ctx->store;
+
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	store->evict_fn = fn;
+	store->evict_arg = arg;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
 void fz_defer_reap_start(fz_context *ctx)
 {
 	if (ctx->store == NULL)
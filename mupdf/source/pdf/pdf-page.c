@@ -252,7 +252,7 @@ pdf_lookup_page_loc(fz_context *ctx, pdf_document *doc, int needle, pdf_obj **pa
 pdf_obj *
 pdf_lookup_page_obj(fz_context *ctx, pdf_document *doc, int needle)
 {
-	if (doc->fwd_page_map == NULL && !doc->page_tree_broken)
+	if (doc->fwd_page_map == NULL && !doc->page_tree_broken && !doc->defer_page_tree)
 	{
 		fz_try(ctx)
 			pdf_load_page_tree_internal(ctx, doc);
@@ -369,7 +369,7 @@ pdf_lookup_page_number_fast(fz_context *ctx, pdf_document *doc, int needle)
 int
 pdf_lookup_page_number(fz_context *ctx, pdf_document *doc, pdf_obj *page)
 {
-	if (doc->rev_page_map == NULL && !doc->page_tree_broken)
+	if (doc->rev_page_map == NULL && !doc->page_tree_broken && !doc->defer_page_tree)
 	{
 		fz_try(ctx)
 			pdf_load_page_tree_internal(ctx, doc);
@@ -85,7 +85,9 @@ function zlib_ng_files()
     "uncompr.c",
     "zutil.c",
   })
+end
 
+function zlib_ng_x86_files()
   files_in_dir("ext/zlib-ng/arch/x86", {
     "*.c",
   })
@@ -673,6 +675,7 @@ function sumatrapdf_files()
     "Tabs.*",
     "Tester.*",
     "TextSearch.*",
+    "TextSearchIndex.*",
     "TextSelection.*",
     "Theme.*",
     "Toolbar.*",
@@ -759,6 +762,7 @@ function utils_files()
     "StrconvUtil.*",
     "StrFormat.*",
     "StrUtil.*",
+    "StrSearch.*",
     "StrVec.*",
     "StrQueue.*",
     "TempAllocator.*",
@@ -1158,11 +1162,14 @@ function test_util_files()
     "BaseUtil.*",
     "BitManip.*",
     "ByteOrderDecoder.*",
+    "ByteReader.*",
+    "ByteWriter.*",
     "CmdLineArgsIter.*",
     "ColorUtil.*",
     "CryptoUtil.*",
     "CssParser.*",
     "Dict.*",
+    "DirIter.*",
     "Dpi.*",
     "FileUtil.*",
     "GeomUtil.*",
@@ -1176,11 +1183,13 @@ function test_util_files()
     "StrconvUtil.*",
     "StrFormat.*",
     "StrUtil.*",
+    "StrSearch.*",
     "StrVec.*",
     "StrQueue.*",
     "SquareTreeParser.*",
     "TrivialHtmlParser.*",
     "TempAllocator.*",
+    "ThreadUtil.*",
     "UtAssert.*",
     "Vec.*",
     "WinUtil.*",
@@ -1197,6 +1206,7 @@ function test_util_files()
     "SumatraConfig.*",
     "SettingsStructs.*",
     "SumatraUnitTests.cpp",
+    "TextSearchIndex.*",
     "tools/test_util.cpp"
   })
 end
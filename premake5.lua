@@ -61,6 +61,11 @@ newoption {
    description = "use clang-cl.exe instead of cl.exe"
 }
 
+newoption {
+   trigger = "with-zlib-ng",
+   description = "use zlib-ng (in zlib compat mode) instead of zlib"
+}
+
 -- TODO: test this option
 -- usestandardpreprocessor 'On'
 
@@ -169,16 +174,57 @@ function zlib_defines()
   }
 end
 
+-- zlib-ng is built in zlib compat mode so the code using
+-- zlib doesn't change, only the headers and the library
+function zlib_ng_headers()
+  defines { "ZLIB_COMPAT" }
+  includedirs {
+    "ext/zlib-ng",
+  }
+end
+
+-- for building zlib-ng itself
+function zlib_ng_defines()
+  zlib_ng_headers()
+  defines {
+    "_CRT_SECURE_NO_DEPRECATE",
+    "_CRT_NONSTDC_NO_DEPRECATE",
+    "UNALIGNED_OK",
+    "UNALIGNED64_OK",
+    "WITH_GZFILEOP",
+  }
+  filter {'platforms:x32 or x64 or x64_asan'}
+    defines {
+      "X86_FEATURES",
+      "X86_PCLMULQDQ_CRC",
+      "X86_SSE2",
+      "X86_SSE2_CHUNKSET",
+      "X86_SSE42_CRC_INTRIN",
+      "X86_SSE42_CRC_HASH",
+      "X86_SSSE3_ADLER32",
+      "X86_AVX2",
+      "X86_AVX2_ADLER32",
+      "X86_AVX_CHUNKSET",
+    }
+  filter {}
+end
+
 -- add to a project that links zlib
 function links_zlib()
-  -- links { "zlib-ng" }
-  links { "zlib" }
+  filter "options:with-zlib-ng"
+    links { "zlib-ng" }
+  filter "options:not with-zlib-ng"
+    links { "zlib" }
+  filter {}
 end
 
 -- add to a project that needs to see zlib headers
 function uses_zlib()
-  --zlib_ng_defines()
-  zlib_defines()
+  filter "options:with-zlib-ng"
+    zlib_ng_headers()
+  filter "options:not with-zlib-ng"
+    zlib_defines()
+  filter {}
 end
 
 workspace "SumatraPDF"
@@ -409,6 +455,21 @@ workspace "SumatraPDF"
     disablewarnings { "4131", "4244", "4245", "4267", "4996" }
     zlib_files()
 
+  -- faster inflate for pdf streams, .cbz files, .synctex.gz etc.
+  -- premake5 --with-zlib-ng vs2022
+  if _OPTIONS["with-zlib-ng"] then
+  project "zlib-ng"
+    kind "StaticLib"
+    language "C"
+    optimized_conf()
+    disablewarnings { "4127", "4131", "4244", "4245", "4267", "4996" }
+    zlib_ng_defines()
+    zlib_ng_files()
+    filter {'platforms:x32 or x64 or x64_asan'}
+      zlib_ng_x86_files()
+    filter {}
+  end
+
   -- to make Visual Studio solution smaller
   -- combine 9 libs only used by mupdf into a single project
   -- instead of having 9 projects
@@ -958,10 +1019,11 @@ workspace "MakeLZSA"
     disablewarnings { "4131", "4244", "4245", "4267", "4996" }
     includedirs { "src", "ext/lzma/C", "ext/unarr" }
 
-    -- for zlib
+    -- for zlib. always classic zlib, even with --with-zlib-ng, as
+    -- zlib-ng's compat headers don't match the zlib sources built here
     disablewarnings { "4131", "4244", "4245", "4267", "4996" }
     zlib_files()
-    uses_zlib()
+    zlib_defines()
 
     -- unarrlib
     -- TODO: for bzip2, need BZ_NO_STDIO and BZ_DEBUG=0
@@ -92,6 +92,7 @@ static i32 gDocumentNotOpenWhitelist[] = {
     CmdDebugTestApp,
     CmdDebugTogglePredictiveRender,
     CmdDebugToggleRtl,
+    CmdDebugDumpMupdfStore,
     CmdFavoriteToggle,
     CmdToggleFullscreen,
     CmdToggleMenuBar,
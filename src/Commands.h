@@ -191,6 +191,7 @@ Cmd* enum (e.g. CmdOpen) and a human-readable name (not used yet).
     V(CmdDebugTogglePredictiveRender, "Debug: Toggle Predictive Rendering")        \
     V(CmdDebugToggleRtl, "Debug: Toggle Rtl")                                      \
     V(CmdDebugDelayCloseWindow, "Debug: Delay Close Window")                       \
+    V(CmdDebugDumpMupdfStore, "Debug: Log MuPDF Store Usage")                      \
     V(CmdNone, "Do nothing")
 
 // order of CreateAnnot* must be the same as enum AnnotationType
@@ -93,10 +93,15 @@ const char* DisplayModel::GetDefaultFileExt() const {
     return engine->defaultExt;
 }
 
+// the engine's page count can change after BuildPagesInfo (for ebooks
+// laid out lazily, see EngineBase::FinishLayout), pagesInfo can't
 int DisplayModel::PageCount() const {
     if (!engine) {
         return 0;
     }
+    if (pagesInfo) {
+        return nPages;
+    }
     return engine->PageCount();
 }
 
@@ -145,7 +150,7 @@ bool DisplayModel::ValidPageNo(int pageNo) const {
     if (!engine) {
         return false;
     }
-    return 1 <= pageNo && pageNo <= engine->PageCount();
+    return 1 <= pageNo && pageNo <= PageCount();
 }
 
 bool DisplayModel::GoToPrevPage(bool toBottom) {
@@ -316,6 +321,8 @@ DisplayModel::~DisplayModel() {
     cb->CleanUp(this);
 
     delete pdfSync;
+    // stops the thread collecting them, which uses textCache
+    delete searchHits;
     delete textSearch;
     delete textSelection;
     delete textCache;
@@ -368,10 +375,20 @@ void DisplayModel::SetInitialViewSettings(DisplayMode newDisplayMode, int newSta
     BuildPagesInfo();
 }
 
+// used for pages with an empty mediabox: A4 size (resp. letter size)
+static RectF DefaultPageRect(EngineBase* engine) {
+    float fileDPI = engine->GetFileDPI();
+    if (0 == GetMeasurementSystem()) {
+        return RectF(0, 0, 21.0 / 2.54 * fileDPI, 29.7 / 2.54 * fileDPI);
+    }
+    return RectF(0, 0, 8.5 * fileDPI, 11 * fileDPI);
+}
+
 void DisplayModel::BuildPagesInfo() {
     ReportIf(pagesInfo);
-    int pageCount = PageCount();
+    int pageCount = engine->PageCount();
     pagesInfo = AllocArray<PageInfo>(pageCount);
+    nPages = pageCount;
 
     log("DisplayModel::BuildPagesInfo started\n");
     auto timeStart = TimeGet();
@@ -380,13 +397,7 @@ void DisplayModel::BuildPagesInfo() {
         logf("DisplayModel::BuildPagesInfo took %.2f ms\n", dur);
     };
 
-    RectF defaultRect;
-    float fileDPI = engine->GetFileDPI();
-    if (0 == GetMeasurementSystem()) {
-        defaultRect = RectF(0, 0, 21.0 / 2.54 * fileDPI, 29.7 / 2.54 * fileDPI);
-    } else {
-        defaultRect = RectF(0, 0, 8.5 * fileDPI, 11 * fileDPI);
-    }
+    RectF defaultRect = DefaultPageRect(engine);
 
     int columns = ColumnsFromDisplayMode(displayMode);
     int newStartPage = startPage;
@@ -1094,6 +1105,39 @@ bool DisplayModel::IsOverText(Point pt) {
     return textSelection->IsOverGlyph(pageNo, pos.x, pos.y);
 }
 
+// number of pages before and after the visible ones whose size is resolved
+// so that the predictively rendered pages also have their actual size
+constexpr int kResolvePagesAroundVisible = 2;
+
+// the layout of a document that is shown before the size of all its pages is
+// known uses estimated sizes (see EngineBase::ResolvePageSizes). once pages come
+// near the viewport, get their actual size and, if that changed, redo the layout
+// while keeping the same part of the document in view.
+// returns true if the layout changed (in which case the visible parts have already
+// been rendered again)
+bool DisplayModel::ResolvePageSizes(int firstVisiblePage, int lastVisiblePage) {
+    int startPage = std::max(firstVisiblePage - kResolvePagesAroundVisible, 1);
+    int endPage = std::min(lastVisiblePage + kResolvePagesAroundVisible, PageCount());
+    if (!engine->ResolvePageSizes(startPage, endPage)) {
+        return false;
+    }
+    auto timeStart = TimeGet();
+    ScrollState ss = GetScrollState();
+    RectF defaultRect = DefaultPageRect(engine);
+    for (int pageNo = startPage; pageNo <= endPage; pageNo++) {
+        PageInfo* pageInfo = GetPageInfo(pageNo);
+        pageInfo->page = engine->PageMediabox(pageNo);
+        if (pageInfo->page.IsEmpty()) {
+            pageInfo->page = defaultRect;
+        }
+    }
+    Relayout(zoomVirtual, rotation);
+    // the pages are already resolved, so this won't end up here again
+    SetScrollState(ss);
+    logf("DisplayModel::ResolvePageSizes: pages %d-%d took %.2f ms\n", startPage, endPage, TimeSinceInMs(timeStart));
+    return true;
+}
+
 void DisplayModel::RenderVisibleParts() {
     int firstVisiblePage = 0;
     int lastVisiblePage = 0;
@@ -1114,6 +1158,10 @@ void DisplayModel::RenderVisibleParts() {
         return;
     }
 
+    if (ResolvePageSizes(firstVisiblePage, lastVisiblePage)) {
+        return;
+    }
+
     // rendering happens LIFO except if the queue is currently
     // empty, so request the visible pages first and last to
     // make sure they're rendered before the predicted pages
@@ -1204,7 +1252,7 @@ Point DisplayModel::GetContentStart(int pageNo) const {
 // TODO: what's GoToPage supposed to do for Facing at 400% zoom?
 void DisplayModel::GoToPage(int pageNo, int scrollY, bool addNavPt, int scrollX) {
     if (!ValidPageNo(pageNo)) {
-        logf("DisplayModel::GoToPage: invalid pageNo: %d, nPages: %d\n", pageNo, engine->PageCount());
+        logf("DisplayModel::GoToPage: invalid pageNo: %d, nPages: %d\n", pageNo, PageCount());
         ReportIf(true);
         return;
     }
@@ -1717,11 +1765,12 @@ void DisplayModel::RotateBy(int newRotation) {
 /* Given <region> (in user coordinates ) on page <pageNo>, copies text in that region
  * into a newly allocated buffer (which the caller needs to free()). */
 char* DisplayModel::GetTextInRegion(int pageNo, RectF region) const {
-    Rect* coords;
-    const WCHAR* pageText = textCache->GetTextForPage(pageNo, nullptr, &coords);
+    const WCHAR* pageText = textCache->GetTextForPage(pageNo);
     if (str::IsEmpty(pageText)) {
         return nullptr;
     }
+    ScopedPageCoords pageCoords(textCache, pageNo);
+    Rect* coords = pageCoords.coords;
 
     str::WStr result;
     Rect regionI = region.Round();
@@ -53,6 +53,7 @@ struct ScrollState {
 struct DocumentTextCache;
 struct TextSelection;
 struct TextSearch;
+struct TextSearchHits;
 struct TextSel;
 class Synchronizer;
 
@@ -131,6 +132,8 @@ struct DisplayModel : DocController {
     TextSelection* textSelection = nullptr;
     // access only from Search thread
     TextSearch* textSearch = nullptr;
+    // all matches of the last search, collected in the background
+    TextSearchHits* searchHits = nullptr;
 
     PageInfo* GetPageInfo(int pageNo) const;
 
@@ -205,6 +208,7 @@ struct DisplayModel : DocController {
     Point GetContentStart(int pageNo) const;
     void RecalcVisibleParts() const;
     void RenderVisibleParts();
+    bool ResolvePageSizes(int firstVisiblePage, int lastVisiblePage);
     void AddNavPoint();
     RectF GetContentBox(int pageNo) const;
     void CalcZoomReal(float zoomVirtual);
@@ -214,8 +218,9 @@ struct DisplayModel : DocController {
 
     EngineBase* engine = nullptr;
 
-    /* an array of PageInfo, len of array is pageCount */
+    /* an array of PageInfo, len of array is nPages */
     PageInfo* pagesInfo = nullptr;
+    int nPages = 0;
 
     DisplayMode displayMode{DisplayMode::Automatic};
     /* In non-continuous mode is the first page from a file that we're
@@ -451,6 +451,7 @@ bool EpubDoc::Load() {
         // an anchor with the file name at the top (for internal links)
         ReportIf(str::FindChar(fullPath, '"'));
         str::TransCharsInPlace(fullPath, "\"", "'");
+        chapterStarts.Append((int)htmlData.size());
         htmlData.AppendFmt("<pagebreak page_path=\"%s\" page_marker />", fullPath);
         htmlData.Append(decoded);
     }
@@ -521,6 +522,11 @@ ByteSlice EpubDoc::GetHtmlData() const {
     return htmlData.AsByteSlice();
 }
 
+// chapters always start on a new page, so they can be laid out independently
+const Vec<int>& EpubDoc::GetChapterStarts() const {
+    return chapterStarts;
+}
+
 ByteSlice* EpubDoc::GetImageData(const char* fileName, const char* pagePath) {
     ScopedCritSec scope(&zipAccess);
 
@@ -23,6 +23,8 @@ class EpubDoc {
     CRITICAL_SECTION zipAccess;
 
     str::Str htmlData;
+    // offsets in htmlData at which spine items start, each with a <pagebreak>
+    Vec<int> chapterStarts;
     Vec<ImageData> images;
     AutoFreeStr tocPath;
     AutoFreeStr fileName;
@@ -41,6 +43,7 @@ class EpubDoc {
     ~EpubDoc();
 
     ByteSlice GetHtmlData() const;
+    const Vec<int>& GetChapterStarts() const;
 
     ByteSlice* GetImageData(const char* fileName, const char* pagePath);
     ByteSlice GetFileData(const char* relPath, const char* pagePath);
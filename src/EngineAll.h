@@ -26,6 +26,8 @@ EngineBase* CreateEngineHtmlFromFile(const char* fileName);
 EngineBase* CreateEngineTxtFromFile(const char* fileName);
 
 void SetDefaultEbookFont(const char* name, float size);
+void SetEbookLazyLayout(bool enable);
+void SetEbookPaginationCacheDir(const char* dir);
 void EngineEbookCleanup();
 
 /* EngineImages.cpp */
@@ -58,6 +60,11 @@ bool EngineMupdfSupportsAnnotations(EngineBase*);
 bool EngineMupdfSaveUpdated(EngineBase* engine, const char* path, const ShowErrorCb& showErrorFunc);
 Annotation* EngineMupdfGetAnnotationAtPos(EngineBase*, int pageNo, PointF pos, Annotation*);
 ByteSlice EngineMupdfLoadAttachment(EngineBase*, int attachmentNo);
+void SetMupdfProgressiveLoading(bool enable);
+void SetMupdfReadThrottle(int kbPerSec, int latencyMs);
+void SetMupdfSharedStore(bool enable);
+void SetMupdfMapLargeFiles(bool enable);
+void DumpMupdfSharedStore();
 
 /* EnginePs.cpp */
 
@@ -3,6 +3,8 @@
    License: GPLv3 */
 
 #include "utils/BaseUtil.h"
+#include "utils/CryptoUtil.h"
+#include "utils/FileUtil.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/UIModels.h"
@@ -389,6 +391,32 @@ void EngineBase::GetProperties(const StrVec&, StrVec&) {
 #endif
 }
 
+bool EngineBase::NotifyWhenLaidOut(const Func0&) {
+    return false;
+}
+
+bool EngineBase::FinishLayout() {
+    return false;
+}
+
+bool EngineBase::ResolvePageSizes(int, int) {
+    return false;
+}
+
+bool EngineBase::GetFingerprint(u8 digest[16]) {
+    ByteSlice d = GetFileData();
+    const char* path = FilePath();
+    if (d.empty() && path && file::Exists(path)) {
+        d = file::ReadFile(path);
+    }
+    if (d.empty()) {
+        return false;
+    }
+    CalcMD5Digest(d.data(), (int)d.size(), digest);
+    d.Free();
+    return true;
+}
+
 bool EngineBase::HasPageLabels() const {
     return hasPageLabels;
 }
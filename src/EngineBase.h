@@ -411,6 +411,10 @@ class EngineBase {
     bool isPasswordProtected = false;
     char* decryptionKey = nullptr;
     bool hasPageLabels = false;
+    // if true, RenderPage() can be called from multiple threads at the same time
+    bool allowsConcurrentRendering = false;
+    // if true, ExtractPageText() can be called from multiple threads at the same time
+    bool allowsConcurrentTextExtraction = false;
     int pageCount = -1;
 
     // TODO: migrate other engines to use this
@@ -446,6 +450,11 @@ class EngineBase {
     // caller needs to free() the result
     virtual ByteSlice GetFileData() = 0;
 
+    // calculates a digest of the file's content (identifying the same
+    // document e.g. for caching data between sessions)
+    // returns false if the content isn't available
+    virtual bool GetFingerprint(u8 digest[16]);
+
     // saves a copy of the current file under a different name (overwriting an existing file)
     virtual bool SaveFileAs(const char* copyFileName) = 0;
 
@@ -517,6 +526,20 @@ class EngineBase {
     // caller must free() the result
     char* GetDecryptionKey() const;
 
+    // engines for reflowable documents can lay out most pages in the background,
+    // in which case pageCount is only an estimate until FinishLayout() is called.
+    // returns false if pageCount is already final, otherwise fn is called
+    // (on a background thread) once FinishLayout() no longer has to block
+    virtual bool NotifyWhenLaidOut(const Func0& fn);
+    // lays out all remaining pages and fixes pageCount. returns true if pageCount
+    // was provisional, in which case views relying on it must be re-created
+    // (and must no longer be used after this call)
+    virtual bool FinishLayout();
+    // until then, PageMediabox() might only return an estimate for pages that
+    // weren't loaded yet. This gets the actual size of pages startPage to endPage
+    // and returns true if that changed the size of any of them
+    virtual bool ResolvePageSizes(int startPage, int endPage);
+
     // loads the given page so that the time required can be measured
     // without also measuring rendering times
     virtual bool BenchLoadPage(int pageNo) = 0;
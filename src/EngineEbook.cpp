@@ -7,7 +7,13 @@
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/Archive.h"
+#include "utils/ByteReader.h"
+#include "utils/ByteWriter.h"
+#include "utils/CryptoUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Timer.h"
 #include "utils/Dpi.h"
+#include "utils/DirIter.h"
 #include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
@@ -30,6 +36,8 @@
 #include "HtmlFormatter.h"
 #include "EbookFormatter.h"
 
+#include "utils/Log.h"
+
 Kind kindEngineEpub = "engineEpub";
 Kind kindEngineFb2 = "engineFb2";
 Kind kindEngineMobi = "engineMobi";
@@ -40,6 +48,17 @@ Kind kindEngineTxt = "engineTxt";
 
 static AutoFreeStr gDefaultFontName;
 static float gDefaultFontSize = 10.f;
+static bool gEbookLazyLayout = false;
+static AutoFreeStr gEbookPaginationCacheDir;
+
+// number of pages laid out before a document is considered loaded
+// when gEbookLazyLayout is set (the rest is laid out in the background)
+constexpr int kPagesToLayoutWhileLoading = 16;
+
+constexpr u32 kPaginationCacheMagic = 0x47415045; // 'EPAG'
+constexpr u32 kPaginationCacheVersion = 1;
+constexpr size_t kPaginationCacheHeaderSize = 4 * sizeof(u32);
+constexpr int kMaxPaginationCacheFiles = 256;
 
 static const WCHAR* GetDefaultFontName() {
     char* s = gDefaultFontName.Get();
@@ -71,6 +90,18 @@ void SetDefaultEbookFont(const char* name, float size) {
     gDefaultFontSize = size * 0.8f;
 }
 
+// only the ui knows how to handle a page count that changes after
+// loading (see EngineBase::NotifyWhenLaidOut), so this is opt-in
+void SetEbookLazyLayout(bool enable) {
+    gEbookLazyLayout = enable;
+}
+
+// page breaks of lazily laid out documents are remembered in this directory
+// so that they can be shown with their final page count right away when reopened
+void SetEbookPaginationCacheDir(const char* dir) {
+    gEbookPaginationCacheDir.SetCopy(dir);
+}
+
 /* common classes for EPUB, FictionBook2, Mobi, PalmDOC, CHM, HTML and TXT engines */
 
 struct PageAnchor {
@@ -81,6 +112,27 @@ struct PageAnchor {
     }
 };
 
+// a part of the html (e.g. an EPUB spine item) that starts on a new page
+// and can be laid out independently of (and in parallel with) the others
+struct EbookChapter {
+    int start = 0;
+    int end = 0;
+    // the following are protected by EngineEbook::chaptersAccess
+    bool claimed = false;
+    bool done = false;
+    // pages laid out by a worker thread, until they're moved to EngineEbook::pages
+    Vec<HtmlPage*> pages;
+    // for text allocated by the chapter's formatter, must outlive its pages
+    PoolAllocator allocator;
+
+    ~EbookChapter() {
+        DeleteVecMembers(pages);
+    }
+};
+
+// at most that many threads lay out chapters in parallel
+constexpr int kMaxChapterLayoutThreads = 8;
+
 class EbookAbortCookie : public AbortCookie {
   public:
     bool abort = false;
@@ -107,6 +159,7 @@ class EngineEbook : public EngineBase {
     RectF Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
 
     ByteSlice GetFileData() override;
+    bool GetFingerprint(u8 digest[16]) override;
 
     bool SaveFileAs(const char* copyFileName) override;
     PageText ExtractPageText(int pageNo) override;
@@ -129,6 +182,9 @@ class EngineEbook : public EngineBase {
 
     bool BenchLoadPage(int pageNo) override;
 
+    bool NotifyWhenLaidOut(const Func0& fn) override;
+    bool FinishLayout() override;
+
   protected:
     Vec<HtmlPage*>* pages = nullptr;
     Vec<PageAnchor> anchors;
@@ -143,8 +199,76 @@ class EngineEbook : public EngineBase {
     RectF pageRect;
     float pageBorder;
 
+    TocTree* tocTree = nullptr;
+    // ToC and links created before all pages were laid out
+    // (kept around because the ui might still reference them)
+    TocTree* provisionalToc = nullptr;
+    Vec<IPageElement*> provisionalElements;
+
+    // pages are laid out incrementally: the first few while loading,
+    // the rest on demand or on a background thread (see StartLayout)
+    HtmlFormatter* formatter = nullptr;
+    bool skipEmptyPages = false;
+    // the default font when the layout started, which might change afterwards
+    AutoFreeStr layoutFontName;
+    float layoutFontSize = 0;
+    mui::TextRenderMethod layoutTextRenderMethod = mui::TextRenderMethod::Gdiplus;
+    // serializes access to formatter, must be acquired before pagesAccess
+    CRITICAL_SECTION formatterAccess;
+    HANDLE layoutThread = nullptr;
+    AtomicBool abortLayout;
+    // the following are protected by pagesAccess
+    bool layoutDone = false;
+    bool provisionalPageCount = false;
+    Func0 onLaidOut;
+    DrawInstr* lastBaseAnchor = nullptr;
+
+    // for documents split into chapters, the chapters following the one laid out
+    // by formatter are laid out by a pool of threads (see StartChapterLayout)
+    Vec<EbookChapter*> chapters;
+    // the next chapter whose pages go into pages, protected by formatterAccess
+    int nextChapter = 0;
+    // protects chapters' claimed, done and pages as well as nextUnclaimedChapter
+    CRITICAL_SECTION chaptersAccess;
+    CONDITION_VARIABLE chapterLaidOut;
+    int nextUnclaimedChapter = 0;
+    Vec<HANDLE> chapterThreads;
+
+    bool StartLayout(HtmlFormatter* formatter, size_t htmlLen, bool skipEmptyPages);
+    bool StartChapterLayout(ByteSlice html, const Vec<int>& chapterStarts, bool skipEmptyPages);
+    void StopLayout();
+    bool LayoutNextPage();
+    bool TakeNextChapter();
+    void LayoutUpToPage(int pageNo);
+    bool IsLaidOut(int pageNo);
+    static void LayoutRemainingPages(EngineEbook* engine);
+    static void LayoutChapters(EngineEbook* engine);
+
+    // reparseIdx of all pages from a previous layout of the same file with the
+    // same formatter args (see LoadPaginationCache), immutable after loading
+    Vec<int> cachedPageStarts;
+    AutoFreeStr paginationCachePath;
+    size_t layoutHtmlLen = 0;
+    // pages laid out on their own from cachedPageStarts (see GetPreviewPage)
+    CRITICAL_SECTION previewAccess;
+    Vec<HtmlPage*> previewPages;
+    PoolAllocator previewAllocator;
+
+    void InitFormatterArgs(HtmlFormatterArgs& args);
+    bool GetPaginationKey(u8 digest[16]);
+    void LoadPaginationCache(size_t htmlLen);
+    void SavePaginationCache();
+    HtmlPage* GetPreviewPage(int pageNo);
+    bool CanPreview(int pageNo);
+
+    // lays out the html from reparseIdx up to htmlEnd with the args from InitFormatterArgs
+    // must be thread-safe, as chapters and preview pages are laid out in parallel
+    virtual HtmlFormatter* CreateFormatter(int, int, Allocator*) {
+        return nullptr;
+    }
+
     void GetTransform(Matrix& m, float zoom, int rotation);
-    bool ExtractPageAnchors();
+    void ExtractPageAnchors(int pageNo);
     TempStr ExtractFontListTemp();
 
     virtual IPageElement* CreatePageLink(DrawInstr* link, Rect rect, int pageNo);
@@ -200,9 +324,18 @@ EngineEbook::EngineEbook() {
     pageBorder = 0.4f * GetFileDPI();
     preferredLayout = preferredLayout = PageLayout(PageLayout::Type::Single);
     InitializeCriticalSection(&pagesAccess);
+    InitializeCriticalSection(&formatterAccess);
+    InitializeCriticalSection(&chaptersAccess);
+    InitializeConditionVariable(&chapterLaidOut);
+    InitializeCriticalSection(&previewAccess);
 }
 
 EngineEbook::~EngineEbook() {
+    // subclasses must already have called StopLayout()
+    // as the formatter might reference their data
+    ReportIf(layoutThread || formatter);
+    StopLayout();
+
     EnterCriticalSection(&pagesAccess);
 
     if (pages) {
@@ -212,9 +345,18 @@ EngineEbook::~EngineEbook() {
         DeleteVecMembers(*pages);
     }
     delete pages;
+    DeleteVecMembers(provisionalElements);
+    delete provisionalToc;
+    delete tocTree;
+    // after pages, as they might reference text allocated by chapters
+    DeleteVecMembers(chapters);
+    DeleteVecMembers(previewPages);
 
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
+    DeleteCriticalSection(&formatterAccess);
+    DeleteCriticalSection(&chaptersAccess);
+    DeleteCriticalSection(&previewAccess);
 }
 
 RectF EngineEbook::PageMediabox(int) {
@@ -235,6 +377,24 @@ ByteSlice EngineEbook::GetFileData() {
     return file::ReadFile(fileName);
 }
 
+// the pages' content also depends on the font they've been laid out with
+// (and isn't final while pageCount is provisional)
+bool EngineEbook::GetFingerprint(u8 digest[16]) {
+    {
+        ScopedCritSec scope(&pagesAccess);
+        if (provisionalPageCount) {
+            return false;
+        }
+    }
+    if (!EngineBase::GetFingerprint(digest)) {
+        return false;
+    }
+    AutoFreeStr hex = str::MemToHex(digest, 16);
+    TempStr s = str::FormatTemp("%s:%s:%g", hex.Get(), layoutFontName.Get(), layoutFontSize);
+    CalcMD5Digest(s, str::Leni(s), digest);
+    return true;
+}
+
 bool EngineEbook::SaveFileAs(const char* dstPath) {
     const char* srcPath = FilePath();
     if (!srcPath) {
@@ -257,49 +417,507 @@ void EngineEbook::GetTransform(Matrix& m, float zoom, int rotation) {
     GetBaseTransform(m, ToGdipRectF(pageRect), zoom, rotation);
 }
 
+// note: while laying out in the background, pageNo can be beyond the pages laid out
+// so far (or, after FinishLayout, beyond the final page count) and nullptr is returned
+// caller must hold pagesAccess
 Vec<DrawInstr>* EngineEbook::GetHtmlPage(int pageNo) {
-    ReportIf(pageNo < 1 || PageCount() < pageNo);
-    if (pageNo < 1 || PageCount() < pageNo) {
+    HtmlPage* page = GetHtmlPage2(pageNo);
+    if (!page) {
         return nullptr;
     }
-    return &pages->at(pageNo - 1)->instructions;
+    return &page->instructions;
 }
 
 HtmlPage* EngineEbook::GetHtmlPage2(int pageNo) {
-    ReportIf(pageNo < 1 || PageCount() < pageNo);
-    if (pageNo < 1 || PageCount() < pageNo) {
+    ReportIf(pageNo < 1);
+    if (pageNo < 1 || !pages || (int)pages->size() < pageNo) {
         return nullptr;
     }
     return pages->at(pageNo - 1);
 }
 
-bool EngineEbook::ExtractPageAnchors() {
+// caller must hold pagesAccess
+void EngineEbook::ExtractPageAnchors(int pageNo) {
+    Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
+    for (size_t k = 0; k < pageInstrs->size(); k++) {
+        DrawInstr* i = &pageInstrs->at(k);
+        if (DrawInstrType::Anchor != i->type) {
+            continue;
+        }
+        anchors.Append(PageAnchor(i, pageNo));
+        if (k < 2 && str::StartsWith(i->str.s + i->str.len, "\" page_marker />")) {
+            lastBaseAnchor = i;
+        }
+    }
+    baseAnchors.Append(lastBaseAnchor);
+    ReportIf(baseAnchors.size() != pages->size());
+}
+
+// takes ownership of formatter. Without gEbookLazyLayout all pages are laid out
+// right away. Otherwise we only lay out the first pages, estimate pageCount from
+// how much of the html they cover and lay out the rest on a background thread
+bool EngineEbook::StartLayout(HtmlFormatter* formatterIn, size_t htmlLen, bool skipEmpty) {
+    ReportIf(formatter || pages);
+    formatter = formatterIn;
+    skipEmptyPages = skipEmpty;
+    // formatterIn has just been created with these
+    layoutFontName.SetCopy(ToUtf8Temp(GetDefaultFontName()));
+    layoutFontSize = GetDefaultFontSize();
+    if (formatter) {
+        layoutTextRenderMethod = formatter->GetMeasureMethod();
+    }
+    pages = new Vec<HtmlPage*>();
+
+    int nPagesNow = gEbookLazyLayout ? kPagesToLayoutWhileLoading : INT_MAX;
+    {
+        ScopedCritSec scope(&formatterAccess);
+        for (int i = 0; i < nPagesNow; i++) {
+            if (!LayoutNextPage()) {
+                break;
+            }
+        }
+    }
+
     ScopedCritSec scope(&pagesAccess);
+    int nPages = (int)pages->size();
+    pageCount = nPages;
+    if (layoutDone || nPages == 0) {
+        return pageCount > 0;
+    }
+
+    // the pages laid out so far must match a previous layout for its page breaks to be trusted
+    layoutHtmlLen = htmlLen;
+    for (int i = 0; i < nPages && cachedPageStarts.Size() > 0; i++) {
+        if (i >= cachedPageStarts.Size() - 1 || pages->at(i)->reparseIdx != cachedPageStarts[i]) {
+            logf("EngineEbook::StartLayout: ignoring outdated pagination cache\n");
+            cachedPageStarts.Reset();
+        }
+    }
 
-    DrawInstr* baseAnchor = nullptr;
-    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
-        Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
-        if (!pageInstrs) {
-            return false;
+    // there must be at least one more page, else layoutDone would be set
+    pageCount = nPages + 1;
+    int reparseIdx = pages->Last()->reparseIdx;
+    if (cachedPageStarts.Size() > 0) {
+        pageCount = cachedPageStarts.Size();
+    } else if (reparseIdx > 0) {
+        i64 estimate = (i64)(nPages - 1) * (i64)htmlLen / reparseIdx;
+        if (estimate > pageCount && estimate < INT_MAX / 2) {
+            pageCount = (int)estimate;
         }
+    }
+    provisionalPageCount = true;
 
-        for (size_t k = 0; k < pageInstrs->size(); k++) {
-            DrawInstr* i = &pageInstrs->at(k);
-            if (DrawInstrType::Anchor != i->type) {
-                continue;
+    auto fn = MkFunc0<EngineEbook>(LayoutRemainingPages, this);
+    layoutThread = StartThread(fn, "EbookLayoutThread");
+    logf("EngineEbook::StartLayout: laid out %d pages, estimated %d\n", nPages, pageCount);
+    return true;
+}
+
+// for documents whose chapters always start on a new page: the first chapter
+// is laid out by StartLayout (and LayoutRemainingPages) while the following ones
+// are laid out in parallel by a pool of threads, each with its own formatter.
+// LayoutNextPage then appends their pages in order
+bool EngineEbook::StartChapterLayout(ByteSlice html, const Vec<int>& chapterStarts, bool skipEmpty) {
+    ReportIf(formatter || pages || chapters.Size() > 0);
+    int n = chapterStarts.Size();
+    for (int i = 0; i < n; i++) {
+        auto chapter = new EbookChapter();
+        chapter->start = chapterStarts[i];
+        chapter->end = i + 1 < n ? chapterStarts[i + 1] : (int)html.size();
+        chapters.Append(chapter);
+    }
+    if (n == 0) {
+        return false;
+    }
+    chapters[0]->claimed = true;
+    nextChapter = 1;
+    nextUnclaimedChapter = 1;
+    skipEmptyPages = skipEmpty;
+
+    // leave one core for laying out the first chapter
+    int nThreads = limitValue(GetLogicalCpuCount() - 1, 1, kMaxChapterLayoutThreads);
+    nThreads = std::min(nThreads, n - 1);
+    for (int i = 0; i < nThreads; i++) {
+        auto fn = MkFunc0<EngineEbook>(LayoutChapters, this);
+        HANDLE h = StartThread(fn, "EbookChapterLayoutThread");
+        if (!h) {
+            break;
+        }
+        chapterThreads.Append(h);
+    }
+    logf("EngineEbook::StartChapterLayout: %d chapters, %d threads\n", n, chapterThreads.Size());
+    EbookChapter* first = chapters[0];
+    return StartLayout(CreateFormatter(first->start, first->end, &first->allocator), html.size(), skipEmpty);
+}
+
+// claims chapters in order and lays them out until there are none left
+void EngineEbook::LayoutChapters(EngineEbook* engine) {
+    for (;;) {
+        EbookChapter* chapter = nullptr;
+        {
+            ScopedCritSec scope(&engine->chaptersAccess);
+            int n = engine->chapters.Size();
+            int idx = engine->nextUnclaimedChapter;
+            while (idx < n && engine->chapters[idx]->claimed) {
+                idx++;
             }
-            anchors.Append(PageAnchor(i, pageNo));
-            if (k < 2 && str::StartsWith(i->str.s + i->str.len, "\" page_marker />")) {
-                baseAnchor = i;
+            if (idx >= n || engine->abortLayout.Get()) {
+                return;
             }
+            chapter = engine->chapters[idx];
+            chapter->claimed = true;
+            engine->nextUnclaimedChapter = idx + 1;
+        }
+
+        HtmlFormatter* chapterFormatter = engine->CreateFormatter(chapter->start, chapter->end, &chapter->allocator);
+        while (chapterFormatter && !engine->abortLayout.Get()) {
+            HtmlPage* page = chapterFormatter->Next(engine->skipEmptyPages);
+            if (!page) {
+                break;
+            }
+            chapter->pages.Append(page);
+        }
+        delete chapterFormatter;
+
+        {
+            ScopedCritSec scope(&engine->chaptersAccess);
+            chapter->done = true;
         }
-        baseAnchors.Append(baseAnchor);
+        WakeAllConditionVariable(&engine->chapterLaidOut);
     }
+}
 
-    ReportIf(baseAnchors.size() != pages->size());
+// moves on to the next chapter: either appends its pages, if it has been laid out
+// by a worker thread (waiting for it to finish), or sets formatter to lay it out
+// returns false if there are no more chapters
+// caller must hold formatterAccess
+bool EngineEbook::TakeNextChapter() {
+    if (nextChapter >= chapters.Size()) {
+        return false;
+    }
+    EbookChapter* chapter = chapters[nextChapter++];
+    bool layOutHere = false;
+    {
+        ScopedCritSec scope(&chaptersAccess);
+        while (chapter->claimed && !chapter->done) {
+            SleepConditionVariableCS(&chapterLaidOut, &chaptersAccess, INFINITE);
+        }
+        if (!chapter->claimed) {
+            chapter->claimed = true;
+            layOutHere = true;
+        }
+    }
+    if (abortLayout.Get()) {
+        return false;
+    }
+    if (layOutHere) {
+        formatter = CreateFormatter(chapter->start, chapter->end, &chapter->allocator);
+        return true;
+    }
+
+    ScopedCritSec scope(&pagesAccess);
+    for (HtmlPage* page : chapter->pages) {
+        pages->Append(page);
+        ExtractPageAnchors((int)pages->size());
+    }
+    chapter->pages.Reset();
     return true;
 }
 
+// lays out a single page (or appends all pages of a chapter laid out by
+// a worker thread), returns false once all pages have been laid out
+// caller must hold formatterAccess
+bool EngineEbook::LayoutNextPage() {
+    if (!formatter && nextChapter >= chapters.Size()) {
+        return false;
+    }
+    for (;;) {
+        if (formatter) {
+            HtmlPage* page = formatter->Next(skipEmptyPages);
+            if (page) {
+                ScopedCritSec scope(&pagesAccess);
+                pages->Append(page);
+                ExtractPageAnchors((int)pages->size());
+                return true;
+            }
+            delete formatter;
+            formatter = nullptr;
+        }
+        if (!TakeNextChapter()) {
+            {
+                ScopedCritSec scope(&pagesAccess);
+                layoutDone = true;
+            }
+            SavePaginationCache();
+            return false;
+        }
+        if (!formatter) {
+            return true;
+        }
+    }
+}
+
+// makes sure that pageNo has been laid out, helping out the background
+// thread instead of waiting for it to get there
+// must be called without holding pagesAccess
+void EngineEbook::LayoutUpToPage(int pageNo) {
+    if (IsLaidOut(pageNo)) {
+        return;
+    }
+    ScopedCritSec scope(&formatterAccess);
+    while (!IsLaidOut(pageNo) && LayoutNextPage()) {
+        // keep going
+    }
+}
+
+bool EngineEbook::IsLaidOut(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
+    return layoutDone || !pages || pageNo <= (int)pages->size();
+}
+
+void EngineEbook::LayoutRemainingPages(EngineEbook* engine) {
+    auto timeStart = TimeGet();
+    while (!engine->abortLayout.Get()) {
+        ScopedCritSec scope(&engine->formatterAccess);
+        if (!engine->LayoutNextPage()) {
+            break;
+        }
+    }
+    if (engine->abortLayout.Get()) {
+        return;
+    }
+
+    Func0 fn;
+    {
+        ScopedCritSec scope(&engine->pagesAccess);
+        logf("EngineEbook::LayoutRemainingPages: %d pages (estimated %d) in %.2f ms\n", (int)engine->pages->size(),
+             engine->pageCount, TimeSinceInMs(timeStart));
+        fn = engine->onLaidOut;
+        engine->onLaidOut = {};
+    }
+    fn.Call();
+}
+
+// must be called by subclasses before destroying data the formatter uses
+void EngineEbook::StopLayout() {
+    abortLayout.Set(true);
+    if (layoutThread) {
+        WaitForSingleObject(layoutThread, INFINITE);
+        CloseHandle(layoutThread);
+        layoutThread = nullptr;
+    }
+    for (HANDLE h : chapterThreads) {
+        WaitForSingleObject(h, INFINITE);
+        CloseHandle(h);
+    }
+    chapterThreads.Reset();
+    ScopedCritSec scope(&formatterAccess);
+    delete formatter;
+    formatter = nullptr;
+}
+
+bool EngineEbook::NotifyWhenLaidOut(const Func0& fn) {
+    {
+        ScopedCritSec scope(&pagesAccess);
+        if (!provisionalPageCount) {
+            return false;
+        }
+        if (!layoutDone) {
+            onLaidOut = fn;
+            return true;
+        }
+    }
+    fn.Call();
+    return true;
+}
+
+bool EngineEbook::FinishLayout() {
+    {
+        ScopedCritSec scope(&formatterAccess);
+        while (LayoutNextPage()) {
+            // keep going
+        }
+    }
+
+    ScopedCritSec scope(&pagesAccess);
+    if (!provisionalPageCount) {
+        return false;
+    }
+    provisionalPageCount = false;
+    pageCount = (int)pages->size();
+
+    // links to pages that weren't laid out yet couldn't be resolved
+    for (HtmlPage* page : *pages) {
+        provisionalElements.Append(page->elements);
+        page->elements.Reset();
+        page->gotElements = false;
+    }
+    if (tocTree) {
+        ReportIf(provisionalToc);
+        provisionalToc = tocTree;
+        tocTree = nullptr;
+    }
+    return true;
+}
+
+void EngineEbook::InitFormatterArgs(HtmlFormatterArgs& args) {
+    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
+    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
+    args.SetFontName(GetDefaultFontName());
+    args.fontSize = GetDefaultFontSize();
+    args.textRenderMethod = mui::TextRenderMethod::FreeType;
+}
+
+// page breaks only stay the same for the same file laid out with the same args
+bool EngineEbook::GetPaginationKey(u8 digest[16]) {
+    if (!EngineBase::GetFingerprint(digest)) {
+        return false;
+    }
+    HtmlFormatterArgs args;
+    InitFormatterArgs(args);
+    AutoFreeStr hex = str::MemToHex(digest, 16);
+    TempStr s = str::FormatTemp("%s:%g:%g:%s:%g:%d", hex.Get(), args.pageDx, args.pageDy,
+                                ToUtf8Temp(args.GetFontName()), args.fontSize, (int)args.textRenderMethod);
+    CalcMD5Digest(s, str::Leni(s), digest);
+    return true;
+}
+
+// must be called before StartLayout (or StartChapterLayout)
+void EngineEbook::LoadPaginationCache(size_t htmlLen) {
+    if (!gEbookLazyLayout || !gEbookPaginationCacheDir || htmlLen > INT_MAX) {
+        return;
+    }
+    u8 digest[16];
+    if (!GetPaginationKey(digest)) {
+        return;
+    }
+    AutoFreeStr hex = str::MemToHex(digest, 16);
+    TempStr name = str::JoinTemp(hex, ".pag");
+    paginationCachePath.Set(path::Join(gEbookPaginationCacheDir, name));
+
+    ByteSlice d = file::ReadFile(paginationCachePath);
+    if (d.empty()) {
+        return;
+    }
+    defer {
+        d.Free();
+    };
+    if (d.size() < kPaginationCacheHeaderSize) {
+        return;
+    }
+    ByteReader r(d);
+    if (r.DWordLE(0) != kPaginationCacheMagic || r.DWordLE(4) != kPaginationCacheVersion) {
+        return;
+    }
+    u32 nPages = r.DWordLE(8);
+    if (nPages == 0 || r.DWordLE(12) != (u32)htmlLen ||
+        d.size() != kPaginationCacheHeaderSize + (u64)nPages * sizeof(u32)) {
+        logf("EngineEbook::LoadPaginationCache: '%s' is outdated or corrupted\n", paginationCachePath.Get());
+        return;
+    }
+    // a token too large for a single page might start several pages
+    int prev = 0;
+    for (u32 i = 0; i < nPages; i++) {
+        u32 reparseIdx = r.DWordLE(kPaginationCacheHeaderSize + i * sizeof(u32));
+        if (reparseIdx >= (u32)htmlLen || (int)reparseIdx < prev) {
+            cachedPageStarts.Reset();
+            return;
+        }
+        cachedPageStarts.Append((int)reparseIdx);
+        prev = (int)reparseIdx;
+    }
+    previewPages.AppendBlanks(cachedPageStarts.Size());
+}
+
+// keeps only the kMaxPaginationCacheFiles most recently written files
+static void PrunePaginationCacheDir(const char* dir) {
+    StrVec paths;
+    Vec<FILETIME> times;
+    DirIter di{dir};
+    for (DirIterEntry* de : di) {
+        if (path::Match(de->filePath, "*.pag")) {
+            paths.Append(de->filePath);
+            times.Append(de->fd->ftLastWriteTime);
+        }
+    }
+    while (paths.Size() > kMaxPaginationCacheFiles) {
+        int oldest = 0;
+        for (int i = 1; i < paths.Size(); i++) {
+            if (CompareFileTime(&times[i], &times[oldest]) < 0) {
+                oldest = i;
+            }
+        }
+        file::Delete(paths.At(oldest));
+        paths.RemoveAt(oldest);
+        times.RemoveAt(oldest);
+    }
+}
+
+// called once all pages have been laid out
+void EngineEbook::SavePaginationCache() {
+    if (!paginationCachePath || abortLayout.Get()) {
+        return;
+    }
+    Vec<int> pageStarts;
+    {
+        ScopedCritSec scope(&pagesAccess);
+        for (HtmlPage* page : *pages) {
+            pageStarts.Append(page->reparseIdx);
+        }
+    }
+    if (pageStarts.Size() == 0) {
+        return;
+    }
+    if (pageStarts.Size() == cachedPageStarts.Size() &&
+        memcmp(pageStarts.LendData(), cachedPageStarts.LendData(), pageStarts.size() * sizeof(int)) == 0) {
+        return;
+    }
+
+    ByteWriterLE w(kPaginationCacheHeaderSize + pageStarts.size() * sizeof(u32));
+    w.Write32(kPaginationCacheMagic);
+    w.Write32(kPaginationCacheVersion);
+    w.Write32((u32)pageStarts.Size());
+    w.Write32((u32)layoutHtmlLen);
+    for (int reparseIdx : pageStarts) {
+        w.Write32((u32)reparseIdx);
+    }
+    dir::CreateForFile(paginationCachePath);
+    if (!file::WriteFile(paginationCachePath, w.AsByteSlice())) {
+        logf("EngineEbook::SavePaginationCache: failed to write '%s'\n", paginationCachePath.Get());
+        return;
+    }
+    PrunePaginationCacheDir(gEbookPaginationCacheDir);
+}
+
+// true for pages the layout hasn't reached yet but whose start is known
+// from a previous layout (see LoadPaginationCache)
+bool EngineEbook::CanPreview(int pageNo) {
+    return pageNo >= 1 && pageNo <= cachedPageStarts.Size() && !IsLaidOut(pageNo);
+}
+
+// lays out a single page starting at its cached page break so that it can be
+// rendered without waiting for all the pages before it. As the formatter starts
+// fresh, styles inherited from before the page break might be missing until
+// the page is properly laid out
+HtmlPage* EngineEbook::GetPreviewPage(int pageNo) {
+    if (!CanPreview(pageNo)) {
+        return nullptr;
+    }
+    ScopedCritSec scope(&previewAccess);
+    HtmlPage* page = previewPages[pageNo - 1];
+    if (page) {
+        return page;
+    }
+    HtmlFormatter* f = CreateFormatter(cachedPageStarts[pageNo - 1], (int)layoutHtmlLen, &previewAllocator);
+    if (!f) {
+        return nullptr;
+    }
+    page = f->Next(skipEmptyPages);
+    delete f;
+    previewPages[pageNo - 1] = page;
+    return page;
+}
+
 RectF EngineEbook::Transform(const RectF& rect, int, float zoom, int rotation, bool inverse) {
     RectF rcF = rect; // TODO: un-needed conversion
     auto p1 = Gdiplus::PointF(rcF.x, rcF.y);
@@ -349,12 +967,27 @@ RenderedBitmap* EngineEbook::RenderPage(RenderPageArgs& args) {
         *args.cookie_out = cookie;
     }
 
+    // preview pages are only needed until the layout catches up with them
+    HtmlPage* preview = GetPreviewPage(pageNo);
+    if (!preview) {
+        LayoutUpToPage(pageNo);
+    }
     ScopedCritSec scope(&pagesAccess);
 
-    mui::ITextRender* textDraw = mui::TextRenderGdiplus::Create(&g);
-    DrawHtmlPage(&g, textDraw, GetHtmlPage(pageNo), pageBorder, pageBorder, false, Color((ARGB)Color::Black),
-                 cookie ? &cookie->abort : nullptr);
-    delete textDraw;
+    // pages beyond the end of a provisional layout are rendered blank
+    Vec<DrawInstr>* pageInstrs = preview ? &preview->instructions : GetHtmlPage(pageNo);
+    if (pageInstrs) {
+        mui::ITextRender* textDraw = nullptr;
+        if (mui::TextRenderMethod::FreeType == layoutTextRenderMethod) {
+            // draws with the glyph advances the pages have been laid out with
+            textDraw = mui::TextRenderFreeType::Create(&g);
+        } else {
+            textDraw = mui::TextRenderGdiplus::Create(&g);
+        }
+        DrawHtmlPage(&g, textDraw, pageInstrs, pageBorder, pageBorder, false, Color((ARGB)Color::Black),
+                     cookie ? &cookie->abort : nullptr);
+        delete textDraw;
+    }
     DeleteDC(hDC);
 
     if (cookie && cookie->abort) {
@@ -374,6 +1007,14 @@ static Rect GetInstrBbox(DrawInstr& instr, float pageBorder) {
 
 PageText EngineEbook::ExtractPageText(int pageNo) {
     const WCHAR* lineSep = L"\n";
+    // the text cache asks for the text of every page before rendering it, so this
+    // mustn't lay out all pages before a preview page either. The text is
+    // extracted again once the layout has finished, as the ui then
+    // replaces the DisplayModel and its DocumentTextCache
+    HtmlPage* preview = GetPreviewPage(pageNo);
+    if (!preview) {
+        LayoutUpToPage(pageNo);
+    }
     ScopedCritSec scope(&pagesAccess);
 
     InterlockedIncrement(&gAllowAllocFailure);
@@ -385,7 +1026,10 @@ PageText EngineEbook::ExtractPageText(int pageNo) {
     Vec<Rect> coords;
     bool insertSpace = false;
 
-    Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
+    Vec<DrawInstr>* pageInstrs = preview ? &preview->instructions : GetHtmlPage(pageNo);
+    if (!pageInstrs) {
+        return {};
+    }
     for (DrawInstr& i : *pageInstrs) {
         Rect bbox = GetInstrBbox(i, pageBorder);
         switch (i.type) {
@@ -462,7 +1106,11 @@ IPageElement* EngineEbook::CreatePageLink(DrawInstr* link, Rect rect, int pageNo
         return NewEbookLink(link, rect, nullptr, pageNo);
     }
 
-    DrawInstr* baseAnchor = baseAnchors.at(pageNo - 1);
+    DrawInstr* baseAnchor = nullptr;
+    {
+        ScopedCritSec scope(&pagesAccess);
+        baseAnchor = baseAnchors.at(pageNo - 1);
+    }
     if (baseAnchor) {
         char* basePath = str::DupTemp(baseAnchor->str.s, baseAnchor->str.len);
         TempStr relPath = ResolveHtmlEntitiesTemp(link->str.s, link->str.len);
@@ -478,7 +1126,20 @@ IPageElement* EngineEbook::CreatePageLink(DrawInstr* link, Rect rect, int pageNo
 }
 
 Vec<IPageElement*> EngineEbook::GetElements(int pageNo) {
-    HtmlPage* pi = GetHtmlPage2(pageNo);
+    // don't block on pages that are rendered as previews, they get
+    // their links and images once they've been laid out
+    if (CanPreview(pageNo)) {
+        return {};
+    }
+    LayoutUpToPage(pageNo);
+    HtmlPage* pi = nullptr;
+    {
+        ScopedCritSec scope(&pagesAccess);
+        pi = GetHtmlPage2(pageNo);
+    }
+    if (!pi) {
+        return {};
+    }
     if (pi->gotElements) {
         return pi->elements;
     }
@@ -521,7 +1182,11 @@ RenderedBitmap* EngineEbook::GetImageForPageElement(IPageElement* iel) {
     PageElementImage* el = (PageElementImage*)iel;
     int pageNo = el->pageNo;
     int idx = el->imageID;
+    ScopedCritSec scope(&pagesAccess);
     Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
+    if (!pageInstrs) {
+        return nullptr;
+    }
     auto&& i = pageInstrs->at(idx);
     ReportIf(i.type != DrawInstrType::Image);
     return getImageFromData(i.GetImage());
@@ -539,7 +1204,10 @@ IPageElement* EngineEbook::GetElementAtPos(int pageNo, PointF pt) {
     return nullptr;
 }
 
+// note: while laying out in the background, this doesn't find
+// destinations on pages that haven't been laid out yet
 IPageDestination* EngineEbook::GetNamedDest(const char* name) {
+    ScopedCritSec scope(&pagesAccess);
     const char* id = name;
     if (str::FindChar(id, '#')) {
         id = str::FindChar(id, '#') + 1;
@@ -596,7 +1264,8 @@ TempStr EngineEbook::ExtractFontListTemp() {
     Vec<mui::CachedFont*> seenFonts;
     StrVec fonts;
 
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+    int nPages = (int)pages->size();
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
         Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
         if (!pageInstrs) {
             continue;
@@ -728,11 +1397,12 @@ class EngineEpub : public EngineEbook {
   protected:
     EpubDoc* doc = nullptr;
     IStream* stream = nullptr;
-    TocTree* tocTree = nullptr;
 
     bool Load(const char* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+
+    HtmlFormatter* CreateFormatter(int reparseIdx, int htmlEnd, Allocator* textAllocator) override;
 };
 
 EngineEpub::EngineEpub() : EngineEbook() {
@@ -741,8 +1411,8 @@ EngineEpub::EngineEpub() : EngineEbook() {
 }
 
 EngineEpub::~EngineEpub() {
+    StopLayout();
     delete doc;
-    delete tocTree;
     if (stream) {
         stream->Release();
     }
@@ -785,20 +1455,8 @@ bool EngineEpub::FinishLoading() {
         return false;
     }
 
-    HtmlFormatterArgs args{};
-    args.htmlStr = doc->GetHtmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
-
-    pages = EpubFormatter(&args, doc).FormatAllPages(false);
-
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    LoadPaginationCache(doc->GetHtmlData().size());
+    if (!StartChapterLayout(doc->GetHtmlData(), doc->GetChapterStarts(), false)) {
         return false;
     }
 
@@ -810,6 +1468,19 @@ bool EngineEpub::FinishLoading() {
     return pageCount > 0;
 }
 
+// each spine item is laid out by its own formatter, see StartChapterLayout
+HtmlFormatter* EngineEpub::CreateFormatter(int reparseIdx, int htmlEnd, Allocator* textAllocator) {
+    ByteSlice html = doc->GetHtmlData();
+    HtmlFormatterArgs args{};
+    InitFormatterArgs(args);
+    // the formatter stops at the end of the chapter, but reparseIdx of
+    // its pages are offsets into the whole html, like for other engines
+    args.htmlStr = ByteSlice(html.data(), htmlEnd);
+    args.reparseIdx = reparseIdx;
+    args.textAllocator = textAllocator;
+    return new EpubFormatter(&args, doc);
+}
+
 ByteSlice EngineEpub::GetFileData() {
     const char* path = FilePath();
     return GetStreamOrFileData(stream, path);
@@ -882,7 +1553,7 @@ class EngineFb2 : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".fb2");
     }
     ~EngineFb2() override {
-        delete tocTree;
+        StopLayout();
         delete doc;
     }
     EngineBase* Clone() override {
@@ -907,11 +1578,11 @@ class EngineFb2 : public EngineEbook {
 
   protected:
     Fb2Doc* doc = nullptr;
-    TocTree* tocTree = nullptr;
 
     bool Load(const char* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+    HtmlFormatter* CreateFormatter(int reparseIdx, int htmlEnd, Allocator* textAllocator) override;
 };
 
 bool EngineFb2::Load(const char* fileName) {
@@ -930,28 +1601,27 @@ bool EngineFb2::FinishLoading() {
         return false;
     }
 
-    HtmlFormatterArgs args;
-    args.htmlStr = doc->GetXmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
-
     if (doc->IsZipped()) {
         str::ReplaceWithCopy(&defaultExt, ".fb2z");
     }
 
-    pages = Fb2Formatter(&args, doc).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    int len = (int)doc->GetXmlData().size();
+    LoadPaginationCache(len);
+    if (!StartLayout(CreateFormatter(0, len, &allocator), len, false)) {
         return false;
     }
     return pageCount > 0;
 }
 
+HtmlFormatter* EngineFb2::CreateFormatter(int reparseIdx, int htmlEnd, Allocator* textAllocator) {
+    HtmlFormatterArgs args;
+    InitFormatterArgs(args);
+    args.htmlStr = ByteSlice(doc->GetXmlData().data(), htmlEnd);
+    args.reparseIdx = reparseIdx;
+    args.textAllocator = textAllocator;
+    return new Fb2Formatter(&args, doc);
+}
+
 TocTree* EngineFb2::GetToc() {
     if (tocTree) {
         return tocTree;
@@ -1005,7 +1675,7 @@ class EngineMobi : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".mobi");
     }
     ~EngineMobi() override {
-        delete tocTree;
+        StopLayout();
         delete doc;
     }
     EngineBase* Clone() override {
@@ -1031,11 +1701,11 @@ class EngineMobi : public EngineEbook {
 
   protected:
     MobiDoc* doc = nullptr;
-    TocTree* tocTree = nullptr;
 
     bool Load(const char* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+    HtmlFormatter* CreateFormatter(int reparseIdx, int htmlEnd, Allocator* textAllocator) override;
 };
 
 bool EngineMobi::Load(const char* fileName) {
@@ -1054,37 +1724,28 @@ bool EngineMobi::FinishLoading() {
         return false;
     }
 
-    HtmlFormatterArgs args;
-    args.htmlStr = doc->GetHtmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
-
-    pages = MobiFormatter(&args, doc).FormatAllPages();
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    int len = (int)doc->GetHtmlData().size();
+    LoadPaginationCache(len);
+    if (!StartLayout(CreateFormatter(0, len, &allocator), len, true)) {
         return false;
     }
     return pageCount > 0;
 }
 
+HtmlFormatter* EngineMobi::CreateFormatter(int reparseIdx, int htmlEnd, Allocator* textAllocator) {
+    HtmlFormatterArgs args;
+    InitFormatterArgs(args);
+    args.htmlStr = ByteSlice(doc->GetHtmlData().data(), htmlEnd);
+    args.reparseIdx = reparseIdx;
+    args.textAllocator = textAllocator;
+    return new MobiFormatter(&args, doc);
+}
+
 IPageDestination* EngineMobi::GetNamedDest(const char* name) {
     int filePos = atoi(name);
     if (filePos < 0 || 0 == filePos && *name != '0') {
         return nullptr;
     }
-    int pageNo;
-    for (pageNo = 1; pageNo < PageCount(); pageNo++) {
-        if (pages->at(pageNo)->reparseIdx > filePos) {
-            break;
-        }
-    }
-    ReportIf(pageNo < 1 || pageNo > PageCount());
-
     ByteSlice htmlData = doc->GetHtmlData();
     size_t htmlLen = htmlData.size();
     const char* start = (const char*)htmlData.data();
@@ -1093,6 +1754,19 @@ IPageDestination* EngineMobi::GetNamedDest(const char* name) {
     }
 
     ScopedCritSec scope(&pagesAccess);
+    // pages that haven't been laid out yet can't be linked to
+    int nPages = (int)pages->size();
+    if (!layoutDone && (nPages == 0 || pages->Last()->reparseIdx <= filePos)) {
+        return nullptr;
+    }
+    int pageNo;
+    for (pageNo = 1; pageNo < nPages; pageNo++) {
+        if (pages->at(pageNo)->reparseIdx > filePos) {
+            break;
+        }
+    }
+    ReportIf(pageNo < 1 || pageNo > nPages);
+
     Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
     // link to the bottom of the page, if filePos points
     // beyond the last visible DrawInstr of a page
@@ -1160,7 +1834,7 @@ class EnginePdb : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".pdb");
     }
     ~EnginePdb() override {
-        delete tocTree;
+        StopLayout();
         delete doc;
     }
     EngineBase* Clone() override {
@@ -1184,7 +1858,6 @@ class EnginePdb : public EngineEbook {
 
   protected:
     PalmDoc* doc = nullptr;
-    TocTree* tocTree = nullptr;
 
     bool Load(const char* fileName);
 };
@@ -1204,12 +1877,9 @@ bool EnginePdb::Load(const char* fileName) {
     args.SetFontName(GetDefaultFontName());
     args.fontSize = GetDefaultFontSize();
     args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
+    args.textRenderMethod = mui::TextRenderMethod::FreeType;
 
-    pages = HtmlFormatter(&args).FormatAllPages();
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    if (!StartLayout(new HtmlFormatter(&args), args.htmlStr.size(), true)) {
         return false;
     }
 
@@ -1381,9 +2051,9 @@ class EngineChm : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".chm");
     }
     ~EngineChm() override {
+        StopLayout();
         delete dataCache;
         delete doc;
-        delete tocTree;
     }
     EngineBase* Clone() override {
         const char* fileName = FilePath();
@@ -1408,7 +2078,6 @@ class EngineChm : public EngineEbook {
   protected:
     ChmFile* doc = nullptr;
     ChmDataCache* dataCache = nullptr;
-    TocTree* tocTree = nullptr;
 
     bool Load(const char* fileName);
 
@@ -1536,12 +2205,9 @@ bool EngineChm::Load(const char* fileName) {
     args.SetFontName(GetDefaultFontName());
     args.fontSize = GetDefaultFontSize();
     args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
+    args.textRenderMethod = mui::TextRenderMethod::FreeType;
 
-    pages = ChmFormatter(&args, dataCache).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    if (!StartLayout(new ChmFormatter(&args, dataCache), args.htmlStr.size(), false)) {
         return false;
     }
 
@@ -1637,6 +2303,7 @@ class EngineHtml : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".html");
     }
     ~EngineHtml() override {
+        StopLayout();
         delete doc;
     }
     EngineBase* Clone() override {
@@ -1681,10 +2348,7 @@ bool EngineHtml::Load(const char* fileName) {
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethod::Gdiplus;
 
-    pages = HtmlFileFormatter(&args, doc).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    if (!StartLayout(new HtmlFileFormatter(&args, doc), args.htmlStr.size(), false)) {
         return false;
     }
 
@@ -1742,7 +2406,7 @@ class EngineTxt : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".txt");
     }
     ~EngineTxt() override {
-        delete tocTree;
+        StopLayout();
         delete doc;
     }
     EngineBase* Clone() override {
@@ -1766,7 +2430,6 @@ class EngineTxt : public EngineEbook {
 
   protected:
     TxtDoc* doc = nullptr;
-    TocTree* tocTree = nullptr;
 
     bool Load(const char* fileName);
 };
@@ -1799,10 +2462,7 @@ bool EngineTxt::Load(const char* fileName) {
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethod::Gdiplus;
 
-    pages = TxtFormatter(&args).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    if (!StartLayout(new TxtFormatter(&args), args.htmlStr.size(), false)) {
         return false;
     }
 
@@ -1838,4 +2498,5 @@ EngineBase* CreateEngineTxtFromFile(const char* fileName) {
 
 void EngineEbookCleanup() {
     gDefaultFontName.Reset();
+    gEbookPaginationCacheDir.Reset();
 }
@@ -12,6 +12,7 @@
 #include "utils/JsonParser.h"
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
+#include "utils/ThreadUtil.h"
 #include "utils/DirIter.h"
 
 #include "wingui/UIModels.h"
@@ -49,8 +50,14 @@ Kind kindEngineImage = "engineImage";
 Kind kindEngineImageDir = "engineImageDir";
 Kind kindEngineComicBooks = "engineComicBooks";
 
-// number of decoded bitmaps to cache for quicker rendering
-#define MAX_IMAGE_PAGE_CACHE 10
+// max. size of decoded bitmaps to cache for quicker rendering
+constexpr size_t kImagePageCacheMaxSize = 256 * 1024 * 1024;
+
+// number of pages to decode on background threads ahead of (in reading
+// direction) and behind the last rendered page
+constexpr int kPrefetchPagesAhead = 3;
+constexpr int kPrefetchPagesBehind = 1;
+constexpr int kPrefetchThreads = 2;
 
 ///// EngineImages methods apply to all types of engines handling full-page images /////
 
@@ -59,6 +66,10 @@ struct ImagePage {
     Bitmap* bmp = nullptr;
     bool ownBmp = true;
     int refs = 1;
+    // size of decoded bitmap, counts towards kImagePageCacheMaxSize
+    size_t size = 0;
+    // bmp is being loaded by another thread
+    bool isLoading = false;
 
     ImagePage(int pageNo, Bitmap* bmp) {
         this->pageNo = pageNo;
@@ -109,9 +120,24 @@ class EngineImages : public EngineBase {
     ScopedComPtr<IStream> fileStream;
 
     CRITICAL_SECTION cacheAccess;
+    CONDITION_VARIABLE pageLoaded;
     Vec<ImagePage*> pageCache;
+    size_t pageCacheSize = 0;
     Vec<ImagePageInfo*> pages;
 
+    // set by engines whose LoadBitmapForPage() can be called from multiple
+    // threads at once. Enables decoding pages around the last rendered
+    // page on background threads. Such engines must call StopPrefetching()
+    // in their destructor
+    bool prefetchPages = false;
+    // serializes LoadBitmapForPage() calls if !prefetchPages
+    CRITICAL_SECTION loadAccess;
+    CONDITION_VARIABLE pagesQueued;
+    Vec<int> pagesToPrefetch;
+    Vec<HANDLE> prefetchThreads;
+    bool stopPrefetching = false;
+    int lastRenderedPageNo = 0;
+
     void GetTransform(Matrix& m, int pageNo, float zoom, int rotation);
 
     virtual Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) = 0;
@@ -119,6 +145,12 @@ class EngineImages : public EngineBase {
 
     ImagePage* GetPage(int pageNo, bool tryOnly = false);
     void DropPage(ImagePage* page, bool forceRemove);
+    ImagePage* FindCachedPage(int pageNo);
+    void ShrinkPageCache(ImagePage* keep);
+    bool IsPageCacheFull();
+
+    void PrefetchPagesAround(int pageNo);
+    void StopPrefetching();
 
     RectF PageContentBox(int pageNo, RenderTarget) override;
 };
@@ -131,9 +163,13 @@ EngineImages::EngineImages() {
     isImageCollection = true;
 
     InitializeCriticalSection(&cacheAccess);
+    InitializeCriticalSection(&loadAccess);
+    InitializeConditionVariable(&pageLoaded);
+    InitializeConditionVariable(&pagesQueued);
 }
 
 EngineImages::~EngineImages() {
+    StopPrefetching();
     EnterCriticalSection(&cacheAccess);
     while (pageCache.size() > 0) {
         ImagePage* lastPage = pageCache.Last();
@@ -143,6 +179,7 @@ EngineImages::~EngineImages() {
     DeleteVecMembers(pages);
     LeaveCriticalSection(&cacheAccess);
     DeleteCriticalSection(&cacheAccess);
+    DeleteCriticalSection(&loadAccess);
 }
 
 RectF EngineImages::PageMediabox(int pageNo) {
@@ -167,6 +204,7 @@ RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
     if (!page) {
         return nullptr;
     }
+    PrefetchPagesAround(pageNo);
 
     auto timeStart = TimeGet();
     defer {
@@ -321,44 +359,92 @@ bool EngineImages::SaveFileAs(const char* dstPath) {
     return file::WriteFile(dstPath, d);
 }
 
-ImagePage* EngineImages::GetPage(int pageNo, bool tryOnly) {
+static size_t DecodedBitmapSize(Bitmap* bmp) {
+    if (!bmp) {
+        return 0;
+    }
+    size_t bpp = Gdiplus::GetPixelFormatSize(bmp->GetPixelFormat());
+    return (size_t)bmp->GetWidth() * (size_t)bmp->GetHeight() * bpp / 8;
+}
+
+ImagePage* EngineImages::FindCachedPage(int pageNo) {
     ScopedCritSec scope(&cacheAccess);
+    for (ImagePage* page : pageCache) {
+        if (page->pageNo == pageNo) {
+            return page;
+        }
+    }
+    return nullptr;
+}
 
-    ImagePage* result = nullptr;
+bool EngineImages::IsPageCacheFull() {
+    ScopedCritSec scope(&cacheAccess);
+    return pageCacheSize >= kImagePageCacheMaxSize;
+}
 
-    for (size_t i = 0; i < pageCache.size(); i++) {
-        if (pageCache.at(i)->pageNo == pageNo) {
-            result = pageCache.at(i);
-            break;
+// drop least recently used pages until the cache fits within kImagePageCacheMaxSize
+// pages that are in use (or are being loaded) are kept
+void EngineImages::ShrinkPageCache(ImagePage* keep) {
+    ScopedCritSec scope(&cacheAccess);
+    for (int i = pageCache.Size() - 1; i >= 0 && pageCacheSize > kImagePageCacheMaxSize; i--) {
+        ImagePage* page = pageCache.at(i);
+        if (page == keep || page->isLoading || page->refs > 1) {
+            continue;
         }
+        DropPage(page, true);
     }
+}
+
+ImagePage* EngineImages::GetPage(int pageNo, bool tryOnly) {
+    ScopedCritSec scope(&cacheAccess);
+
+    ImagePage* result = FindCachedPage(pageNo);
     if (!result && tryOnly) {
         return nullptr;
     }
 
     if (!result) {
-        // TODO: drop most memory intensive pages first
-        if (pageCache.size() >= MAX_IMAGE_PAGE_CACHE) {
-            ReportIf(pageCache.size() != MAX_IMAGE_PAGE_CACHE);
-            DropPage(pageCache.Last(), true);
-        }
         result = new ImagePage(pageNo, nullptr);
-        result->bmp = LoadBitmapForPage(pageNo, result->ownBmp);
-        pageCache.InsertAt(0, result);
-    } else if (result != pageCache.at(0)) {
-        // keep the list Most Recently Used first
-        pageCache.Remove(result);
+        result->isLoading = true;
+        result->refs++;
         pageCache.InsertAt(0, result);
+
+        // decode without holding cacheAccess so that cached pages
+        // can be rendered while other pages are being decoded
+        LeaveCriticalSection(&cacheAccess);
+        bool ownBmp = true;
+        Bitmap* bmp = nullptr;
+        if (prefetchPages) {
+            bmp = LoadBitmapForPage(pageNo, ownBmp);
+        } else {
+            ScopedCritSec scopeLoad(&loadAccess);
+            bmp = LoadBitmapForPage(pageNo, ownBmp);
+        }
+        EnterCriticalSection(&cacheAccess);
+
+        result->bmp = bmp;
+        result->ownBmp = ownBmp;
+        result->size = ownBmp ? DecodedBitmapSize(bmp) : 0;
+        result->isLoading = false;
+        pageCacheSize += result->size;
+        WakeAllConditionVariable(&pageLoaded);
+        ShrinkPageCache(result);
+    } else {
+        result->refs++;
+        while (result->isLoading) {
+            SleepConditionVariableCS(&pageLoaded, &cacheAccess, INFINITE);
+        }
+        if (pageCache.size() > 0 && result != pageCache.at(0) && pageCache.Remove(result) >= 0) {
+            // keep the list Most Recently Used first
+            pageCache.InsertAt(0, result);
+        }
     }
+
     // return nullptr if a page failed to load
-    if (result && !result->bmp) {
+    if (!result->bmp) {
+        DropPage(result, false);
         return nullptr;
     }
-    if (!result) {
-        return nullptr;
-    }
-
-    result->refs++;
     return result;
 }
 
@@ -368,7 +454,9 @@ void EngineImages::DropPage(ImagePage* page, bool forceRemove) {
     ReportIf(page->refs < 0);
 
     if (0 == page->refs || forceRemove) {
-        pageCache.Remove(page);
+        if (pageCache.Remove(page) >= 0) {
+            pageCacheSize -= page->size;
+        }
     }
 
     if (0 == page->refs) {
@@ -379,6 +467,77 @@ void EngineImages::DropPage(ImagePage* page, bool forceRemove) {
     }
 }
 
+static void ImagePrefetchThread(EngineImages* engine) {
+    for (;;) {
+        int pageNo;
+        {
+            ScopedCritSec scope(&engine->cacheAccess);
+            while (!engine->stopPrefetching && engine->pagesToPrefetch.IsEmpty()) {
+                SleepConditionVariableCS(&engine->pagesQueued, &engine->cacheAccess, INFINITE);
+            }
+            if (engine->stopPrefetching) {
+                return;
+            }
+            pageNo = engine->pagesToPrefetch.PopAt(0);
+        }
+        ImagePage* page = engine->GetPage(pageNo);
+        if (page) {
+            engine->DropPage(page, false);
+        }
+    }
+}
+
+// queue pages the user is likely to look at next so that
+// they're already decoded when they have to be rendered
+void EngineImages::PrefetchPagesAround(int pageNo) {
+    if (!prefetchPages) {
+        return;
+    }
+
+    ScopedCritSec scope(&cacheAccess);
+    if (stopPrefetching || pageNo == lastRenderedPageNo) {
+        return;
+    }
+    int dir = pageNo >= lastRenderedPageNo ? 1 : -1;
+    lastRenderedPageNo = pageNo;
+
+    pagesToPrefetch.Reset();
+    for (int i = 1; i <= kPrefetchPagesAhead + kPrefetchPagesBehind; i++) {
+        int n = i <= kPrefetchPagesAhead ? pageNo + dir * i : pageNo - dir * (i - kPrefetchPagesAhead);
+        if (n < 1 || n > pageCount || FindCachedPage(n)) {
+            continue;
+        }
+        pagesToPrefetch.Append(n);
+    }
+    if (pagesToPrefetch.IsEmpty()) {
+        return;
+    }
+
+    while (prefetchThreads.Size() < kPrefetchThreads) {
+        auto fn = MkFunc0<EngineImages>(ImagePrefetchThread, this);
+        HANDLE h = StartThread(fn, "ImagePrefetchThread");
+        if (!h) {
+            break;
+        }
+        prefetchThreads.Append(h);
+    }
+    WakeAllConditionVariable(&pagesQueued);
+}
+
+void EngineImages::StopPrefetching() {
+    EnterCriticalSection(&cacheAccess);
+    stopPrefetching = true;
+    pagesToPrefetch.Reset();
+    WakeAllConditionVariable(&pagesQueued);
+    LeaveCriticalSection(&cacheAccess);
+
+    for (HANDLE h : prefetchThreads) {
+        WaitForSingleObject(h, INFINITE);
+        CloseHandle(h);
+    }
+    prefetchThreads.Reset();
+}
+
 // Get content box for image by cropping out margins of similar color
 RectF EngineImages::PageContentBox(int pageNo, RenderTarget target) {
     // try to load bitmap for the image
@@ -726,7 +885,7 @@ RectF EngineImage::LoadMediabox(int pageNo) {
     }
 
     // fill the cache to prevent the first few frames from being unpacked twice
-    ImagePage* page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.size());
+    ImagePage* page = GetPage(pageNo, IsPageCacheFull());
     if (page) {
         RectF mbox(0, 0, (float)page->bmp->GetWidth(), (float)page->bmp->GetHeight());
         DropPage(page, false);
@@ -803,9 +962,11 @@ class EngineImageDir : public EngineImages {
         // TODO: is there a better place to expose pageFileNames
         // than through page labels?
         hasPageLabels = true;
+        prefetchPages = true;
     }
 
     ~EngineImageDir() override {
+        StopPrefetching();
         delete tocTree;
     }
 
@@ -1120,7 +1281,8 @@ class EngineCbx : public EngineImages {
 
     ByteSlice GetImageData(int pageNo);
 
-    // access to cbxFile must be protected after initialization (with cacheAccess)
+    // access to cbxFile must be protected after initialization (with archiveAccess)
+    CRITICAL_SECTION archiveAccess;
     MultiFormatArchive* cbxFile = nullptr;
     Vec<MultiFormatArchive::FileInfo*> files;
     TocTree* tocTree = nullptr;
@@ -1132,11 +1294,15 @@ class EngineCbx : public EngineImages {
 EngineCbx::EngineCbx(MultiFormatArchive* arch) {
     cbxFile = arch;
     kind = kindEngineComicBooks;
+    prefetchPages = true;
+    InitializeCriticalSection(&archiveAccess);
 }
 
 EngineCbx::~EngineCbx() {
+    StopPrefetching();
     delete tocTree;
     delete cbxFile;
+    DeleteCriticalSection(&archiveAccess);
 }
 
 EngineBase* EngineCbx::Clone() {
@@ -1238,11 +1404,17 @@ bool EngineCbx::FinishLoading() {
         }
     }
 
+    // read before starting the background decode so that we don't
+    // have to wait for it to reach ComicInfo.xml in a solid archive
     ByteSlice metadata = cbxFile->GetFileDataByName("ComicInfo.xml");
     if (metadata) {
         cip.Parse(metadata);
         metadata.Free();
     }
+
+    // for solid .cbr/.cb7 files, decoding all pages in one pass is much faster
+    // than decoding from the start of the solid block for every page
+    cbxFile->DecodeSolidInBackground();
     const char* comment = cbxFile->GetComment();
     if (comment) {
         json::Parse(comment, &cip);
@@ -1295,6 +1467,7 @@ TocTree* EngineCbx::GetToc() {
 ByteSlice EngineCbx::GetImageData(int pageNo) {
     ReportIf((pageNo < 1) || (pageNo > PageCount()));
     size_t fileId = files[pageNo - 1]->fileId;
+    ScopedCritSec scope(&archiveAccess);
     ByteSlice d = cbxFile->GetFileDataById(fileId);
     return d;
 }
@@ -1345,7 +1518,31 @@ Bitmap* EngineCbx::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
     return res;
 }
 
+// most image formats store the size within the first few bytes but
+// jpeg files can have large EXIF/ICC segments before the frame header
+static const size_t kImageHeaderProbeSizes[] = {4 * 1024, 64 * 1024};
+
 RectF EngineCbx::LoadMediabox(int pageNo) {
+    // avoid uncompressing the whole image just to get its size
+    size_t fileId = files[pageNo - 1]->fileId;
+    for (size_t probeSize : kImageHeaderProbeSizes) {
+        ByteSlice hdr;
+        {
+            ScopedCritSec scope(&archiveAccess);
+            hdr = cbxFile->GetFileDataPartById(fileId, probeSize);
+        }
+        Size size = BitmapSizeFromHeader(hdr);
+        size_t hdrSize = hdr.size();
+        hdr.Free();
+        if (!size.IsEmpty()) {
+            return RectF(0, 0, (float)size.dx, (float)size.dy);
+        }
+        if (hdrSize < probeSize) {
+            // got the whole file, no point in trying a bigger probe
+            break;
+        }
+    }
+
     ByteSlice img = GetImageData(pageNo);
     if (!img.empty()) {
         Size size = BitmapSizeFromData(img);
@@ -1358,7 +1555,7 @@ RectF EngineCbx::LoadMediabox(int pageNo) {
     }
     img.Free();
 
-    ImagePage* page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.size());
+    ImagePage* page = GetPage(pageNo, IsPageCacheFull());
     if (page) {
         RectF mbox(0, 0, (float)page->bmp->GetWidth(), (float)page->bmp->GetHeight());
         DropPage(page, false);
@@ -19,6 +19,7 @@ extern "C" {
 #include "utils/TrivialHtmlParser.h"
 #include "utils/WinUtil.h"
 #include "utils/ZipUtil.h"
+#include "utils/ThreadUtil.h"
 #include "utils/Timer.h"
 
 #include "wingui/UIModels.h"
@@ -396,6 +397,194 @@ static fz_stream* FzOpenIStream(fz_context* ctx, IStream* stream) {
     return stm;
 }
 
+// a stream that reads directly from a memory-mapped file, without copying the data.
+// pages are loaded on demand by the OS and are shared with the file cache,
+// so unlike a copy they don't add to the private memory of the process
+struct mapped_file_state {
+    HANDLE hFile;
+    HANDLE hMap;
+    u8* view;
+    u8* data; // start of the stream data, can be after the start of the file
+    i64 size;
+};
+
+// all data is available from the start, there's nothing more to read
+extern "C" int next_mapped_file(fz_context*, fz_stream*, size_t) {
+    return EOF;
+}
+
+extern "C" void seek_mapped_file(fz_context*, fz_stream* stm, i64 offset, int whence) {
+    mapped_file_state* state = (mapped_file_state*)stm->state;
+    if (whence == 1) {
+        offset += stm->rp - state->data;
+    } else if (whence == 2) {
+        offset += state->size;
+    }
+    offset = std::clamp(offset, (i64)0, state->size);
+    stm->rp = state->data + offset;
+}
+
+extern "C" void drop_mapped_file(fz_context* ctx, void* state_) {
+    mapped_file_state* state = (mapped_file_state*)state_;
+    UnmapViewOfFile(state->view);
+    CloseHandle(state->hMap);
+    CloseHandle(state->hFile);
+    fz_free(ctx, state);
+}
+
+#if defined(_WIN64)
+constexpr i64 kMaxMappedFileSize = INT64_MAX;
+#else
+// 32-bit processes only have 2 GB of address space for all documents
+constexpr i64 kMaxMappedFileSize = 256 * 1024 * 1024;
+#endif
+
+// other programs can't truncate or overwrite a mapped file, which breaks
+// regenerating a document while it's open (and auto-reloading it), so
+// mapping is opt-in, see SetMupdfMapLargeFiles()
+static bool gMapLargeFiles = false;
+
+void SetMupdfMapLargeFiles(bool enable) {
+    gMapLargeFiles = enable;
+}
+
+// even then, LaTeX must be able to overwrite a .pdf that has
+// a synchronization file next to it
+static bool HasSyncFile(const char* path) {
+    TempStr pathNoExt = path::GetPathNoExtTemp(path);
+    const char* exts[] = {".synctex", ".synctex.gz", ".pdfsync"};
+    for (const char* ext : exts) {
+        if (file::Exists(str::JoinTemp(pathNoExt, ext))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// skips the first <offset> bytes of the file
+// returns nullptr if the file can't or shouldn't be mapped
+static fz_stream* FzOpenMappedFile(fz_context* ctx, const char* path, i64 offset) {
+    // reading mapped memory raises an exception instead of returning an error
+    // if the data can't be read, so only do it for files on local drives
+    if (!gMapLargeFiles || !path::IsOnFixedDrive(path) || HasSyncFile(path)) {
+        return nullptr;
+    }
+    WCHAR* pathW = ToWStrTemp(path);
+    // allow other programs to read and write the file, like fz_open_file_w()
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE;
+    HANDLE hFile = CreateFileW(pathW, GENERIC_READ, share, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    LARGE_INTEGER fileSize{};
+    if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart <= offset || fileSize.QuadPart > kMaxMappedFileSize) {
+        CloseHandle(hFile);
+        return nullptr;
+    }
+    HANDLE hMap = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    u8* view = hMap ? (u8*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        if (hMap) {
+            CloseHandle(hMap);
+        }
+        CloseHandle(hFile);
+        return nullptr;
+    }
+
+    mapped_file_state* state = nullptr;
+    fz_stream* stm = nullptr;
+    fz_var(state);
+    fz_try(ctx) {
+        state = fz_malloc_struct(ctx, mapped_file_state);
+        state->hFile = hFile;
+        state->hMap = hMap;
+        state->view = view;
+        state->data = view + offset;
+        state->size = fileSize.QuadPart - offset;
+        stm = fz_new_stream(ctx, state, next_mapped_file, drop_mapped_file);
+        stm->seek = seek_mapped_file;
+        stm->rp = state->data;
+        stm->wp = state->data + state->size;
+        stm->pos = state->size;
+    }
+    fz_catch(ctx) {
+        fz_free(ctx, state);
+        UnmapViewOfFile(view);
+        CloseHandle(hMap);
+        CloseHandle(hFile);
+        fz_report_error(ctx);
+        return nullptr;
+    }
+    return stm;
+}
+
+// returns the data of a memory-mapped stream without copying it
+static ByteSlice FzMappedStreamData(fz_stream* stm) {
+    if (!stm || stm->seek != seek_mapped_file) {
+        return {};
+    }
+    mapped_file_state* state = (mapped_file_state*)stm->state;
+    return {state->data, (size_t)state->size};
+}
+
+// simulates reading from a slow network share on a local drive, see SetMupdfReadThrottle()
+static int gReadThrottleKBps = 0;
+static int gReadThrottleLatencyMs = 0;
+
+void SetMupdfReadThrottle(int kbPerSec, int latencyMs) {
+    gReadThrottleKBps = kbPerSec;
+    gReadThrottleLatencyMs = latencyMs;
+}
+
+// a stream that waits for gReadThrottleLatencyMs plus the time it would take to
+// transfer the data at gReadThrottleKBps for every read from the file
+struct throttled_file_state {
+    fz_stream* file;
+    u8 buf[64 * 1024];
+};
+
+extern "C" int next_throttled_file(fz_context* ctx, fz_stream* stm, size_t) {
+    throttled_file_state* state = (throttled_file_state*)stm->state;
+    size_t n = fz_read(ctx, state->file, state->buf, sizeof(state->buf));
+    i64 bytesPerSec = std::max((i64)gReadThrottleKBps, (i64)1) * 1024;
+    i64 ms = gReadThrottleLatencyMs + (i64)n * 1000 / bytesPerSec;
+    Sleep((DWORD)ms);
+    stm->rp = state->buf;
+    stm->wp = state->buf + n;
+    stm->pos += (i64)n;
+    return n > 0 ? *stm->rp++ : EOF;
+}
+
+extern "C" void seek_throttled_file(fz_context* ctx, fz_stream* stm, i64 offset, int whence) {
+    throttled_file_state* state = (throttled_file_state*)stm->state;
+    fz_seek(ctx, state->file, offset, whence);
+    stm->pos = fz_tell(ctx, state->file);
+    stm->rp = state->buf;
+    stm->wp = state->buf;
+}
+
+extern "C" void drop_throttled_file(fz_context* ctx, void* state_) {
+    throttled_file_state* state = (throttled_file_state*)state_;
+    fz_drop_stream(ctx, state->file);
+    fz_free(ctx, state);
+}
+
+// takes ownership of file
+static fz_stream* FzOpenThrottledFile(fz_context* ctx, fz_stream* file) {
+    throttled_file_state* state = nullptr;
+    fz_try(ctx) {
+        state = fz_malloc_struct(ctx, throttled_file_state);
+    }
+    fz_catch(ctx) {
+        fz_drop_stream(ctx, file);
+        fz_rethrow(ctx);
+    }
+    state->file = file;
+    fz_stream* stm = fz_new_stream(ctx, state, next_throttled_file, drop_throttled_file);
+    stm->seek = seek_throttled_file;
+    return stm;
+}
+
 static void* FzMemdup(fz_context* ctx, void* p, size_t size) {
     void* res = fz_malloc_no_throw(ctx, size);
     if (!res) {
@@ -478,6 +667,11 @@ static fz_stream* FzReadMaybeFixPDF(fz_context* ctx, const char* path) {
         return nullptr;
     }
 
+    stm = FzOpenMappedFile(ctx, path, n);
+    if (stm) {
+        return stm;
+    }
+
     ByteSlice d = file::ReadFile(path);
     if (d.empty()) {
         // failed to read
@@ -492,14 +686,30 @@ static fz_stream* FzReadMaybeFixPDF(fz_context* ctx, const char* path) {
     return stm;
 }
 
-static fz_stream* FzOpenOrReadFile(fz_context* ctx, const char* path) {
-    fz_stream* stm = FzReadFileIfSmall(ctx, path);
-    if (stm) {
-        return stm;
+// readsOnDemand is set if the data isn't in memory (or mapped) but read from
+// the file as it's needed, which might be slow for files on network shares
+static fz_stream* FzOpenOrReadFile(fz_context* ctx, const char* path, bool* readsOnDemand = nullptr) {
+    fz_stream* stm = nullptr;
+    // when simulating a slow network share, always read through the throttled stream
+    bool throttle = gReadThrottleKBps > 0;
+    if (!throttle) {
+        stm = FzReadFileIfSmall(ctx, path);
+        if (!stm) {
+            stm = FzOpenMappedFile(ctx, path, 0);
+        }
+        if (stm) {
+            return stm;
+        }
     }
     WCHAR* pathW = ToWStrTemp(path);
     fz_try(ctx) {
         stm = fz_open_file_w(ctx, pathW);
+        if (throttle) {
+            stm = FzOpenThrottledFile(ctx, stm);
+        }
+        if (readsOnDemand) {
+            *readsOnDemand = true;
+        }
     }
     fz_catch(ctx) {
         stm = nullptr;
@@ -509,6 +719,15 @@ static fz_stream* FzOpenOrReadFile(fz_context* ctx, const char* path) {
 }
 
 static void FzStreamFingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16]) {
+    ByteSlice mapped = FzMappedStreamData(stm);
+    if (!mapped.empty()) {
+        fz_md5 md5;
+        fz_md5_init(&md5);
+        fz_md5_update(&md5, mapped.data(), mapped.size());
+        fz_md5_final(&md5, digest);
+        return;
+    }
+
     i64 fileLen = -1;
     fz_buffer* buf = nullptr;
 
@@ -534,9 +753,15 @@ static void FzStreamFingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16])
     fz_md5_init(&md5);
     fz_md5_update(&md5, data, size);
     fz_md5_final(&md5, digest);
+    fz_free(ctx, data);
 }
 
 static ByteSlice FzExtractStreamData(fz_context* ctx, fz_stream* stream) {
+    ByteSlice mapped = FzMappedStreamData(stream);
+    if (!mapped.empty()) {
+        return mapped.Clone();
+    }
+
     fz_seek(ctx, stream, 0, 2);
     i64 fileLen = fz_tell(ctx, stream);
     fz_seek(ctx, stream, 0, 0);
@@ -837,59 +1062,101 @@ static LinkRectList* LinkifyText(const WCHAR* pageText, Rect* coords) {
     return list;
 }
 
-// try to produce an 8-bit palette for saving some memory
-static RenderedBitmap* TryRenderAsPaletteImage(fz_pixmap* pixmap) {
-    int w = pixmap->w;
-    int h = pixmap->h;
+// creates a top-down 32-bit DIB section, backed by a file mapping like all
+// rendered bitmaps. GDI's BGRA is a pixel format mupdf can draw into, so
+// pages are rasterized straight into the returned samples
+static RenderedBitmap* NewBgraRenderedBitmap(int w, int h, u8** samplesOut) {
+    BITMAPINFO bmi{};
+    BITMAPINFOHEADER* bmih = &bmi.bmiHeader;
+    bmih->biSize = sizeof(*bmih);
+    bmih->biWidth = w;
+    bmih->biHeight = -h;
+    bmih->biPlanes = 1;
+    bmih->biCompression = BI_RGB;
+    bmih->biBitCount = 32;
+    bmih->biSizeImage = (DWORD)w * h * 4;
+    bmih->biClrUsed = 0;
+
+    void* data = nullptr;
+    HANDLE hMap = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, bmih->biSizeImage, nullptr);
+    HBITMAP hbmp = CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, &data, hMap, 0);
+    if (!hbmp || !data) {
+        if (hbmp) {
+            DeleteObject(hbmp);
+        }
+        if (hMap) {
+            CloseHandle(hMap);
+        }
+        // return a RenderedBitmap even if hbmp is nullptr so that callers can
+        // distinguish rendering errors from GDI resource exhaustion
+        // (RenderCache retries with smaller tiles)
+        *samplesOut = nullptr;
+        return new RenderedBitmap(nullptr, Size(w, h));
+    }
+    *samplesOut = (u8*)data;
+    return new RenderedBitmap(hbmp, Size(w, h), hMap);
+}
+
+// try to produce an 8-bit palette for saving some memory. building the palette
+// and the 8-bit image is a single pass over the BGRA samples, writing the
+// indices directly into the memory the 8-bit DIB section is created from
+static RenderedBitmap* TryRenderAsPaletteImage(const u8* samples, int w, int h) {
     int rows8 = ((w + 3) / 4) * 4;
-    u8* bmpData = (u8*)calloc(rows8, h);
+    DWORD imgSize = (DWORD)rows8 * h;
+    HANDLE hMap = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, imgSize, nullptr);
+    if (!hMap) {
+        return nullptr;
+    }
+    u8* bmpData = (u8*)MapViewOfFile(hMap, FILE_MAP_WRITE, 0, 0, imgSize);
     if (!bmpData) {
+        CloseHandle(hMap);
         return nullptr;
     }
 
     ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
 
     u8* dest = bmpData;
-    u8* source = pixmap->samples;
+    // BGRA samples have the memory layout of RGBQUAD
+    const u32* source = (const u32*)samples;
     u32* palette = (u32*)bmi.Get()->bmiColors;
     u8 grayIdxs[256]{};
 
     int paletteSize = 0;
-    RGBQUAD c;
     for (int j = 0; j < h; j++) {
         for (int i = 0; i < w; i++) {
-            c.rgbRed = *source++;
-            c.rgbGreen = *source++;
-            c.rgbBlue = *source++;
-            c.rgbReserved = 0;
-            source++;
+            u32 c = *source++ & 0xffffff;
+            u8 b = c & 0xff;
+            u8 g = (c >> 8) & 0xff;
+            u8 r = (c >> 16) & 0xff;
 
             /* find this color in the palette */
             int k;
-            bool isGray = c.rgbRed == c.rgbGreen && c.rgbRed == c.rgbBlue;
+            bool isGray = r == g && r == b;
             if (isGray) {
-                k = grayIdxs[c.rgbRed] || palette[0] == *(u32*)&c ? grayIdxs[c.rgbRed] : paletteSize;
+                k = grayIdxs[r] || palette[0] == c ? grayIdxs[r] : paletteSize;
             } else {
-                for (k = 0; k < paletteSize && palette[k] != *(u32*)&c; k++) {
+                for (k = 0; k < paletteSize && palette[k] != c; k++) {
                     ;
                 }
             }
             /* add it to the palette if it isn't in there and if there's still space left */
             if (k == paletteSize) {
                 if (++paletteSize > 256) {
-                    free(bmpData);
+                    UnmapViewOfFile(bmpData);
+                    CloseHandle(hMap);
                     return nullptr;
                 }
                 if (isGray) {
-                    grayIdxs[c.rgbRed] = (BYTE)k;
+                    grayIdxs[r] = (BYTE)k;
                 }
-                palette[k] = *(u32*)&c;
+                palette[k] = c;
             }
             /* 8-bit data consists of indices into the color palette */
             *dest++ = k;
         }
         dest += rows8 - w;
     }
+    UnmapViewOfFile(bmpData);
 
     BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
     bmih->biSize = sizeof(*bmih);
@@ -898,120 +1165,54 @@ static RenderedBitmap* TryRenderAsPaletteImage(fz_pixmap* pixmap) {
     bmih->biPlanes = 1;
     bmih->biCompression = BI_RGB;
     bmih->biBitCount = 8;
-    bmih->biSizeImage = h * rows8;
+    bmih->biSizeImage = imgSize;
     bmih->biClrUsed = paletteSize;
 
     void* data = nullptr;
-    HANDLE hMap = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, bmih->biSizeImage, nullptr);
     HBITMAP hbmp = CreateDIBSection(nullptr, bmi, DIB_RGB_COLORS, &data, hMap, 0);
     if (!hbmp) {
-        free(bmpData);
+        CloseHandle(hMap);
         return nullptr;
     }
-    memcpy(data, bmpData, bmih->biSizeImage);
-    free(bmpData);
     return new RenderedBitmap(hbmp, Size(w, h), hMap);
 }
 
-// had to create a copy of fz_convert_pixmap to ensure we always get the alpha
-static fz_pixmap* FzConvertPixmap2(fz_context* ctx, fz_pixmap* pix, fz_colorspace* ds, fz_colorspace* prf,
-                                   fz_default_colorspaces* default_cs, fz_color_params color_params, int keep_alpha) {
-    fz_pixmap* cvt;
-
-    if (!ds && !keep_alpha) {
-        fz_throw(ctx, FZ_ERROR_GENERIC, "cannot both throw away and keep alpha");
-    }
-
-    cvt = fz_new_pixmap(ctx, ds, pix->w, pix->h, pix->seps, keep_alpha);
-
-    cvt->xres = pix->xres;
-    cvt->yres = pix->yres;
-    cvt->x = pix->x;
-    cvt->y = pix->y;
-    if (pix->flags & FZ_PIXMAP_FLAG_INTERPOLATE) {
-        cvt->flags |= FZ_PIXMAP_FLAG_INTERPOLATE;
-    } else {
-        cvt->flags &= ~FZ_PIXMAP_FLAG_INTERPOLATE;
-    }
-
-    fz_try(ctx) {
-        fz_convert_pixmap_samples(ctx, pix, cvt, prf, default_cs, color_params, 1);
-    }
-    fz_catch(ctx) {
-        fz_drop_pixmap(ctx, cvt);
-        fz_rethrow(ctx);
+// replaces bmp (created by NewBgraRenderedBitmap) with an 8-bit version if possible
+static RenderedBitmap* MaybeRenderAsPaletteImage(RenderedBitmap* bmp, const u8* samples) {
+    Size size = bmp->GetSize();
+    RenderedBitmap* res = TryRenderAsPaletteImage(samples, size.dx, size.dy);
+    if (!res) {
+        return bmp;
     }
-
-    return cvt;
+    delete bmp;
+    return res;
 }
 
 RenderedBitmap* NewRenderedFzPixmap(fz_context* ctx, fz_pixmap* pixmap) {
-    if (pixmap->n == 4 && fz_colorspace_is_rgb(ctx, pixmap->colorspace)) {
-        RenderedBitmap* res = TryRenderAsPaletteImage(pixmap);
-        if (res) {
-            return res;
-        }
+    u8* samples = nullptr;
+    RenderedBitmap* bmp = NewBgraRenderedBitmap(pixmap->w, pixmap->h, &samples);
+    if (!samples) {
+        return bmp;
     }
 
-    ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
-
     fz_pixmap* bgrPixmap = nullptr;
-    fz_colorspace* csdest = nullptr;
-    fz_color_params cp;
-
     fz_var(bgrPixmap);
-    fz_var(csdest);
-    fz_var(cp);
 
-    /* BGRA is a GDI compatible format */
+    // convert straight into the bitmap's memory (always with alpha)
     fz_try(ctx) {
-        csdest = fz_device_bgr(ctx);
-        cp = fz_default_color_params;
-        bgrPixmap = FzConvertPixmap2(ctx, pixmap, csdest, nullptr, nullptr, cp, 1);
+        fz_irect bbox = fz_pixmap_bbox(ctx, pixmap);
+        bgrPixmap = fz_new_pixmap_with_bbox_and_data(ctx, fz_device_bgr(ctx), bbox, nullptr, 1, samples);
+        fz_convert_pixmap_samples(ctx, pixmap, bgrPixmap, nullptr, nullptr, fz_default_color_params, 1);
+    }
+    fz_always(ctx) {
+        fz_drop_pixmap(ctx, bgrPixmap);
     }
     fz_catch(ctx) {
         fz_report_error(ctx);
+        delete bmp;
         return nullptr;
     }
-
-    if (!bgrPixmap || !bgrPixmap->samples) {
-        return nullptr;
-    }
-
-    int w = bgrPixmap->w;
-    int h = bgrPixmap->h;
-    int n = bgrPixmap->n;
-    int imgSize = bgrPixmap->stride * h;
-    int bitsCount = n * 8;
-
-    BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
-    bmih->biSize = sizeof(*bmih);
-    bmih->biWidth = w;
-    bmih->biHeight = -h;
-    bmih->biPlanes = 1;
-    bmih->biCompression = BI_RGB;
-    bmih->biBitCount = bitsCount;
-    bmih->biSizeImage = imgSize;
-    bmih->biClrUsed = 0;
-
-    void* data = nullptr;
-    HANDLE hFile = INVALID_HANDLE_VALUE;
-    DWORD fl = PAGE_READWRITE;
-    HANDLE hMap = CreateFileMappingW(hFile, nullptr, fl, 0, imgSize, nullptr);
-    uint usage = DIB_RGB_COLORS;
-    HBITMAP hbmp = CreateDIBSection(nullptr, bmi, usage, &data, hMap, 0);
-    if (data) {
-        u8* samples = bgrPixmap->samples;
-        memcpy(data, samples, imgSize);
-    }
-    fz_drop_pixmap(ctx, bgrPixmap);
-    if (!hbmp) {
-        return nullptr;
-    }
-    // return a RenderedBitmap even if hbmp is nullptr so that callers can
-    // distinguish rendering errors from GDI resource exhaustion
-    // (and in the latter case retry using smaller target rectangles)
-    return new RenderedBitmap(hbmp, Size(w, h), hMap);
+    return MaybeRenderAsPaletteImage(bmp, samples);
 }
 
 static TocItem* NewTocItemWithDestination(TocItem* parent, char* title, IPageDestination* dest) {
@@ -1572,10 +1773,183 @@ struct ContextThreadID {
 static Vec<ContextThreadID>* gPerThreadContexts;
 static CRITICAL_SECTION gPerThreadContextsCs;
 
+// when set, all engines clone their context from gSharedCtx, so that they share
+// one store (with a single memory budget), glyph cache, font and colorspace context
+// instead of each having their own. must be set before the first engine is created
+static bool gMupdfSharedStore = false;
+
+void SetMupdfSharedStore(bool enable) {
+    gMupdfSharedStore = enable;
+}
+
+static fz_context* gSharedCtx = nullptr;
+static fz_locks_context gSharedLocks;
+static CRITICAL_SECTION gSharedMutexes[FZ_LOCK_MAX];
+
+// items in the shared store are attributed to the engine whose context
+// stored them (see fz_set_user_context), for DumpMupdfSharedStore()
+struct FzStoreOwner {
+    int id = 0;
+    EngineMupdf* engine = nullptr;
+    i64 evictedSize = 0;
+    int nEvicted = 0;
+};
+
+static Vec<FzStoreOwner>* gStoreOwners;
+static CRITICAL_SECTION gStoreOwnersCs;
+static int gLastStoreOwnerId = 0;
+// evictions of items stored by engines that have since been closed
+static i64 gClosedEvictedSize = 0;
+static int gClosedNEvicted = 0;
+
+static void fz_lock_shared_cs(void*, int lock) {
+    EnterCriticalSection(&gSharedMutexes[lock]);
+}
+
+static void fz_unlock_shared_cs(void*, int lock) {
+    LeaveCriticalSection(&gSharedMutexes[lock]);
+}
+
+static int StoreOwnerId(void* owner) {
+    return (int)(intptr_t)owner;
+}
+
+// called with the store's alloc lock held
+static void FzStoreItemEvicted(void*, void* owner, const char*, size_t size) {
+    ScopedCritSec cs(&gStoreOwnersCs);
+    for (auto& o : *gStoreOwners) {
+        if (o.id == StoreOwnerId(owner)) {
+            o.evictedSize += (i64)size;
+            o.nEvicted++;
+            return;
+        }
+    }
+    gClosedEvictedSize += (i64)size;
+    gClosedNEvicted++;
+}
+
+static int RegisterStoreOwner(EngineMupdf* engine) {
+    ScopedCritSec cs(&gStoreOwnersCs);
+    FzStoreOwner o;
+    o.id = ++gLastStoreOwnerId;
+    o.engine = engine;
+    gStoreOwners->Append(o);
+    return o.id;
+}
+
+static void UnregisterStoreOwner(int id) {
+    ScopedCritSec cs(&gStoreOwnersCs);
+    int n = gStoreOwners->Size();
+    for (int i = 0; i < n; i++) {
+        FzStoreOwner& o = gStoreOwners->at(i);
+        if (o.id == id) {
+            gClosedEvictedSize += o.evictedSize;
+            gClosedNEvicted += o.nEvicted;
+            gStoreOwners->RemoveAt(i);
+            return;
+        }
+    }
+}
+
+// called once, before the first engine is created
 void InitializeEngineMupdf() {
     ReportIf(gPerThreadContexts);
     InitializeCriticalSection(&gPerThreadContextsCs);
     gPerThreadContexts = new Vec<ContextThreadID>();
+    InitializeCriticalSection(&gStoreOwnersCs);
+    gStoreOwners = new Vec<FzStoreOwner>();
+
+    if (!gMupdfSharedStore) {
+        return;
+    }
+    for (int i = 0; i < FZ_LOCK_MAX; i++) {
+        InitializeCriticalSection(&gSharedMutexes[i]);
+    }
+    gSharedLocks.user = nullptr;
+    gSharedLocks.lock = fz_lock_shared_cs;
+    gSharedLocks.unlock = fz_unlock_shared_cs;
+    gSharedCtx = fz_new_context(nullptr, &gSharedLocks, FZ_STORE_DEFAULT);
+    if (!gSharedCtx) {
+        logf("InitializeEngineMupdf: failed to create the shared context\n");
+        return;
+    }
+    InstallFitzErrorCallbacks(gSharedCtx);
+    install_load_windows_font_funcs(gSharedCtx);
+    fz_register_document_handlers(gSharedCtx);
+    fz_set_store_evict_callback(gSharedCtx, FzStoreItemEvicted, nullptr);
+}
+
+struct FzStoreUsage {
+    int ownerId = 0;
+    const char* type = nullptr;
+    i64 size = 0;
+    int nItems = 0;
+};
+
+// called with the store's alloc lock held, so mustn't call into fitz
+static void FzCollectStoreUsage(void* arg, void* owner, const char* type, size_t size) {
+    auto usage = (Vec<FzStoreUsage>*)arg;
+    int ownerId = StoreOwnerId(owner);
+    for (auto& u : *usage) {
+        if (u.ownerId == ownerId && str::Eq(u.type, type)) {
+            u.size += (i64)size;
+            u.nItems++;
+            return;
+        }
+    }
+    usage->Append({ownerId, type, (i64)size, 1});
+}
+
+static void LogStoreUsage(const Vec<FzStoreUsage>& usage, int ownerId) {
+    for (auto& u : usage) {
+        if (u.ownerId == ownerId) {
+            logf("    %s: %d items, %d KB\n", u.type, u.nItems, (int)(u.size / 1024));
+        }
+    }
+}
+
+// logs how much of the shared store each open document uses
+// and how much each of them has lost to evictions
+void DumpMupdfSharedStore() {
+    if (!gSharedCtx) {
+        logf("DumpMupdfSharedStore: each document has its own store\n");
+        return;
+    }
+    Vec<FzStoreUsage> usage;
+    fz_enumerate_store(gSharedCtx, FzCollectStoreUsage, &usage);
+
+    i64 total = 0;
+    for (auto& u : usage) {
+        total += u.size;
+    }
+    ScopedCritSec cs(&gStoreOwnersCs);
+    logf("shared mupdf store: %d of %d MB used by %d documents\n", (int)(total / (1024 * 1024)),
+         (int)(FZ_STORE_DEFAULT / (1024 * 1024)), gStoreOwners->Size());
+    for (auto& o : *gStoreOwners) {
+        i64 size = 0;
+        for (auto& u : usage) {
+            size += u.ownerId == o.id ? u.size : 0;
+        }
+        logf("  %s: %d KB, evicted %d items (%d KB)\n", o.engine->FilePath(), (int)(size / 1024), o.nEvicted,
+             (int)(o.evictedSize / 1024));
+        LogStoreUsage(usage, o.id);
+    }
+    // items stored by the shared context itself or by closed documents
+    // (e.g. fonts that outlive them)
+    Vec<FzStoreUsage> other;
+    for (auto& u : usage) {
+        bool isOpen = false;
+        for (auto& o : *gStoreOwners) {
+            isOpen |= u.ownerId == o.id;
+        }
+        if (!isOpen) {
+            FzStoreUsage el = u;
+            el.ownerId = 0;
+            other.Append(el);
+        }
+    }
+    logf("  other: evicted %d items (%d KB)\n", gClosedNEvicted, (int)(gClosedEvictedSize / 1024));
+    LogStoreUsage(other, 0);
 }
 
 fz_context* GetOrClonePerThreadContext(EngineMupdf* engine, fz_context* ctx) {
@@ -1587,6 +1961,7 @@ fz_context* GetOrClonePerThreadContext(EngineMupdf* engine, fz_context* ctx) {
         }
     }
     auto newCtx = fz_clone_context(ctx);
+    InstallFitzErrorCallbacks(newCtx);
     ContextThreadID el{engine, newCtx, threadID};
     gPerThreadContexts->Append(el);
     return newCtx;
@@ -1607,16 +1982,50 @@ void ReleasePerThreadContext(EngineMupdf* engine) {
     }
 }
 
+// must be called before dropping engine's base context
+// because the clones share its locks and store
+static void ReleaseAllPerThreadContexts(EngineMupdf* engine) {
+    if (!gPerThreadContexts) {
+        return;
+    }
+    ScopedCritSec cs(&gPerThreadContextsCs);
+    int n = gPerThreadContexts->Size();
+    for (int i = n - 1; i >= 0; i--) {
+        auto& el = gPerThreadContexts->at(i);
+        if (el.engine == engine) {
+            fz_drop_context(el.ctx);
+            gPerThreadContexts->RemoveAtFast(i);
+        }
+    }
+}
+
 EngineMupdf::EngineMupdf() {
     kind = kindEngineMupdf;
     defaultExt = str::Dup(".pdf");
     fileDPI = 72.0f;
+    // see RenderPage() and ExtractPageText()
+    allowsConcurrentRendering = true;
+    allowsConcurrentTextExtraction = true;
 
     for (size_t i = 0; i < dimof(mutexes); i++) {
         InitializeCriticalSection(&mutexes[i]);
     }
     InitializeCriticalSection(&pagesAccess);
-    ctxAccess = &mutexes[FZ_LOCK_ALLOC];
+    InitializeCriticalSection(&ctxAccessCs);
+    ctxAccess = &ctxAccessCs;
+
+    // the per-thread render contexts (GetOrClonePerThreadContext()) and gSharedCtx need it
+    static bool didInitialize = (InitializeEngineMupdf(), true);
+    (void)didInitialize;
+
+    if (gSharedCtx) {
+        // document handlers and font loading are inherited from gSharedCtx
+        _ctx = fz_clone_context(gSharedCtx);
+        storeOwnerId = RegisterStoreOwner(this);
+        fz_set_user_context(_ctx, (void*)(intptr_t)storeOwnerId);
+        InstallFitzErrorCallbacks(_ctx);
+        return;
+    }
 
     fz_locks_ctx.user = this;
     fz_locks_ctx.lock = fz_lock_context_cs;
@@ -1632,7 +2041,71 @@ fz_context* EngineMupdf::Ctx() const {
     return _ctx;
 }
 
+// recorded pages are kept in the fz store (keyed by engine, page and usage),
+// so their memory is accounted for together with images, fonts etc. and
+// the least recently used ones are evicted when the store is full
+struct FzDisplayListKey {
+    int refs;
+    EngineMupdf* engine;
+    int pageNo;
+    bool forPrint;
+};
+
+static int FzMakeHashDisplayListKey(fz_context*, fz_store_hash* hash, void* key_) {
+    auto key = (FzDisplayListKey*)key_;
+    hash->u.pi.ptr = key->engine;
+    hash->u.pi.i = key->forPrint ? -key->pageNo : key->pageNo;
+    return 1;
+}
+
+static void* FzKeepDisplayListKey(fz_context* ctx, void* key_) {
+    auto key = (FzDisplayListKey*)key_;
+    return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void FzDropDisplayListKey(fz_context* ctx, void* key_) {
+    auto key = (FzDisplayListKey*)key_;
+    if (fz_drop_imp(ctx, key, &key->refs)) {
+        fz_free(ctx, key);
+    }
+}
+
+static int FzCmpDisplayListKey(fz_context*, void* k1, void* k2) {
+    auto a = (FzDisplayListKey*)k1;
+    auto b = (FzDisplayListKey*)k2;
+    bool same = a->engine == b->engine && a->pageNo == b->pageNo && a->forPrint == b->forPrint;
+    return same ? 0 : 1;
+}
+
+static void FzFormatDisplayListKey(fz_context*, char* buf, size_t size, void* key_) {
+    auto key = (FzDisplayListKey*)key_;
+    fz_snprintf(buf, size, "(display list page %d%s)", key->pageNo, key->forPrint ? " print" : "");
+}
+
+static const fz_store_type kFzDisplayListStoreType = {
+    "fz_display_list",        // name
+    FzMakeHashDisplayListKey, // make_hash_key
+    FzKeepDisplayListKey,     // keep_key
+    FzDropDisplayListKey,     // drop_key
+    FzCmpDisplayListKey,      // cmp_key
+    FzFormatDisplayListKey,   // format_key
+    nullptr,                  // needs_reap
+};
+
+static int FzIsEngineDisplayList(fz_context*, void* arg, void* key_) {
+    auto key = (FzDisplayListKey*)key_;
+    return key->engine == (EngineMupdf*)arg ? 1 : 0;
+}
+
+static void DropAllDisplayLists(fz_context* ctx, EngineMupdf* engine) {
+    fz_filter_store(ctx, FzIsEngineDisplayList, engine, &kFzDisplayListStoreType);
+}
+
 EngineMupdf::~EngineMupdf() {
+    StopLoading();
+    if (storeOwnerId) {
+        UnregisterStoreOwner(storeOwnerId);
+    }
     EnterCriticalSection(&pagesAccess);
 
     auto ctx = Ctx();
@@ -1651,25 +2124,34 @@ EngineMupdf::~EngineMupdf() {
 
     fz_drop_outline(ctx, outline);
     fz_drop_outline(ctx, attachments);
+    fz_drop_outline(ctx, pendingOutline);
+    fz_drop_outline(ctx, pendingAttachments);
 
     if (pdfInfo) {
         pdf_drop_obj(ctx, pdfInfo);
     }
+    if (pendingInfo) {
+        pdf_drop_obj(ctx, pendingInfo);
+    }
 
     if (pdfdoc) {
         pdf_drop_page_tree(ctx, pdfdoc);
     }
 
+    DropAllDisplayLists(ctx, this);
     fz_drop_document(ctx, _doc);
+    ReleaseAllPerThreadContexts(this);
     fz_drop_context(ctx);
 
     delete pageLabels;
+    delete pendingPageLabels;
     delete tocTree;
     DeleteVecMembers(pages);
 
     for (size_t i = 0; i < dimof(mutexes); i++) {
         DeleteCriticalSection(&mutexes[i]);
     }
+    DeleteCriticalSection(&ctxAccessCs);
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
 }
@@ -1897,14 +2379,15 @@ bool EngineMupdf::Load(const char* path, PasswordUI* pwdUI) {
         return FinishLoading();
     }
 
-    fz_stream* file = FzOpenOrReadFile(ctx, fnCopy);
+    bool readsOnDemand = false;
+    fz_stream* file = FzOpenOrReadFile(ctx, fnCopy, &readsOnDemand);
     ok = LoadFromStream(file, FilePath(), pwdUI);
     if (!ok) {
         return false;
     }
 
     if (streamNo < 0) {
-        ok = FinishLoading();
+        ok = FinishLoading(true, readsOnDemand);
         if (ok) {
             return true;
         }
@@ -2228,70 +2711,51 @@ static void FinishNonPDFLoading(EngineMupdf* e) {
     }
 }
 
-bool EngineMupdf::FinishLoading() {
-    auto ctx = Ctx();
-    pdfdoc = pdf_specifics(ctx, _doc);
-
-    pageCount = 0;
-    fz_var(pageCount);
+// returns the size of page pageNo (0-based) given its page object
+static RectF PdfPageObjMediabox(fz_context* ctx, pdf_obj* pageref, int pageNo) {
+    fz_rect mbox{};
+    fz_matrix page_ctm{};
+    fz_var(mbox);
     fz_try(ctx) {
-        // this call might throw the first time
-        pageCount = fz_count_pages(ctx, _doc);
+        pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
+        mbox = fz_transform_rect(mbox, page_ctm);
     }
     fz_catch(ctx) {
         fz_report_error(ctx);
-        pageCount = 0;
+        mbox = {};
     }
-    if (pageCount == 0) {
-        fz_warn(ctx, "document has no pages");
-        return false;
+    if (fz_is_empty_rect(mbox)) {
+        logfa("cannot find page size for page %d", pageNo);
+        mbox.x0 = 0;
+        mbox.y0 = 0;
+        mbox.x1 = 612;
+        mbox.y1 = 792;
     }
+    return ToRectF(mbox);
+}
 
-    preferredLayout = GetPreferredLayout(ctx, _doc);
-    allowsPrinting = fz_has_permission(ctx, _doc, FZ_PERMISSION_PRINT);
-    allowsCopyingText = fz_has_permission(ctx, _doc, FZ_PERMISSION_COPY);
-
-    for (int i = 0; i < pageCount; i++) {
-        auto pi = new FzPageInfo();
-        pages.Append(pi);
+// caller must hold ctxAccess
+static RectF PdfPageMediabox(fz_context* ctx, pdf_document* doc, int pageNo) {
+    pdf_obj* pageref = nullptr;
+    fz_var(pageref);
+    fz_try(ctx) {
+        // note: don't pdf_drop_obj() this
+        pageref = pdf_lookup_page_obj(ctx, doc, pageNo);
     }
-    if (!pdfdoc) {
-        FinishNonPDFLoading(this);
-        return true;
-    }
-
-    ScopedCritSec scope(ctxAccess);
-
-    for (int pageNo = 0; pageNo < pageCount; pageNo++) {
-        pdf_obj* pageref = nullptr;
-        fz_rect mbox{};
-        fz_matrix page_ctm{};
-        fz_var(pageref);
-        fz_var(mbox);
-        fz_try(ctx) {
-            // note: don't pdf_drop_obj() this
-            pageref = pdf_lookup_page_obj(ctx, pdfdoc, pageNo);
-            pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
-            mbox = fz_transform_rect(mbox, page_ctm);
-        }
-        fz_catch(ctx) {
-            fz_report_error(ctx);
-            mbox = {};
-        }
-        if (fz_is_empty_rect(mbox)) {
-            logfa("cannot find page size for page %d", pageNo);
-            mbox.x0 = 0;
-            mbox.y0 = 0;
-            mbox.x1 = 612;
-            mbox.y1 = 792;
-        }
-        FzPageInfo* pageInfo = pages[pageNo];
-        pageInfo->mediabox = ToRectF(mbox);
-        pageInfo->pageNo = pageNo + 1;
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        pageref = nullptr;
     }
+    return PdfPageObjMediabox(ctx, pageref, pageNo);
+}
 
+// caller must hold ctxAccess
+static fz_outline* PdfLoadOutline(EngineMupdf* e) {
+    auto ctx = e->Ctx();
+    fz_outline* outline = nullptr;
+    fz_var(outline);
     fz_try(ctx) {
-        outline = fz_load_outline(ctx, _doc);
+        outline = fz_load_outline(ctx, e->_doc);
     }
     fz_catch(ctx) {
         fz_report_error(ctx);
@@ -2299,12 +2763,19 @@ bool EngineMupdf::FinishLoading() {
         // this information is not critical and checking the
         // error might prevent loading some pdfs that would
         // otherwise get displayed
-        logfa("Couldn't load outline for '%s'\n", FilePath());
+        logfa("Couldn't load outline for '%s'\n", e->FilePath());
+        outline = nullptr;
     }
+    return outline;
+}
 
-    attachments = PdfLoadAttachments(ctx, pdfdoc, FilePath());
-
+// caller must hold ctxAccess
+static pdf_obj* PdfLoadInfo(EngineMupdf* e) {
+    auto ctx = e->Ctx();
+    pdf_document* pdfdoc = e->pdfdoc;
+    pdf_obj* info = nullptr;
     pdf_obj* origInfo = nullptr;
+    fz_var(info);
     fz_var(origInfo);
     fz_try(ctx) {
         // keep a copy of the Info dictionary, as accessing the original
@@ -2313,20 +2784,20 @@ bool EngineMupdf::FinishLoading() {
         origInfo = pdf_dict_gets(ctx, pdf_trailer(ctx, pdfdoc), "Info");
 
         if (origInfo) {
-            pdfInfo = PdfCopyStrDict(ctx, pdfdoc, origInfo);
+            info = PdfCopyStrDict(ctx, pdfdoc, origInfo);
         }
-        if (!pdfInfo) {
-            pdfInfo = pdf_new_dict(ctx, pdfdoc, 4);
+        if (!info) {
+            info = pdf_new_dict(ctx, pdfdoc, 4);
         }
         // also remember linearization and tagged states at this point
-        if (IsLinearizedFile(this)) {
-            pdf_dict_puts_drop(ctx, pdfInfo, "Linearized", PDF_TRUE);
+        if (IsLinearizedFile(e)) {
+            pdf_dict_puts_drop(ctx, info, "Linearized", PDF_TRUE);
         }
         pdf_obj* trailer = pdf_trailer(ctx, pdfdoc);
         pdf_obj* marked = pdf_dict_getp(ctx, trailer, "Root/MarkInfo/Marked");
         bool isMarked = pdf_to_bool(ctx, marked);
         if (isMarked) {
-            pdf_dict_puts_drop(ctx, pdfInfo, "Marked", PDF_TRUE);
+            pdf_dict_puts_drop(ctx, info, "Marked", PDF_TRUE);
         }
         // also remember known output intents (PDF/X, etc.)
         pdf_obj* intents = pdf_dict_getp(ctx, trailer, "Root/OutputIntents");
@@ -2340,33 +2811,389 @@ bool EngineMupdf::FinishLoading() {
                     pdf_array_push(ctx, list, intent);
                 }
             }
-            pdf_dict_puts_drop(ctx, pdfInfo, "OutputIntents", list);
+            pdf_dict_puts_drop(ctx, info, "OutputIntents", list);
         }
         // also note common unsupported features (such as XFA forms)
         pdf_obj* xfa = pdf_dict_getp(ctx, pdf_trailer(ctx, pdfdoc), "Root/AcroForm/XFA");
         if (pdf_is_array(ctx, xfa)) {
-            pdf_dict_puts_drop(ctx, pdfInfo, "Unsupported_XFA", PDF_TRUE);
+            pdf_dict_puts_drop(ctx, info, "Unsupported_XFA", PDF_TRUE);
         }
     }
     fz_catch(ctx) {
         fz_report_error(ctx);
         fz_warn(ctx, "Couldn't load document properties");
-        pdf_drop_obj(ctx, pdfInfo);
-        pdfInfo = nullptr;
+        pdf_drop_obj(ctx, info);
+        info = nullptr;
     }
+    return info;
+}
 
+// caller must hold ctxAccess
+static StrVec* PdfLoadPageLabels(EngineMupdf* e) {
+    auto ctx = e->Ctx();
+    StrVec* res = nullptr;
     pdf_obj* labels = nullptr;
+    fz_var(res);
     fz_var(labels);
     fz_try(ctx) {
-        labels = pdf_dict_getp(ctx, pdf_trailer(ctx, pdfdoc), "Root/PageLabels");
+        labels = pdf_dict_getp(ctx, pdf_trailer(ctx, e->pdfdoc), "Root/PageLabels");
         if (labels) {
-            pageLabels = BuildPageLabelVec(ctx, labels, PageCount());
+            res = BuildPageLabelVec(ctx, labels, e->PageCount());
         }
     }
     fz_catch(ctx) {
         fz_report_error(ctx);
         fz_warn(ctx, "Couldn't load page labels");
     }
+    return res;
+}
+
+// show linearized PDFs before all of their pages have been loaded
+// (only the ui knows how to handle page sizes that change after loading)
+static bool gMupdfProgressiveLoading = false;
+
+void SetMupdfProgressiveLoading(bool enable) {
+    gMupdfProgressiveLoading = enable;
+}
+
+// the page tree is a lot shallower in practice
+constexpr int kMaxPageTreeDepth = 64;
+
+struct PdfPageTreeNode {
+    pdf_obj* obj = nullptr;
+    int nextKid = 0;
+};
+
+// visits all pages in order like pdf_lookup_page_loc() does for a single page.
+// ctxAccess is only held while loading a single page tree node or page so that
+// pages can be loaded and rendered in the meantime (in a linearized file the
+// page objects are spread over the whole file)
+// returns false if the page tree is malformed or loading has been aborted
+static bool PdfLoadAllMediaboxes(EngineMupdf* e, Vec<RectF>& boxes) {
+    auto ctx = e->Ctx();
+    Vec<PdfPageTreeNode> stack;
+    bool ok = true;
+    {
+        ScopedCritSec scope(e->ctxAccess);
+        fz_try(ctx) {
+            pdf_obj* root = pdf_dict_getp(ctx, pdf_trailer(ctx, e->pdfdoc), "Root/Pages");
+            if (!root) {
+                fz_throw(ctx, FZ_ERROR_FORMAT, "cannot find page tree");
+            }
+            stack.Append({pdf_keep_obj(ctx, root), 0});
+        }
+        fz_catch(ctx) {
+            fz_report_error(ctx);
+            ok = false;
+        }
+    }
+
+    while (ok && stack.size() > 0 && !e->abortLoad.Get()) {
+        ScopedCritSec scope(e->ctxAccess);
+        PdfPageTreeNode node = stack.Last();
+        stack.Last().nextKid++;
+        fz_try(ctx) {
+            pdf_obj* kids = pdf_dict_get(ctx, node.obj, PDF_NAME(Kids));
+            if (node.nextKid >= pdf_array_len(ctx, kids)) {
+                pdf_drop_obj(ctx, node.obj);
+                stack.RemoveLast();
+            } else {
+                pdf_obj* kid = pdf_array_get(ctx, kids, node.nextKid);
+                pdf_obj* type = pdf_dict_get(ctx, kid, PDF_NAME(Type));
+                bool isPages = type ? pdf_name_eq(ctx, type, PDF_NAME(Pages))
+                                    : pdf_dict_get(ctx, kid, PDF_NAME(Kids)) &&
+                                          !pdf_dict_get(ctx, kid, PDF_NAME(MediaBox));
+                if (isPages) {
+                    if ((int)stack.size() >= kMaxPageTreeDepth) {
+                        fz_throw(ctx, FZ_ERROR_FORMAT, "page tree too deep or has a cycle");
+                    }
+                    stack.Append({pdf_keep_obj(ctx, kid), 0});
+                } else {
+                    int pageNo = (int)boxes.size();
+                    if (pageNo >= e->pageCount) {
+                        fz_throw(ctx, FZ_ERROR_FORMAT, "page tree has more than %d pages", e->pageCount);
+                    }
+                    boxes.Append(PdfPageObjMediabox(ctx, kid, pageNo));
+                }
+            }
+        }
+        fz_catch(ctx) {
+            fz_report_error(ctx);
+            ok = false;
+        }
+    }
+
+    if (stack.size() > 0) {
+        ScopedCritSec scope(e->ctxAccess);
+        for (PdfPageTreeNode& node : stack) {
+            pdf_drop_obj(ctx, node.obj);
+        }
+        ok = false;
+    }
+    return ok && (int)boxes.size() == e->pageCount;
+}
+
+// runs on loadThread. hands everything FinishLoading() skipped over
+// to FinishLayout() in the pending* fields
+static void PdfLoadRemaining(EngineMupdf* e) {
+    auto timeStart = TimeGet();
+    auto ctx = e->Ctx();
+
+    Vec<RectF> boxes;
+    bool ok = PdfLoadAllMediaboxes(e, boxes);
+    if (e->abortLoad.Get()) {
+        return;
+    }
+    {
+        ScopedCritSec scope(e->ctxAccess);
+        // all page objects are cached by now, so loading the whole
+        // page tree (for fast page number lookups) is quick
+        e->pdfdoc->defer_page_tree = 0;
+        if (!ok) {
+            boxes.Reset();
+            for (int i = 0; i < e->pageCount; i++) {
+                boxes.Append(PdfPageMediabox(ctx, e->pdfdoc, i));
+            }
+        }
+    }
+    {
+        ScopedCritSec scope(&e->pagesAccess);
+        e->pendingMediaboxes = boxes;
+    }
+
+    fz_outline* outline = nullptr;
+    fz_outline* attachments = nullptr;
+    if (!e->abortLoad.Get()) {
+        ScopedCritSec scope(e->ctxAccess);
+        outline = PdfLoadOutline(e);
+        attachments = PdfLoadAttachments(ctx, e->pdfdoc, e->FilePath());
+    }
+    pdf_obj* info = nullptr;
+    StrVec* labels = nullptr;
+    if (!e->abortLoad.Get()) {
+        ScopedCritSec scope(e->ctxAccess);
+        info = PdfLoadInfo(e);
+        labels = PdfLoadPageLabels(e);
+    }
+
+    Func0 fn;
+    {
+        ScopedCritSec scope(&e->pagesAccess);
+        e->pendingOutline = outline;
+        e->pendingAttachments = attachments;
+        e->pendingInfo = info;
+        e->pendingPageLabels = labels;
+        e->loadDone = true;
+        fn = e->onLoaded;
+        e->onLoaded = {};
+    }
+    if (e->abortLoad.Get()) {
+        return;
+    }
+    logf("PdfLoadRemaining: loaded %d pages of '%s' in %.2f ms\n", e->pageCount, e->FilePath(),
+         TimeSinceInMs(timeStart));
+    fn.Call();
+}
+
+// must be called before destroying anything loadThread uses
+void EngineMupdf::StopLoading() {
+    abortLoad.Set(true);
+    if (loadThread) {
+        WaitForSingleObject(loadThread, INFINITE);
+        CloseHandle(loadThread);
+        loadThread = nullptr;
+    }
+}
+
+bool EngineMupdf::NotifyWhenLaidOut(const Func0& fn) {
+    {
+        ScopedCritSec scope(&pagesAccess);
+        if (!provisionalLoad) {
+            return false;
+        }
+        if (!loadDone) {
+            onLoaded = fn;
+            return true;
+        }
+    }
+    fn.Call();
+    return true;
+}
+
+bool EngineMupdf::FinishLayout() {
+    if (loadThread) {
+        WaitForSingleObject(loadThread, INFINITE);
+        CloseHandle(loadThread);
+        loadThread = nullptr;
+    }
+
+    ScopedCritSec scope(&pagesAccess);
+    if (!provisionalLoad) {
+        return false;
+    }
+    provisionalLoad = false;
+
+    ScopedCritSec ctxScope(ctxAccess);
+    for (int i = 0; i < pageCount && i < (int)pendingMediaboxes.size(); i++) {
+        pages[i]->mediabox = pendingMediaboxes[i];
+        pages[i]->mediaboxIsEstimate = false;
+    }
+    pendingMediaboxes.Reset();
+    outline = pendingOutline;
+    attachments = pendingAttachments;
+    pdfInfo = pendingInfo;
+    pageLabels = pendingPageLabels;
+    hasPageLabels = pageLabels != nullptr;
+    pendingOutline = nullptr;
+    pendingAttachments = nullptr;
+    pendingInfo = nullptr;
+    pendingPageLabels = nullptr;
+    return true;
+}
+
+bool EngineMupdf::ResolvePageSizes(int startPage, int endPage) {
+    Vec<int> pageNos;
+    {
+        ScopedCritSec scope(&pagesAccess);
+        if (!provisionalLoad) {
+            return false;
+        }
+        for (int pageNo = std::max(startPage, 1); pageNo <= std::min(endPage, pageCount); pageNo++) {
+            if (pages[pageNo - 1]->mediaboxIsEstimate) {
+                pageNos.Append(pageNo);
+            }
+        }
+    }
+    if (pageNos.empty()) {
+        return false;
+    }
+
+    Vec<RectF> boxes;
+    {
+        ScopedCritSec scope(ctxAccess);
+        for (int pageNo : pageNos) {
+            boxes.Append(PdfPageMediabox(Ctx(), pdfdoc, pageNo - 1));
+        }
+    }
+
+    bool changed = false;
+    ScopedCritSec scope(&pagesAccess);
+    for (int i = 0; i < pageNos.Size(); i++) {
+        FzPageInfo* pageInfo = pages[pageNos[i] - 1];
+        if (!pageInfo->mediaboxIsEstimate) {
+            continue;
+        }
+        if (!(pageInfo->mediabox == boxes[i])) {
+            changed = true;
+        }
+        pageInfo->mediabox = boxes[i];
+        pageInfo->mediaboxIsEstimate = false;
+    }
+    return changed;
+}
+
+// documents with at least this many pages are loaded progressively,
+// even when they're not linearized or are on a local drive
+constexpr int kProgressiveLoadPageCount = 2000;
+// the size of pages that weren't loaded yet is estimated from this many pages
+constexpr int kPagesToEstimateSizeFrom = 4;
+
+// returns the size shared by most of the given pages (the first one if there's a tie)
+static RectF MostCommonMediabox(const Vec<RectF>& boxes) {
+    RectF res = boxes[0];
+    int maxCount = 0;
+    for (const RectF& box : boxes) {
+        int count = 0;
+        for (const RectF& other : boxes) {
+            if (other == box) {
+                count++;
+            }
+        }
+        if (count > maxCount) {
+            maxCount = count;
+            res = box;
+        }
+    }
+    return res;
+}
+
+// allowProgressive is set for documents loaded from a file (EnginePs and other
+// users of streams don't pass NotifyWhenLaidOut() on to the ui).
+// readsOnDemand is set for documents that are read from disk as they're
+// needed (see FzOpenOrReadFile)
+bool EngineMupdf::FinishLoading(bool allowProgressive, bool readsOnDemand) {
+    auto ctx = Ctx();
+    pdfdoc = pdf_specifics(ctx, _doc);
+
+    pageCount = 0;
+    fz_var(pageCount);
+    fz_try(ctx) {
+        // this call might throw the first time
+        pageCount = fz_count_pages(ctx, _doc);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        pageCount = 0;
+    }
+    if (pageCount == 0) {
+        fz_warn(ctx, "document has no pages");
+        return false;
+    }
+
+    preferredLayout = GetPreferredLayout(ctx, _doc);
+    allowsPrinting = fz_has_permission(ctx, _doc, FZ_PERMISSION_PRINT);
+    allowsCopyingText = fz_has_permission(ctx, _doc, FZ_PERMISSION_COPY);
+
+    for (int i = 0; i < pageCount; i++) {
+        auto pi = new FzPageInfo();
+        pages.Append(pi);
+    }
+    if (!pdfdoc) {
+        FinishNonPDFLoading(this);
+        return true;
+    }
+
+    ScopedCritSec scope(ctxAccess);
+
+    // loading the page tree (or the outline) of a linearized PDF reads from all
+    // over the file, but its first page is at the start so it can be shown right away.
+    // for documents with lots of pages, getting the size of all pages
+    // takes a while even when they're on a local drive
+    bool progressive = allowProgressive && gMupdfProgressiveLoading && pageCount > 1;
+    bool isSlowLinearized = progressive && readsOnDemand && IsLinearizedFile(this);
+    progressive = isSlowLinearized || (progressive && pageCount >= kProgressiveLoadPageCount);
+    if (progressive) {
+        pdfdoc->defer_page_tree = 1;
+        // the other pages of a slow linearized PDF might be all over the file
+        int nKnown = isSlowLinearized ? 1 : std::min(pageCount, kPagesToEstimateSizeFrom);
+        Vec<RectF> known;
+        for (int pageNo = 0; pageNo < nKnown; pageNo++) {
+            known.Append(PdfPageMediabox(ctx, pdfdoc, pageNo));
+        }
+        RectF estimate = MostCommonMediabox(known);
+        for (int pageNo = 0; pageNo < pageCount; pageNo++) {
+            FzPageInfo* pageInfo = pages[pageNo];
+            pageInfo->mediaboxIsEstimate = pageNo >= nKnown;
+            pageInfo->mediabox = pageInfo->mediaboxIsEstimate ? estimate : known[pageNo];
+            pageInfo->pageNo = pageNo + 1;
+        }
+        provisionalLoad = true;
+        auto fn = MkFunc0<EngineMupdf>(PdfLoadRemaining, this);
+        loadThread = StartThread(fn, "PdfLoadThread");
+        logf("EngineMupdf::FinishLoading: loading %d pages of '%s' in the background\n", pageCount, FilePath());
+        return true;
+    }
+
+    for (int pageNo = 0; pageNo < pageCount; pageNo++) {
+        FzPageInfo* pageInfo = pages[pageNo];
+        pageInfo->mediabox = PdfPageMediabox(ctx, pdfdoc, pageNo);
+        pageInfo->pageNo = pageNo + 1;
+    }
+
+    outline = PdfLoadOutline(this);
+    attachments = PdfLoadAttachments(ctx, pdfdoc, FilePath());
+    pdfInfo = PdfLoadInfo(this);
+    pageLabels = PdfLoadPageLabels(this);
     if (pageLabels) {
         hasPageLabels = true;
     }
@@ -2903,8 +3730,92 @@ RectF EngineMupdf::Transform(const RectF& rect, int pageNo, float zoom, int rota
     return ToRectF(rect2);
 }
 
-RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
+// records page content into a display list. "View" and "Print" differ
+// in which optional content and annotations are shown
+static fz_display_list* FzNewPageDisplayList(fz_context* ctx, fz_page* page, bool isPdf, const char* usage,
+                                             fz_cookie* cookie) {
+    fz_display_list* list = nullptr;
+    fz_device* dev = nullptr;
+    fz_var(list);
+    fz_var(dev);
+    fz_try(ctx) {
+        list = fz_new_display_list(ctx, fz_bound_page(ctx, page));
+        dev = fz_new_list_device(ctx, list);
+        if (isPdf) {
+            pdf_page* pdfpage = pdf_page_from_fz_page(ctx, page);
+            pdf_run_page_with_usage(ctx, pdfpage, dev, fz_identity, usage, cookie);
+        } else {
+            fz_run_page_contents(ctx, page, dev, fz_identity, cookie);
+        }
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx) {
+        fz_drop_display_list(ctx, list);
+        fz_report_error(ctx);
+        return nullptr;
+    }
+    return list;
+}
+
+// returns a reference that the caller must fz_drop_display_list().
+// page content is recorded once (under ctxAccess) and then replayed without
+// a lock on per-thread cloned contexts by rendering the view, thumbnails and
+// printing as well as by text extraction
+fz_display_list* EngineMupdf::GetPageDisplayList(FzPageInfo* pageInfo, fz_cookie* cookie, bool forPrint) {
+    auto ctx = Ctx();
+    ScopedCritSec cs(ctxAccess);
+    FzDisplayListKey key{1, this, pageInfo->pageNo, forPrint};
+    auto list = (fz_display_list*)fz_find_item(ctx, fz_drop_display_list_imp, &key, &kFzDisplayListStoreType);
+    if (list) {
+        return list;
+    }
+    const char* usage = forPrint ? "Print" : "View";
+    list = FzNewPageDisplayList(ctx, pageInfo->page, pdfdoc != nullptr, usage, cookie);
+    if (!list) {
+        return nullptr;
+    }
+    // don't cache partially recorded list
+    bool aborted = cookie && cookie->abort;
+    if (aborted) {
+        return list;
+    }
+    FzDisplayListKey* storeKey = nullptr;
+    fz_var(storeKey);
+    fz_try(ctx) {
+        storeKey = fz_malloc_struct(ctx, FzDisplayListKey);
+        *storeKey = key;
+        size_t size = fz_display_list_size(ctx, list);
+        auto existing = (fz_display_list*)fz_store_item(ctx, storeKey, list, size, &kFzDisplayListStoreType);
+        // can't happen as long as lists are only recorded under ctxAccess
+        ReportIf(existing);
+        fz_drop_display_list(ctx, existing);
+    }
+    fz_always(ctx) {
+        if (storeKey) {
+            FzDropDisplayListKey(ctx, storeKey);
+        }
+    }
+    fz_catch(ctx) {
+        // not being able to cache the list isn't fatal
+        fz_report_error(ctx);
+    }
+    return list;
+}
+
+// call when page content changes e.g. after editing annotations
+void EngineMupdf::DropPageDisplayList(FzPageInfo* pageInfo) {
     auto ctx = Ctx();
+    ScopedCritSec cs(ctxAccess);
+    for (bool forPrint : {false, true}) {
+        FzDisplayListKey key{1, this, pageInfo->pageNo, forPrint};
+        fz_remove_item(ctx, fz_drop_display_list_imp, &key, &kFzDisplayListStoreType);
+    }
+}
+
+RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
     auto pageNo = args.pageNo;
 
     fz_cookie* fzcookie = nullptr;
@@ -2921,89 +3832,70 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
     }
     fz_page* page = pageInfo->page;
 
-    ScopedCritSec cs(ctxAccess);
-
-    auto pageRect = args.pageRect;
-    auto zoom = args.zoom;
-    auto rotation = args.rotation;
+    // printing uses a separate recording as it might show different
+    // optional content and annotations
+    bool forPrint = args.target == RenderTarget::Print;
+    fz_display_list* list = GetPageDisplayList(pageInfo, fzcookie, forPrint);
     fz_rect pRect;
-    if (pageRect) {
-        pRect = ToFzRect(*pageRect);
-    } else {
-        // TODO(port): use pageInfo->mediabox?
-        pRect = fz_bound_page(ctx, page);
+    fz_matrix ctm;
+    if (!list) {
+        return nullptr;
+    }
+    {
+        ScopedCritSec cs(ctxAccess);
+        if (args.pageRect) {
+            pRect = ToFzRect(*args.pageRect);
+        } else {
+            // TODO(port): use pageInfo->mediabox?
+            pRect = fz_bound_page(Ctx(), page);
+        }
+        ctm = viewctm(page, args.zoom, args.rotation);
     }
-    fz_matrix ctm = viewctm(page, zoom, rotation);
-    fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
 
-    fz_colorspace* csRgb = fz_device_rgb(ctx);
-    fz_irect ibounds = bbox;
+    // rasterizing only reads the display list so tiles of the same page
+    // (and different pages) can be rendered concurrently
+    fz_context* ctx = GetOrClonePerThreadContext(this, Ctx());
+    fz_irect ibounds = fz_round_rect(fz_transform_rect(pRect, ctm));
+    fz_rect scissor = fz_rect_from_irect(ibounds);
 
     fz_pixmap* pix = nullptr;
     fz_device* dev = nullptr;
     RenderedBitmap* bitmap = nullptr;
+    u8* samples = nullptr;
 
     fz_var(dev);
     fz_var(pix);
     fz_var(bitmap);
+    fz_var(samples);
 
-    const char* usage = "View";
-    switch (args.target) {
-        case RenderTarget::Print:
-            usage = "Print";
-            break;
+    // draw directly into the bitmap's memory, without converting or copying the pixels
+    bitmap = NewBgraRenderedBitmap(ibounds.x1 - ibounds.x0, ibounds.y1 - ibounds.y0, &samples);
+    if (!samples) {
+        fz_drop_display_list(ctx, list);
+        return bitmap;
     }
 
-    pdf_page* pdfpage = nullptr;
-    fz_var(pdfpage);
-    if (pdfdoc) {
-        fz_try(ctx) {
-            pdfpage = pdf_page_from_fz_page(ctx, page);
-            pix = fz_new_pixmap_with_bbox(ctx, csRgb, ibounds, nullptr, 1);
-            fz_clear_pixmap_with_value(ctx, pix, 0xff);
-            // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
-            // or "Print". "Export" is not used
-            dev = fz_new_draw_device(ctx, ctm, pix);
-            pdf_run_page_with_usage(ctx, pdfpage, dev, fz_identity, usage, fzcookie);
-            bitmap = NewRenderedFzPixmap(ctx, pix);
-            fz_close_device(ctx, dev);
-        }
-        fz_always(ctx) {
-            if (dev) {
-                fz_drop_device(ctx, dev);
-            }
-            fz_drop_pixmap(ctx, pix);
-        }
-        fz_catch(ctx) {
-            fz_report_error(ctx);
-            delete bitmap;
-            return nullptr;
-        }
-    } else {
-        fz_try(ctx) {
-            pix = fz_new_pixmap_with_bbox(ctx, csRgb, ibounds, nullptr, 1);
-            // TODO: to have uniform background needs to set custom css
-            // background-color and clear pixmap with the same color
-            fz_clear_pixmap_with_value(ctx, pix, 0xff);
-            // fz_clear_pixmap(ctx, pix);
-            // fz_fill_pixmap_with_color(ctx, pix, )
-            dev = fz_new_draw_device(ctx, ctm, pix);
-            fz_run_page_contents(ctx, page, dev, fz_identity, NULL);
-            fz_close_device(ctx, dev);
-            fz_drop_device(ctx, dev);
-            bitmap = NewRenderedFzPixmap(ctx, pix);
-        }
-        fz_always(ctx) {
-            fz_drop_pixmap(ctx, pix);
-        }
-        fz_catch(ctx) {
-            fz_report_error(ctx);
-            delete bitmap;
-            return nullptr;
-        }
+    fz_try(ctx) {
+        pix = fz_new_pixmap_with_bbox_and_data(ctx, fz_device_bgr(ctx), ibounds, nullptr, 1, samples);
+        // TODO: for non-pdf documents, to have uniform background needs to set custom css
+        // background-color and clear pixmap with the same color
+        fz_clear_pixmap_with_value(ctx, pix, 0xff);
+        dev = fz_new_draw_device(ctx, ctm, pix);
+        fz_run_display_list(ctx, list, dev, fz_identity, scissor, fzcookie);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, pix);
+        fz_drop_display_list(ctx, list);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        delete bitmap;
+        return nullptr;
     }
 
-    return bitmap;
+    return MaybeRenderAsPaletteImage(bitmap, samples);
 }
 
 // don't delete the result
@@ -3167,33 +4059,49 @@ RenderedBitmap* EngineMupdf::GetPageImage(int pageNo, RectF rect, int imageIdx)
 }
 
 PageText EngineMupdf::ExtractPageText(int pageNo) {
-    auto ctx = Ctx();
-
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
-    if (!pageInfo) {
+    if (!pageInfo || !pageInfo->page) {
         return {};
     }
 
-    ScopedCritSec scope(ctxAccess);
+    // shares the recording with RenderPage()
+    fz_display_list* list = GetPageDisplayList(pageInfo, nullptr);
+    if (!list) {
+        return {};
+    }
+
+    // extracting text only reads the display list so that several pages can
+    // be extracted at the same time (see DocumentTextCache::ExtractPages()).
+    // the cloned context is dropped right away (instead of using a per-thread
+    // context) as text is also extracted on short-lived threads
+    fz_context* ctx = fz_clone_context(Ctx());
+    if (!ctx) {
+        fz_drop_display_list(Ctx(), list);
+        return {};
+    }
+    InstallFitzErrorCallbacks(ctx);
 
     fz_stext_page* stext = nullptr;
     fz_var(stext);
     fz_stext_options opts{};
     fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
+        stext = fz_new_stext_page_from_display_list(ctx, list, &opts);
+    }
+    fz_always(ctx) {
+        fz_drop_display_list(ctx, list);
     }
     fz_catch(ctx) {
         fz_report_error(ctx);
     }
-    if (!stext) {
-        return {};
-    }
     PageText res;
-    // TODO: convert to return PageText
-    WCHAR* text = FzTextPageToStr(stext, &res.coords);
-    fz_drop_stext_page(ctx, stext);
-    res.text = text;
-    res.len = (int)str::Len(text);
+    if (stext) {
+        // TODO: convert to return PageText
+        WCHAR* text = FzTextPageToStr(stext, &res.coords);
+        fz_drop_stext_page(ctx, stext);
+        res.text = text;
+        res.len = (int)str::Len(text);
+    }
+    fz_drop_context(ctx);
     return res;
 }
 
@@ -3495,7 +4403,33 @@ ByteSlice EngineMupdf::GetFileData() {
     return file::ReadFile(path);
 }
 
+bool EngineMupdf::GetFingerprint(u8 digest[16]) {
+    if (!pdfdoc) {
+        return EngineBase::GetFingerprint(digest);
+    }
+    {
+        ScopedCritSec scope(ctxAccess);
+        FzStreamFingerprint(Ctx(), pdfdoc->file, digest);
+    }
+    // FzStreamFingerprint() returns an all-zero digest if the data isn't available
+    for (int i = 0; i < 16; i++) {
+        if (digest[i] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool EngineMupdf::SaveFileAs(const char* dstPath) {
+    if (pdfdoc) {
+        // write a memory-mapped file directly from the mapping
+        ScopedCritSec scope(ctxAccess);
+        ByteSlice mapped = FzMappedStreamData(pdfdoc->file);
+        if (!mapped.empty()) {
+            return file::WriteFile(dstPath, mapped);
+        }
+    }
+
     ByteSlice d = GetFileData();
     if (!d.empty()) {
         bool ok = file::WriteFile(dstPath, d);
@@ -3910,6 +4844,7 @@ NO_INLINE void MarkNotificationAsModified(EngineMupdf* e, Annotation* annot, Ann
     auto ctx = e->Ctx();
     RebuildCommentsFromAnnotations(ctx, pageInfo);
     pageInfo->elementsNeedRebuilding = true;
+    e->DropPageDisplayList(pageInfo);
 }
 
 // creates Annotation wrapper around pdf_annot
@@ -31,6 +31,8 @@ struct FzPageInfo {
     bool elementsNeedRebuilding = true;
 
     RectF mediabox{};
+    // set if mediabox is the size of another page (see EngineMupdf::provisionalLoad)
+    bool mediaboxIsEstimate = false;
     Vec<FitzPageImageInfo*> images;
 
     // if false, only loaded page (fast)
@@ -52,6 +54,7 @@ class EngineMupdf : public EngineBase {
     RectF Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
 
     ByteSlice GetFileData() override;
+    bool GetFingerprint(u8 digest[16]) override;
     bool SaveFileAs(const char* copyFileName) override;
     PageText ExtractPageText(int pageNo) override;
 
@@ -72,17 +75,26 @@ class EngineMupdf : public EngineBase {
     TempStr GetPageLabeTemp(int pageNo) const override;
     int GetPageByLabel(const char* label) const override;
 
+    bool NotifyWhenLaidOut(const Func0& fn) override;
+    bool FinishLayout() override;
+    bool ResolvePageSizes(int startPage, int endPage) override;
+
     fz_context* Ctx() const;
 
     // make sure to never ask for pagesAccess in an ctxAccess
     // protected critical section in order to avoid deadlocks
+    // ctxAccess guards _ctx and _doc. it's separate from mutexes[] so that
+    // rendering on cloned contexts doesn't block on it
     CRITICAL_SECTION* ctxAccess;
+    CRITICAL_SECTION ctxAccessCs;
     CRITICAL_SECTION pagesAccess;
 
     CRITICAL_SECTION mutexes[FZ_LOCK_MAX];
 
     fz_context* _ctx = nullptr;
     fz_locks_context fz_locks_ctx;
+    // set when _ctx is a clone of the context shared by all engines
+    int storeOwnerId = 0;
     int displayDPI{96};
     fz_document* _doc = nullptr;
     pdf_document* pdfdoc = nullptr;
@@ -94,6 +106,22 @@ class EngineMupdf : public EngineBase {
 
     TocTree* tocTree = nullptr;
 
+    // a linearized PDF (or one with lots of pages) is shown as soon as its first
+    // page can be loaded. Until FinishLayout() is called, the other pages have an
+    // estimated size (unless resolved with ResolvePageSizes()) and there's no outline,
+    // attachments, properties or page labels.
+    // loadThread loads them into the pending* fields (guarded by pagesAccess)
+    bool provisionalLoad = false;
+    bool loadDone = false;
+    HANDLE loadThread = nullptr;
+    AtomicBool abortLoad;
+    Func0 onLoaded;
+    Vec<RectF> pendingMediaboxes;
+    fz_outline* pendingOutline = nullptr;
+    fz_outline* pendingAttachments = nullptr;
+    pdf_obj* pendingInfo = nullptr;
+    StrVec* pendingPageLabels = nullptr;
+
     // used to track "dirty" state of annotations. not perfect because if we add and delete
     // the same annotation, we should be back to 0
     bool modifiedAnnotations = false;
@@ -103,12 +131,15 @@ class EngineMupdf : public EngineBase {
     // TODO(port): fz_stream can no-longer be re-opened (fz_clone_stream)
     // bool Load(fz_stream* stm, PasswordUI* pwdUI = nullptr);
     bool LoadFromStream(fz_stream* stm, const char* nameHing, PasswordUI* pwdUI = nullptr);
-    bool FinishLoading();
+    bool FinishLoading(bool allowProgressive = false, bool readsOnDemand = false);
+    void StopLoading();
     RenderedBitmap* GetPageImage(int pageNo, RectF rect, int imageIdx);
 
     FzPageInfo* GetFzPageInfoCanFail(int pageNo);
     FzPageInfo* GetFzPageInfoFast(int pageNo);
     FzPageInfo* GetFzPageInfo(int pageNo, bool loadQuick, fz_cookie* cookie = nullptr);
+    fz_display_list* GetPageDisplayList(FzPageInfo* pageInfo, fz_cookie* cookie, bool forPrint = false);
+    void DropPageDisplayList(FzPageInfo* pageInfo);
     fz_matrix viewctm(int pageNo, float zoom, int rotation);
     fz_matrix viewctm(fz_page* page, float zoom, int rotation) const;
     TocItem* BuildTocTree(TocItem* parent, fz_outline* outline, int& idCounter, bool isAttachment);
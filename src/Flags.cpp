@@ -68,6 +68,7 @@
     V(Render, "render")                          \
     V(ExtractText, "extract-text")               \
     V(Bench, "bench")                            \
+    V(BenchJson, "bench-json")                   \
     V(Dir, "d")                                  \
     V(InstallDir, "install-dir")                 \
     V(Lang, "lang")                              \
@@ -87,6 +88,7 @@
     V(Adobe, "a")                                \
     V(DDE, "dde")                                \
     V(EngineDump, "engine-dump")                 \
+    V(MapLargeFiles, "map-large-files")          \
     V(SetColorRange, "set-color-range")
 
 #define MAKE_ARG(__arg, __name) __arg,
@@ -188,9 +190,16 @@ bool IsValidPageRange(const char* ranges) {
 
 // <s> can be:
 // * "loadonly"
+// * "tiles" : measure tiles/sec when rendering with 1, 2, 4 and N threads
+// * "search" : measure building the text search index and searching with it
+// * "inflate" : measure zlib inflate throughput
+// * "pdfsync" : measure forward / inverse search with a generated .pdfsync file
+// * "firstpage" : measure time to first page of a PDF read from a simulated slow network share
+// * "layout" : measure laying out an ebook with GDI+, GDI and FreeType text measuring
 // * description of page ranges e.g. "1", "1-5", "2-3,6,8-10"
 bool IsBenchPagesInfo(const char* s) {
-    return str::EqI(s, "loadonly") || IsValidPageRange(s);
+    return str::EqI(s, "loadonly") || str::EqI(s, "tiles") || str::EqI(s, "search") || str::EqI(s, "inflate") ||
+           str::EqI(s, "pdfsync") || str::EqI(s, "firstpage") || str::EqI(s, "layout") || IsValidPageRange(s);
 }
 
 // -view [continuous][singlepage|facing|bookview]
@@ -486,6 +495,10 @@ void ParseFlags(const WCHAR* cmdLine, Flags& i) {
             i.log = true;
             continue;
         }
+        if (arg == Arg::MapLargeFiles) {
+            i.mapLargeFiles = true;
+            continue;
+        }
         if (arg == Arg::RunInstallNow) {
             i.runInstallNow = true;
             continue;
@@ -653,6 +666,10 @@ void ParseFlags(const WCHAR* cmdLine, Flags& i) {
             i.exitImmediately = true;
             continue;
         }
+        if (arg == Arg::BenchJson) {
+            i.benchJsonPath = str::Dup(param);
+            continue;
+        }
         if (arg == Arg::Dir || arg == Arg::InstallDir) {
             i.installDir = str::Dup(param);
             continue;
@@ -733,6 +750,7 @@ Flags::~Flags() {
     str::Free(appdataDir);
     str::Free(inverseSearchCmdLine);
     str::Free(stressTestPath);
+    str::Free(benchJsonPath);
     str::Free(stressTestFilter);
     str::Free(stressTestRanges);
     str::Free(lang);
@@ -35,8 +35,11 @@ struct Flags {
     // - name of the file to benchmark
     // - optional (nullptr if not available) string that represents which pages
     //   to benchmark. It can also be a string "loadonly" which means we'll
-    //   only benchmark loading of the catalog
+    //   only benchmark loading of the catalog or "tiles" which measures
+    //   multi-threaded tile rendering throughput
     StrVec pathsToBenchmark;
+    // if set, -bench results are also written to this file as json
+    char* benchJsonPath = nullptr;
     bool exitWhenDone = false;
     bool printDialog = false;
     char* printerName = nullptr;
@@ -87,6 +90,7 @@ struct Flags {
     bool testApp = false;
     char* dde = nullptr;
     bool engineDump = false; // -engine-dump
+    bool mapLargeFiles = false; // -map-large-files
 
     bool crashOnOpen = false;
 
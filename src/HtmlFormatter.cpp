@@ -165,8 +165,13 @@ HtmlFormatter::HtmlFormatter(HtmlFormatterArgs* args)
     htmlParser->SetCurrPosOff(currReparseIdx);
     ReportIf(!ValidReparseIdx(currReparseIdx, htmlParser));
 
-    gfx = mui::AllocGraphicsForMeasureText();
-    textMeasure = CreateTextRender(args->textRenderMethod, gfx, 10, 10);
+    // not mui::AllocGraphicsForMeasureText(), which is cached per thread while e.g. EngineEbook
+    // creates formatters on a loading thread and uses them on a layout thread
+    gfxBmp = new Bitmap(32, 4, PixelFormat32bppARGB);
+    gfx = new Graphics(gfxBmp);
+    mui::InitGraphicsMode(gfx);
+    textRenderMethod = args->textRenderMethod;
+    textMeasure = CreateTextRender(textRenderMethod, gfx, 10, 10);
     defaultFontName.SetCopy(args->GetFontName());
     defaultFontSize = args->fontSize;
 
@@ -194,7 +199,8 @@ HtmlFormatter::~HtmlFormatter() {
     DeleteVecMembers(pagesToSend);
     delete currPage;
     delete textMeasure;
-    mui::FreeGraphicsForMeasureText(gfx);
+    delete gfx;
+    delete gfxBmp;
     delete htmlParser;
 }
 
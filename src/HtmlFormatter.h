@@ -232,10 +232,14 @@ class HtmlFormatter {
     float pageDy = 0;
     float lineSpacing = 0;
     float spaceDx = 0;
-    Graphics* gfx = nullptr; // for measuring text
+    // for measuring text, owned by the formatter as it might be
+    // created, used and deleted on different threads
+    Graphics* gfx = nullptr;
+    Bitmap* gfxBmp = nullptr;
     AutoFreeWStr defaultFontName;
     float defaultFontSize = 0;
     Allocator* textAllocator = nullptr;
+    mui::TextRenderMethod textRenderMethod = mui::TextRenderMethod::Gdiplus;
     mui::ITextRender* textMeasure = nullptr;
 
     // style stack of the current line
@@ -290,6 +294,11 @@ class HtmlFormatter {
 
     HtmlPage* Next(bool skipEmptyPages = true);
     Vec<HtmlPage*>* FormatAllPages(bool skipEmptyPages = true);
+
+    // pages should be drawn with the same method they've been measured with
+    mui::TextRenderMethod GetMeasureMethod() const {
+        return textRenderMethod;
+    }
 };
 
 void DrawHtmlPage(Graphics* g, mui::ITextRender* textDraw, Vec<DrawInstr>* drawInstructions, float offX, float offY,
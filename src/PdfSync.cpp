@@ -5,7 +5,6 @@
 #include <synctex_parser.h>
 #include "utils/WinUtil.h"
 #include "utils/FileUtil.h"
-#include "utils/ZipUtil.h"
 
 #include "wingui/UIModels.h"
 
@@ -14,6 +13,7 @@
 #include "PdfSync.h"
 
 #include "utils/Log.h"
+#include "utils/Timer.h"
 
 // size of the mark highlighting the location calculated by forward-search
 #define MARK_SIZE 10
@@ -40,6 +40,12 @@ struct PdfsyncPoint {
     UINT page, x, y;
 };
 
+// position of a point in PDF coordinates, for finding the points close to a location
+struct PdfsyncPointPos {
+    int x, y;
+    size_t idx; // index into points
+};
+
 // Synchronizer based on .pdfsync file generated with the pdfsync tex package
 class Pdfsync : public Synchronizer {
   public:
@@ -52,6 +58,7 @@ class Pdfsync : public Synchronizer {
 
   private:
     int RebuildIndexIfNeeded();
+    void BuildLookupIndex();
     UINT SourceToRecord(const char* srcfilename, int line, int col, Vec<size_t>& records);
 
     EngineBase* engine;              // needed for converting between coordinate systems
@@ -60,6 +67,11 @@ class Pdfsync : public Synchronizer {
     Vec<PdfsyncPoint> points;        // record-to-point mapping
     Vec<PdfsyncFileIndex> fileIndex; // start and end of entries for a file in <lines>
     Vec<size_t> sheetIndex;          // start of entries for a sheet in <points>
+
+    // lookup tables built once per rebuild of the index
+    Vec<PdfsyncPointPos> pointsByY; // same sheet ranges as <points>, sorted by y within each sheet
+    Vec<size_t> linesBySource;      // indexes into <lines>, sorted by file and line
+    Vec<size_t> pointsByRecord;     // indexes into <points>, sorted by record
 };
 
 // Synchronizer based on .synctex file generated with SyncTex
@@ -85,10 +97,19 @@ class SyncTex : public Synchronizer {
     synctex_scanner_p scanner;
 };
 
+// if only a compressed .synctex.gz exists, that's the file to watch for changes
+static int StatSyncFile(const char* syncFilePath, struct _stat* st) {
+    WCHAR* path = ToWStrTemp(syncFilePath);
+    if (_wstat(path, st) == 0) {
+        return 0;
+    }
+    path = ToWStrTemp(str::JoinTemp(syncFilePath, ".gz"));
+    return _wstat(path, st);
+}
+
 Synchronizer::Synchronizer(const char* syncFilePathIn) {
     syncFilePath = str::Dup(syncFilePathIn);
-    WCHAR* path = ToWStrTemp(syncFilePathIn);
-    _wstat(path, &syncfileTimestamp);
+    StatSyncFile(syncFilePath, &syncfileTimestamp);
 }
 
 bool Synchronizer::NeedsToRebuildIndex() const {
@@ -99,8 +120,7 @@ bool Synchronizer::NeedsToRebuildIndex() const {
 
     // has the synchronization file been changed on disk?
     struct _stat newstamp;
-    WCHAR* path = ToWStrTemp(syncFilePath);
-    if (_wstat(path, &newstamp) == 0 && difftime(newstamp.st_mtime, syncfileTimestamp.st_mtime) > 0) {
+    if (StatSyncFile(syncFilePath, &newstamp) == 0 && difftime(newstamp.st_mtime, syncfileTimestamp.st_mtime) > 0) {
         // update time stamp
         memcpy((void*)&syncfileTimestamp, &newstamp, sizeof(syncfileTimestamp));
         return true; // the file has changed!
@@ -111,8 +131,7 @@ bool Synchronizer::NeedsToRebuildIndex() const {
 
 int Synchronizer::MarkIndexWasRebuilt() {
     needsToRebuildIndex = false;
-    TempWStr path = ToWStrTemp(syncFilePath);
-    _wstat(path, &syncfileTimestamp);
+    StatSyncFile(syncFilePath, &syncfileTimestamp);
     return PDFSYNCERR_SUCCESS;
 }
 
@@ -204,6 +223,9 @@ int Pdfsync::RebuildIndexIfNeeded() {
     points.Reset();
     fileIndex.Reset();
     sheetIndex.Reset();
+    pointsByY.Reset();
+    linesBySource.Reset();
+    pointsByRecord.Reset();
 
     Vec<size_t> filestack;
     int page = 1;
@@ -299,12 +321,53 @@ int Pdfsync::RebuildIndexIfNeeded() {
     fileIndex.at(0).end = lines.size();
     ReportIf(filestack.size() != 1);
 
+    BuildLookupIndex();
+
     return MarkIndexWasRebuilt();
 }
 
 // convert a coordinate from the sync file into a PDF coordinate
 #define SYNC_TO_PDF_COORDINATE(c) (c / 65781.76)
 
+// sorted tables for DocToSource and SourceToDoc so that they don't have
+// to scan all points of a sheet or all lines of a file.
+// ties are broken by the position in the file so that results are the
+// same as when scanning in order
+void Pdfsync::BuildLookupIndex() {
+    size_t nPoints = points.size();
+    for (size_t i = 0; i < nPoints; i++) {
+        PdfsyncPoint& p = points.at(i);
+        PdfsyncPointPos pos{(int)SYNC_TO_PDF_COORDINATE(p.x), (int)SYNC_TO_PDF_COORDINATE(p.y), i};
+        pointsByY.Append(pos);
+        pointsByRecord.Append(i);
+    }
+    auto cmpPos = [](const PdfsyncPointPos& a, const PdfsyncPointPos& b) -> bool {
+        return a.y < b.y || (a.y == b.y && a.idx < b.idx);
+    };
+    for (size_t sheet = 0; sheet < sheetIndex.size(); sheet++) {
+        size_t start = sheetIndex.at(sheet);
+        size_t end = sheet + 1 < sheetIndex.size() ? sheetIndex.at(sheet + 1) : nPoints;
+        std::sort(pointsByY.begin() + start, pointsByY.begin() + end, cmpPos);
+    }
+    std::sort(pointsByRecord.begin(), pointsByRecord.end(), [this](size_t a, size_t b) -> bool {
+        UINT ra = points.at(a).record;
+        UINT rb = points.at(b).record;
+        return ra < rb || (ra == rb && a < b);
+    });
+
+    for (size_t i = 0; i < lines.size(); i++) {
+        linesBySource.Append(i);
+    }
+    std::sort(linesBySource.begin(), linesBySource.end(), [this](size_t a, size_t b) -> bool {
+        PdfsyncLine& la = lines.at(a);
+        PdfsyncLine& lb = lines.at(b);
+        if (la.file != lb.file) {
+            return la.file < lb.file;
+        }
+        return la.line < lb.line || (la.line == lb.line && a < b);
+    });
+}
+
 static int cmpLineRecords(const void* a, const void* b) {
     return ((PdfsyncLine*)a)->record - ((PdfsyncLine*)b)->record;
 }
@@ -335,18 +398,37 @@ int Pdfsync::DocToSource(int pageNo, Point pt, AutoFreeStr& filename, int* line,
     UINT closest_xdist = UINT_MAX;        // horizontal distance between the hit point and the vertically-closest record
     UINT closest_ydist_record = UINT_MAX; // vertically-closest record
 
-    // read all the sections of 'p' declarations for this pdf sheet
-    for (size_t i = sheetIndex.at((size_t)pageNo); i < points.size() && points.at(i).page == (uint)pageNo; i++) {
+    size_t selected_idx = (size_t)-1;
+    size_t closest_ydist_idx = (size_t)-1;
+
+    // the 'p' declarations for this pdf sheet
+    size_t start = sheetIndex.at((size_t)pageNo);
+    size_t end = (size_t)pageNo + 1 < sheetIndex.size() ? sheetIndex.at((size_t)pageNo + 1) : points.size();
+    if (start < end && points.at(start).page != (uint)pageNo) {
+        end = start;
+    }
+
+    // only points within this vertical distance can be close enough
+    int maxDy = std::max((int)sqrt((double)PDFSYNC_EPSILON_SQUARE), PDFSYNC_EPSILON_Y);
+    PdfsyncPointPos* sheetEnd = pointsByY.begin() + end;
+    PdfsyncPointPos* it = std::lower_bound(pointsByY.begin() + start, sheetEnd, pt.y - maxDy,
+                                           [](const PdfsyncPointPos& pos, int y) -> bool { return pos.y < y; });
+    for (; it < sheetEnd && it->y <= pt.y + maxDy; it++) {
         // check whether it is closer than the closest point found so far
-        UINT dx = abs(pt.x - (int)SYNC_TO_PDF_COORDINATE(points.at(i).x));
-        UINT dy = abs(pt.y - (int)SYNC_TO_PDF_COORDINATE(points.at(i).y));
+        UINT dx = abs(pt.x - it->x);
+        UINT dy = abs(pt.y - it->y);
         UINT dist = dx * dx + dy * dy;
-        if (dist < PDFSYNC_EPSILON_SQUARE && dist < closest_xydist) {
-            selected_record = points.at(i).record;
-            closest_xydist = dist;
-        } else if ((closest_xydist == UINT_MAX) && dy < PDFSYNC_EPSILON_Y &&
-                   (dy < closest_ydist || (dy == closest_ydist && dx < closest_xdist))) {
-            closest_ydist_record = points.at(i).record;
+        if (dist < PDFSYNC_EPSILON_SQUARE) {
+            if (dist < closest_xydist || (dist == closest_xydist && it->idx < selected_idx)) {
+                selected_record = points.at(it->idx).record;
+                selected_idx = it->idx;
+                closest_xydist = dist;
+            }
+        } else if (dy < PDFSYNC_EPSILON_Y &&
+                   (dy < closest_ydist || (dy == closest_ydist && dx < closest_xdist) ||
+                    (dy == closest_ydist && dx == closest_xdist && it->idx < closest_ydist_idx))) {
+            closest_ydist_record = points.at(it->idx).record;
+            closest_ydist_idx = it->idx;
             closest_ydist = dy;
             closest_xdist = dx;
         }
@@ -422,24 +504,32 @@ UINT Pdfsync::SourceToRecord(const char* srcfilename, int line, int, Vec<size_t>
         return PDFSYNCERR_NORECORD_IN_SOURCEFILE; // there is not any record declaration for that particular source file
     }
 
-    // look for sections belonging to the specified file
-    // starting with the first section that is declared within the scope of the file.
+    // find the first record of the closest line at or after the requested line
+    // and the first record of the closest line before it
+    size_t file = (size_t)isrc;
+    auto isBefore = [this, file](size_t ix, int lineNo) -> bool {
+        PdfsyncLine& l = lines.at(ix);
+        return l.file < file || (l.file == file && (int)l.line < lineNo);
+    };
+    size_t* first = linesBySource.begin();
+    size_t* it = std::lower_bound(first, linesBySource.end(), line, isBefore);
+
     UINT min_distance = EPSILON_LINE; // distance to the closest record
     size_t lineIx = (size_t)-1;       // closest record-line index
-
-    for (size_t isec = fileIndex.at(isrc).start; isec < fileIndex.at(isrc).end; isec++) {
-        // does this section belong to the desired file?
-        if (lines.at(isec).file != (size_t)isrc) {
-            continue;
-        }
-
-        UINT d = abs((int)lines.at(isec).line - (int)line);
+    if (it < linesBySource.end() && lines.at(*it).file == file) {
+        UINT d = (UINT)((int)lines.at(*it).line - line);
         if (d < min_distance) {
             min_distance = d;
-            lineIx = isec;
-            if (0 == d) {
-                break; // We have found a record for the requested line!
-            }
+            lineIx = *it;
+        }
+    }
+    if (it > first && lines.at(it[-1]).file == file) {
+        int prevLine = (int)lines.at(it[-1]).line;
+        size_t* prev = std::lower_bound(first, it, prevLine, isBefore);
+        UINT d = (UINT)(line - prevLine);
+        if (d < min_distance || (d == min_distance && d < EPSILON_LINE && *prev < lineIx)) {
+            min_distance = d;
+            lineIx = *prev;
         }
     }
     if (lineIx == (size_t)-1) {
@@ -470,11 +560,22 @@ int Pdfsync::SourceToDoc(const char* srcfilename, int line, int col, int* page,
 
     // records have been found for the desired source position:
     // we now find the page and positions in the PDF corresponding to these found records
-    int firstPage = UINT_MAX;
-    for (PdfsyncPoint& p : points) {
-        if (!found_records.Contains(p.record)) {
-            continue;
+    Vec<size_t> found_points;
+    for (size_t record : found_records) {
+        auto it = std::lower_bound(pointsByRecord.begin(), pointsByRecord.end(), record,
+                                   [this](size_t ix, size_t rec) -> bool { return points.at(ix).record < rec; });
+        for (; it < pointsByRecord.end() && points.at(*it).record == record; it++) {
+            if (!found_points.Contains(*it)) {
+                found_points.Append(*it);
+            }
         }
+    }
+    // in the order they're declared in the sync file
+    std::sort(found_points.begin(), found_points.end());
+
+    int firstPage = UINT_MAX;
+    for (size_t ix : found_points) {
+        PdfsyncPoint& p = points.at(ix);
         if (firstPage != UINT_MAX && firstPage != (int)p.page) {
             continue;
         }
@@ -493,29 +594,6 @@ int Pdfsync::SourceToDoc(const char* srcfilename, int line, int col, int* page,
     return PDFSYNCERR_NOSYNCPOINT_FOR_LINERECORD;
 }
 
-// returns path of ungzipped file
-TempStr ungzipToFile(char* path) {
-    // to see if we can read when gzopen in synctex_scanner_new_with_output_file cannot
-    ByteSlice compr = file::ReadFile(path);
-    if (compr.IsEmpty()) {
-        logf("ungzip: file::ReadFile() '%s' failed\n", path);
-        return nullptr;
-    }
-    logf("ungzip: file::ReadFile() did read '%s'\n", path);
-    ByteSlice uncompr = Ungzip(compr);
-    compr.Free();
-    if (uncompr.IsEmpty()) {
-        return nullptr;
-    }
-    TempStr destPath = str::JoinTemp(path, ".sum.synctex");
-    bool ok = file::WriteFile(destPath, uncompr);
-    uncompr.Free();
-    if (!ok) {
-        return nullptr;
-    }
-    return destPath;
-}
-
 // SYNCTEX synchronizer
 
 int SyncTex::RebuildIndexIfNeeded() {
@@ -525,56 +603,28 @@ int SyncTex::RebuildIndexIfNeeded() {
     }
     synctex_scanner_free(scanner);
     scanner = nullptr;
-    i64 fsize;
-    TempStr pathNoExt;
-    TempStr pathSyncGz;
-    bool didRepeat = false;
-
-    TempStr syncPathTemp = str::DupTemp(syncFilePath.Get());
-Repeat:
-    TempWStr ws = ToWStrTemp(syncPathTemp);
-    AutoFreeStr pathAnsi = strconv::WStrToAnsi(ws);
-    scanner = synctex_scanner_new_with_output_file(pathAnsi, nullptr, 1);
-    if (scanner) {
-        logfa("synctex_scanner_new_with_output_file: ok for pathAnsi '%s'\n", pathAnsi.Get());
-        goto Exit;
-    }
-    if (!str::Eq(syncPathTemp, pathAnsi)) {
-        logfa("synctex_scanner_new_with_output_file: retrying for syncFilePath '%s'\n", syncPathTemp);
-        scanner = synctex_scanner_new_with_output_file(syncPathTemp, nullptr, 1);
-    }
-    if (scanner) {
-        logfa("synctex_scanner_new_with_output_file: ok forsyncFilePath '%s'\n", syncPathTemp);
-        goto Exit;
-    }
-    if (didRepeat) {
-        logfa("synctex_scanner_new_with_output_file: failed for '%s'\n", pathAnsi.Get());
-        return PDFSYNCERR_SYNCFILE_NOTFOUND;
-    }
-
-    // Note: https://github.com/sumatrapdfreader/sumatrapdf/discussions/2640#discussioncomment-2861368
-    // reported failure to parse a large (12 MB) .synctex.gz even though file exists
-    pathNoExt = path::GetPathNoExtTemp(syncFilePath);
-    pathSyncGz = str::JoinTemp(pathNoExt, ".synctex.gz");
-    if (!file::Exists(pathSyncGz)) {
-        logfa("synctex_scanner_new_with_output_file: failed for '%s'\n", pathAnsi.Get());
-        return PDFSYNCERR_SYNCFILE_NOTFOUND;
-    }
-    fsize = file::GetSize(pathSyncGz);
-    logf("SyncTex::RebuildIndexIfNeeded: trying to uncompress %s, size: %d\n", pathSyncGz, (int)fsize);
-
-    syncPathTemp = ungzipToFile(pathSyncGz);
-    if (!syncPathTemp) {
-        logfa("SyncTex::RebuildIndexIfNeeded: ungzipToFile('%s') failecd\n", pathSyncGz);
-        goto Exit;
-    }
-    fsize = file::GetSize(syncPathTemp);
-    logfa("SyncTex::RebuildIndexIfNeeded: retrying with uncompressed version '%s' of size %d\n", syncPathTemp, fsize);
-
-    didRepeat = true;
-    goto Repeat;
-
-Exit:
+
+    // prefer .synctex over .synctex.gz, same as synctex_scanner_new_with_output_file()
+    TempStr path = syncFilePath.Get();
+    if (!file::Exists(path)) {
+        TempStr pathNoExt = path::GetPathNoExtTemp(syncFilePath);
+        path = str::JoinTemp(pathNoExt, ".synctex.gz");
+        if (!file::Exists(path)) {
+            logfa("SyncTex::RebuildIndexIfNeeded: '%s' doesn't exist\n", path);
+            return PDFSYNCERR_SYNCFILE_NOTFOUND;
+        }
+    }
+
+    // the .synctex.gz is uncompressed by zlib while parsing, without a temporary file
+    // https://github.com/sumatrapdfreader/sumatrapdf/discussions/2640#discussioncomment-2861368
+    auto timeStart = TimeGet();
+    TempWStr pathW = ToWStrTemp(path);
+    scanner = synctex_scanner_new_with_synctex_file_w(pathW, syncFilePath, 1);
+    if (!scanner) {
+        logfa("SyncTex::RebuildIndexIfNeeded: failed to parse '%s'\n", path);
+        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
+    }
+    logfa("SyncTex::RebuildIndexIfNeeded: parsed '%s' in %.2f ms\n", path, TimeSinceInMs(timeStart));
     return MarkIndexWasRebuilt();
 }
 
@@ -296,6 +296,12 @@ static bool PrintToDevice(const PrintData& pd) {
         pd.engine->Release();
     };
 
+    // the cloned engine isn't shared with a view, so it's safe to
+    // wait for the final page count of lazily laid out ebooks
+    if (!pd.failedEngineClone) {
+        pd.engine->FinishLayout();
+    }
+
     DOCINFOW di{};
     di.cbSize = sizeof(DOCINFO);
     if (gPluginMode) {
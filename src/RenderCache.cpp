@@ -5,6 +5,7 @@
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/UIModels.h"
 
@@ -30,6 +31,11 @@
 
 bool gShowTileLayout = false;
 
+struct RenderThreadData {
+    RenderCache* cache = nullptr;
+    int threadIdx = 0;
+};
+
 RenderCache::RenderCache() : maxTileSize({GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN)}) {
     // enable when debugging RenderCache logic
     // gEnableDbgLog = true;
@@ -38,23 +44,43 @@ RenderCache::RenderCache() : maxTileSize({GetSystemMetrics(SM_CXSCREEN), GetSyst
     textColor = WIN_COL_BLACK;
     backgroundColor = WIN_COL_WHITE;
 
+    MEMORYSTATUSEX ms{};
+    ms.dwLength = sizeof(ms);
+    if (GlobalMemoryStatusEx(&ms)) {
+        physicalMemBytes = (i64)ms.ullTotalPhys;
+    }
+
     InitializeCriticalSection(&cacheAccess);
     InitializeCriticalSection(&requestAccess);
 
     startRendering = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-    renderThread = CreateThread(nullptr, 0, RenderCacheThread, this, 0, nullptr);
-    ReportIf(nullptr == renderThread);
+    // leave one core for the ui thread
+    int nThreads = limitValue(GetLogicalCpuCount() - 1, 1, MAX_RENDER_THREADS);
+    for (int i = 0; i < nThreads; i++) {
+        auto data = new RenderThreadData{this, i};
+        HANDLE h = CreateThread(nullptr, 0, RenderCacheThread, data, 0, nullptr);
+        ReportIf(nullptr == h);
+        if (!h) {
+            delete data;
+            break;
+        }
+        renderThreads[nRenderThreads++] = h;
+    }
 }
 
 RenderCache::~RenderCache() {
     EnterCriticalSection(&requestAccess);
     EnterCriticalSection(&cacheAccess);
 
-    CloseHandle(renderThread);
+    bool isRendering = false;
+    for (int i = 0; i < nRenderThreads; i++) {
+        CloseHandle(renderThreads[i]);
+        isRendering |= curReqs[i] != nullptr;
+    }
     CloseHandle(startRendering);
-    if (curReq || 0 != requestCount || cacheCount != 0) {
-        logf("RenderCache::~RenderCache: curReq: 0x%p, requestCount: %d, cacheCount: %d\n", curReq, requestCount,
-             cacheCount);
+    if (isRendering || 0 != requestCount || cache.Size() != 0) {
+        logf("RenderCache::~RenderCache: isRendering: %d, requestCount: %d, cacheCount: %d\n", (int)isRendering,
+             requestCount, cache.Size());
         ReportIf(true);
     }
 
@@ -64,18 +90,48 @@ RenderCache::~RenderCache() {
     DeleteCriticalSection(&requestAccess);
 }
 
+// zoom and tile are not part of the key because Find() can be asked
+// for any zoom / tile of a page
+static int CacheBucketIdx(DisplayModel* dm, int pageNo) {
+    u8 key[sizeof(dm) + sizeof(pageNo)];
+    memcpy(key, &dm, sizeof(dm));
+    memcpy(key + sizeof(dm), &pageNo, sizeof(pageNo));
+    return (int)(MurmurHash2(key, sizeof(key)) % RENDER_CACHE_BUCKETS);
+}
+
+void RenderCache::IndexAdd(BitmapCacheEntry* entry) {
+    int idx = CacheBucketIdx(entry->dm, entry->pageNo);
+    entry->nextInBucket = cacheIndex[idx];
+    cacheIndex[idx] = entry;
+}
+
+void RenderCache::IndexRemove(BitmapCacheEntry* entry) {
+    int idx = CacheBucketIdx(entry->dm, entry->pageNo);
+    BitmapCacheEntry** curr = &cacheIndex[idx];
+    while (*curr) {
+        if (*curr == entry) {
+            *curr = entry->nextInBucket;
+            entry->nextInBucket = nullptr;
+            return;
+        }
+        curr = &(*curr)->nextInBucket;
+    }
+    ReportIf(true); // must be in the index
+}
+
 /* Find a bitmap for a page defined by <dm> and <pageNo> and optionally also
    <rotation> and <zoom> in the cache - call DropCacheEntry when you
    no longer need a found entry. */
 BitmapCacheEntry* RenderCache::Find(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile) {
     ScopedCritSec scope(&cacheAccess);
     rotation = NormalizeRotation(rotation);
-    for (int i = 0; i < cacheCount; i++) {
-        BitmapCacheEntry* e = cache[i];
+    int idx = CacheBucketIdx(dm, pageNo);
+    for (BitmapCacheEntry* e = cacheIndex[idx]; e; e = e->nextInBucket) {
         if ((dm == e->dm) && (pageNo == e->pageNo) && (rotation == e->rotation) &&
             (kInvalidZoom == zoom || zoom == e->zoom) && (!tile || e->tile == *tile)) {
             e->refs++;
-            ReportIf(i != e->cacheIdx);
+            e->lastUsed = ++useCounter;
+            ReportIf(cache[e->cacheIdx] != e);
             return e;
         }
     }
@@ -97,6 +153,7 @@ bool RenderCache::DropCacheEntry(BitmapCacheEntry* entry) {
         return false;
     }
     int idx = entry->cacheIdx;
+    int cacheCount = cache.Size();
     ReportIf(idx < 0);
     ReportIf(idx >= cacheCount);
     if ((idx < 0) || (idx >= cacheCount)) {
@@ -112,55 +169,130 @@ bool RenderCache::DropCacheEntry(BitmapCacheEntry* entry) {
     logf("RenderCache::DropCacheEntry: pageNo: %d, rotation: %d, zoom: %.2f\n", entry->pageNo, entry->rotation,
          entry->zoom);
 
+    IndexRemove(entry);
+    cacheBytes -= entry->bitmapBytes;
+    ReportIf(cacheBytes < 0);
     delete entry;
 
     // fast removal by replacing freed item with the item at the end
-    cache[idx] = nullptr;
-    int lastIdx = cacheCount - 1;
-    if ((lastIdx >= 0) && (idx != lastIdx)) {
-        cache[idx] = cache[lastIdx];
+    cache.RemoveAtFast(idx);
+    if (idx < cache.Size()) {
         cache[idx]->cacheIdx = idx;
-        cache[lastIdx] = nullptr;
     }
-    cacheCount--;
-    ReportIf(cacheCount < 0);
     return true;
 }
 
-static bool FreeIfFull(RenderCache* rc, const PageRenderRequest& req) {
-    int n = rc->cacheCount;
-    if (n < MAX_BITMAPS_CACHED) {
-        return true;
+void RenderCache::GetStats(RenderCacheStats* stats) {
+    ScopedCritSec scopeReq(&requestAccess);
+    stats->nRenderThreads = nRenderThreads;
+    stats->queueDepth = requestCount;
+    stats->maxQueueDepth = maxQueueDepth;
+    stats->nRendered = nRendered;
+    stats->totalLatencyMs = totalLatencyMs;
+    stats->maxLatencyMs = maxLatencyMs;
+    stats->nCancelled = nCancelled;
+
+    ScopedCritSec scope(&cacheAccess);
+    stats->hits = nHits;
+    stats->misses = nMisses;
+    stats->evictions = nEvictions;
+    stats->cacheBytes = cacheBytes;
+    stats->maxCacheBytes = GetMaxCacheBytes();
+    stats->nBitmaps = cache.Size();
+}
+
+// the budget is a percentage of physical memory, see FixedPageUI.RenderCacheMemoryPercent
+i64 RenderCache::GetMaxCacheBytes() const {
+    int percent = gGlobalPrefs ? gGlobalPrefs->fixedPageUI.renderCacheMemoryPercent : 10;
+    percent = limitValue(percent, 1, 50);
+    i64 physMem = physicalMemBytes;
+    if (physMem <= 0) {
+        physMem = (i64)1024 * 1024 * 1024;
     }
+    i64 res = physMem / 100 * percent;
+    if (!IsProcess64()) {
+        // address space is the limit for 32-bit processes
+        res = std::min(res, (i64)512 * 1024 * 1024);
+    }
+    return res;
+}
 
-    DisplayModel* dm = req.dm;
-    // free an invisible page of the same DisplayModel ...
-    for (int i = 0; i < n; i++) {
-        auto entry = rc->cache[i];
-        if (entry->dm == dm && !dm->PageVisibleNearby(entry->pageNo)) {
-            bool didDrop = rc->DropCacheEntry(entry);
-            if (didDrop) {
-                return true;
-            }
-        }
+static i64 GetBitmapBytes(RenderedBitmap* bmp) {
+    HBITMAP hbmp = bmp ? bmp->GetBitmap() : nullptr;
+    if (!hbmp) {
+        return 0;
+    }
+    BITMAP bm{};
+    if (GetObjectW(hbmp, sizeof(bm), &bm) != 0) {
+        return (i64)bm.bmWidthBytes * (i64)bm.bmHeight;
     }
+    Size size = bmp->GetSize();
+    return (i64)size.dx * (i64)size.dy * 4;
+}
+
+// lower value means evict first, -1 means: don't evict
+// we prefer evicting pages far from the visible part of a document.
+// we don't free visible pages of the document we're currently rendering
+// as it leads to flicker
+// TODO: it can still flicker if the dm is from a visible tab
+// in a different window, but it's harder to detect
+static int EvictionClass(BitmapCacheEntry* e, DisplayModel* dm) {
+    if (e->refs > 1) {
+        // currently being painted
+        return -1;
+    }
+    if (!e->dm->PageVisibleNearby(e->pageNo)) {
+        return 0;
+    }
+    if (e->dm != dm) {
+        return 1;
+    }
+    if (e->outOfDate || !e->dm->PageVisible(e->pageNo)) {
+        return 2;
+    }
+    return -1;
+}
 
-    // ... or just the oldest cached page
-    for (int i = 0; i < n; i++) {
-        auto entry = rc->cache[i];
-        if (entry->dm == dm) {
-            // don't free pages from the document we're currently displaying
-            // as it leads to flicker
-            // TODO: it can still flicker if the dm is from a visible tab
-            // in a different window, but it's harder to detect
+static BitmapCacheEntry* FindEntryToEvict(RenderCache* rc, DisplayModel* dm) {
+    BitmapCacheEntry* res = nullptr;
+    int resClass = -1;
+    int resDist = 0;
+    for (BitmapCacheEntry* e : rc->cache) {
+        int cls = EvictionClass(e, dm);
+        if (cls < 0) {
             continue;
         }
-        bool didDrop = rc->DropCacheEntry(entry);
-        if (didDrop) {
-            return true;
+        // distance from the current page only matters for invisible pages
+        int dist = 0;
+        if (cls == 0) {
+            dist = abs(e->pageNo - e->dm->CurrentPageNo());
+        }
+        bool isBetter = !res || cls < resClass;
+        if (!isBetter && cls == resClass) {
+            isBetter = dist > resDist || (dist == resDist && e->lastUsed < res->lastUsed);
+        }
+        if (isBetter) {
+            res = e;
+            resClass = cls;
+            resDist = dist;
         }
     }
-    return false;
+    return res;
+}
+
+// returns false if there's no space for another bitmap. we can go over
+// the memory budget if all cached bitmaps are visible
+static bool FreeIfFull(RenderCache* rc, const PageRenderRequest& req, i64 bmpBytes) {
+    i64 maxBytes = rc->GetMaxCacheBytes();
+    while (rc->cache.Size() >= MAX_BITMAPS_CACHED || rc->cacheBytes + bmpBytes > maxBytes) {
+        BitmapCacheEntry* entry = FindEntryToEvict(rc, req.dm);
+        if (!entry) {
+            return rc->cache.Size() < MAX_BITMAPS_CACHED;
+        }
+        rc->nEvictions++;
+        rc->DropCacheEntry(entry);
+    }
+    return true;
 }
 
 void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bmp) {
@@ -168,20 +300,27 @@ void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bmp) {
     ReportIf(!req.dm);
 
     req.rotation = NormalizeRotation(req.rotation);
-    ReportIf(cacheCount > MAX_BITMAPS_CACHED);
+    ReportIf(cache.Size() > MAX_BITMAPS_CACHED);
 
     /* It's possible there still is a cached bitmap with different zoom/rotation */
     FreePage(req.dm, req.pageNo, &req.tile);
 
-    bool hasSpace = FreeIfFull(this, req);
-    ReportIf(!hasSpace); // TODO: FreeIfFull() might actually fail to free
-    ReportIf(cacheCount > MAX_BITMAPS_CACHED);
+    i64 bmpBytes = GetBitmapBytes(bmp);
+    bool hasSpace = FreeIfFull(this, req, bmpBytes);
+    if (!hasSpace) {
+        logf("RenderCache::Add: no space for pageNo: %d, bytes: %d\n", req.pageNo, (int)bmpBytes);
+        delete bmp;
+        return;
+    }
 
     // Copy the PageRenderRequest as it will be reused
     auto entry = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bmp);
-    entry->cacheIdx = cacheCount;
-    cache[cacheCount] = entry;
-    cacheCount++;
+    entry->bitmapBytes = bmpBytes;
+    entry->lastUsed = ++useCounter;
+    entry->cacheIdx = cache.Size();
+    cache.Append(entry);
+    IndexAdd(entry);
+    cacheBytes += bmpBytes;
 }
 
 static RectF GetTileRect(RectF pagerect, TilePosition tile) {
@@ -238,6 +377,43 @@ static bool IsTileVisible(DisplayModel* dm, int pageNo, TilePosition tile, float
     return !tileOnScreen.Intersect(screen).IsEmpty();
 }
 
+// lower value is rendered first
+enum class RenderPriority {
+    // tiles visible on screen
+    Visible = 0,
+    // tiles of pages near the viewport
+    Nearby,
+    // everything else e.g. thumbnails
+    Prefetch,
+};
+
+static RenderPriority GetRenderPriority(PageRenderRequest* req) {
+    if (req->renderCb) {
+        return RenderPriority::Prefetch;
+    }
+    if (IsTileVisible(req->dm, req->pageNo, req->tile)) {
+        return RenderPriority::Visible;
+    }
+    if (req->dm->PageVisibleNearby(req->pageNo)) {
+        return RenderPriority::Nearby;
+    }
+    return RenderPriority::Prefetch;
+}
+
+// requests are ordered from oldest to newest
+static int GetLeastImportantRequestIdx(RenderCache* rc) {
+    int res = 0;
+    RenderPriority resPriority = GetRenderPriority(&rc->requests[0]);
+    for (int i = 1; i < rc->requestCount; i++) {
+        RenderPriority priority = GetRenderPriority(&rc->requests[i]);
+        if (priority > resPriority) {
+            res = i;
+            resPriority = priority;
+        }
+    }
+    return res;
+}
+
 /* Free all bitmaps in the cache that are of a specific page (or all pages
    of the given DisplayModel, or even all invisible pages). */
 void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
@@ -245,7 +421,7 @@ void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
     ScopedCritSec scope(&cacheAccess);
 
     // must go from end becaues freeing changes the cache
-    for (int i = cacheCount - 1; i >= 0; i--) {
+    for (int i = cache.Size() - 1; i >= 0; i--) {
         BitmapCacheEntry* entry = cache[i];
         bool shouldFree;
         if (dm && pageNo != kInvalidPageNo) {
@@ -287,13 +463,15 @@ void RenderCache::FreeNotVisible() {
 // mark invisible pages as out-of-date to prevent inconsistencies
 void RenderCache::KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm) {
     ScopedCritSec scope(&cacheAccess);
-    for (int i = 0; i < cacheCount; i++) {
-        BitmapCacheEntry* entry = cache[i];
+    for (BitmapCacheEntry* entry : cache) {
         if (entry->dm != oldDm) {
             continue;
         }
-        if (oldDm->PageVisible(entry->pageNo)) {
+        if (oldDm->PageVisible(entry->pageNo) && oldDm != newDm) {
+            // dm is part of the index key
+            IndexRemove(entry);
             entry->dm = newDm;
+            IndexAdd(entry);
         }
         // make sure that the page is rerendered eventually
         entry->zoom = kInvalidZoom;
@@ -306,15 +484,13 @@ void RenderCache::Invalidate(DisplayModel* dm, int pageNo, RectF rect) {
     ScopedCritSec scopeReq(&requestAccess);
 
     ClearQueueForDisplayModel(dm, pageNo);
-    if (curReq && curReq->dm == dm && curReq->pageNo == pageNo) {
-        AbortCurrentRequest();
-    }
+    AbortCurrentRequests(dm, pageNo);
 
     ScopedCritSec scopeCache(&cacheAccess);
 
     RectF mediabox = dm->GetEngine()->PageMediabox(pageNo);
-    for (int i = 0; i < cacheCount; i++) {
-        auto e = cache[i];
+    int idx = CacheBucketIdx(dm, pageNo);
+    for (BitmapCacheEntry* e = cacheIndex[idx]; e; e = e->nextInBucket) {
         if (e->dm == dm && e->pageNo == pageNo && !GetTileRect(mediabox, e->tile).Intersect(rect).IsEmpty()) {
             e->zoom = kInvalidZoom;
             e->outOfDate = true;
@@ -359,8 +535,8 @@ USHORT RenderCache::GetTileRes(DisplayModel* dm, int pageNo) const {
 USHORT RenderCache::GetMaxTileRes(DisplayModel* dm, int pageNo, int rotation) {
     ScopedCritSec scope(&cacheAccess);
     USHORT maxRes = 0;
-    for (int i = 0; i < cacheCount; i++) {
-        auto e = cache[i];
+    int idx = CacheBucketIdx(dm, pageNo);
+    for (BitmapCacheEntry* e = cacheIndex[idx]; e; e = e->nextInBucket) {
         if (e->dm == dm && e->pageNo == pageNo && e->rotation == rotation) {
             maxRes = std::max(e->tile.res, maxRes);
         }
@@ -385,13 +561,13 @@ bool RenderCache::ReduceTileSize() {
     }
 
     // invalidate all rendered bitmaps and all requests
-    while (cacheCount > 0) {
+    while (cache.Size() > 0) {
         FreeForDisplayModel(cache[0]->dm);
     }
     while (requestCount > 0) {
         ClearQueueForDisplayModel(requests[0].dm);
     }
-    AbortCurrentRequest();
+    AbortCurrentRequests();
 
     return true;
 }
@@ -425,14 +601,20 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
     int rotation = NormalizeRotation(dm->GetRotation());
     float zoom = dm->GetZoomReal(pageNo);
 
-    if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
-        if ((curReq->zoom == zoom) && (curReq->rotation == rotation)) {
-            /* we're already rendering exactly the same page */
-            return;
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = curReqs[i];
+        if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
+            if ((curReq->zoom == zoom) && (curReq->rotation == rotation)) {
+                /* we're already rendering exactly the same page */
+                return;
+            }
+            /* Currently rendered page is for the same page but with different zoom
+            or rotation, so abort it */
+            if (curReq->abortCookie) {
+                curReq->abortCookie->Abort();
+            }
+            curReq->abort = true;
         }
-        /* Currently rendered page is for the same page but with different zoom
-        or rotation, so abort it */
-        AbortCurrentRequest();
     }
 
     // clear requests for tiles of different resolution and invisible tiles
@@ -496,17 +678,19 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
 
     /* add request to the queue */
     if (requestCount == MAX_PAGE_REQUESTS) {
-        /* queue is full -> remove the oldest items on the queue */
-        if (requests[0].renderCb) {
-            requests[0].renderCb->Call(nullptr);
+        /* queue is full -> remove the least important (and oldest) item on the queue */
+        int idx = GetLeastImportantRequestIdx(this);
+        if (requests[idx].renderCb) {
+            requests[idx].renderCb->Call(nullptr);
         }
-        memmove(&(requests[0]), &(requests[1]), sizeof(PageRenderRequest) * (MAX_PAGE_REQUESTS - 1));
+        memmove(&(requests[idx]), &(requests[idx + 1]), sizeof(PageRenderRequest) * (MAX_PAGE_REQUESTS - idx - 1));
         newRequest = &(requests[MAX_PAGE_REQUESTS - 1]);
     } else {
         newRequest = &(requests[requestCount]);
         requestCount++;
     }
     ReportIf(requestCount > MAX_PAGE_REQUESTS);
+    maxQueueDepth = std::max(maxQueueDepth, requestCount);
 
     newRequest->dm = dm;
     newRequest->pageNo = pageNo;
@@ -535,8 +719,11 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
 int RenderCache::GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile) {
     ScopedCritSec scope(&requestAccess);
 
-    if (curReq && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile) {
-        return GetTickCount() - curReq->timestamp;
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = curReqs[i];
+        if (curReq && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile) {
+            return GetTickCount() - curReq->timestamp;
+        }
     }
 
     for (int i = 0; i < requestCount; i++) {
@@ -548,33 +735,76 @@ int RenderCache::GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile)
     return RENDER_DELAY_UNDEFINED;
 }
 
-bool RenderCache::GetNextRequest(PageRenderRequest* req) {
-    ScopedCritSec scope(&requestAccess);
-
-    if (requestCount == 0) {
+// engines that don't allow concurrent rendering are only rendered by one thread at a time
+bool RenderCache::IsEngineBusy(EngineBase* engine) const {
+    if (engine->allowsConcurrentRendering) {
         return false;
     }
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = curReqs[i];
+        if (curReq && curReq->dm->GetEngine() == engine) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// picks the most important request that can be rendered now. requests
+// with the same priority are rendered most recent first
+bool RenderCache::GetNextRequest(PageRenderRequest* req, int threadIdx) {
+    ScopedCritSec scope(&requestAccess);
 
     ReportIf(requestCount < 0);
     ReportIf(requestCount > MAX_PAGE_REQUESTS);
+    int bestIdx = -1;
+    RenderPriority bestPriority = RenderPriority::Prefetch;
+    for (int i = requestCount - 1; i >= 0; i--) {
+        PageRenderRequest* r = &requests[i];
+        if (IsEngineBusy(r->dm->GetEngine())) {
+            continue;
+        }
+        RenderPriority priority = GetRenderPriority(r);
+        if (bestIdx < 0 || priority < bestPriority) {
+            bestIdx = i;
+            bestPriority = priority;
+        }
+    }
+    if (bestIdx < 0) {
+        return false;
+    }
+
+    *req = requests[bestIdx];
+    memmove(&(requests[bestIdx]), &(requests[bestIdx + 1]), sizeof(PageRenderRequest) * (requestCount - bestIdx - 1));
     requestCount--;
-    *req = requests[requestCount];
-    curReq = req;
+    curReqs[threadIdx] = req;
     ReportIf(requestCount < 0);
     ReportIf(req->abort);
 
+    if (requestCount > 0) {
+        // wake up another render thread
+        SetEvent(startRendering);
+    }
     return true;
 }
 
-bool RenderCache::ClearCurrentRequest() {
+void RenderCache::ClearCurrentRequest(int threadIdx, bool rendered) {
     ScopedCritSec scope(&requestAccess);
+    PageRenderRequest* curReq = curReqs[threadIdx];
     if (curReq) {
+        if (rendered) {
+            int latencyMs = (int)(GetTickCount() - curReq->timestamp);
+            nRendered++;
+            totalLatencyMs += latencyMs;
+            maxLatencyMs = std::max(maxLatencyMs, latencyMs);
+        }
         delete curReq->abortCookie;
     }
-    curReq = nullptr;
+    curReqs[threadIdx] = nullptr;
 
-    bool isQueueEmpty = requestCount == 0;
-    return isQueueEmpty;
+    if (requestCount > 0) {
+        // requests might be waiting for the engine we've just been using
+        SetEvent(startRendering);
+    }
 }
 
 /* Wait until rendering of a page beloging to <dm> has finished. */
@@ -585,14 +815,18 @@ void RenderCache::CancelRendering(DisplayModel* dm) {
 
     for (;;) {
         EnterCriticalSection(&requestAccess);
-        if (!curReq || (curReq->dm != dm)) {
+        bool isRendering = false;
+        for (int i = 0; i < nRenderThreads; i++) {
+            isRendering |= curReqs[i] && curReqs[i]->dm == dm;
+        }
+        if (!isRendering) {
             // to be on the safe side
             ClearQueueForDisplayModel(dm);
             LeaveCriticalSection(&requestAccess);
             return;
         }
 
-        AbortCurrentRequest();
+        AbortCurrentRequests(dm);
         LeaveCriticalSection(&requestAccess);
 
         /* TODO: busy loop is not good, but I don't have a better idea */
@@ -622,36 +856,62 @@ void RenderCache::ClearQueueForDisplayModel(DisplayModel* dm, int pageNo, TilePo
     }
 }
 
-void RenderCache::AbortCurrentRequest() {
+// aborts requests being rendered, optionally only for a given dm / page
+void RenderCache::AbortCurrentRequests(DisplayModel* dm, int pageNo) {
     ScopedCritSec scope(&requestAccess);
-    if (!curReq) {
-        return;
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = curReqs[i];
+        if (!curReq) {
+            continue;
+        }
+        if (dm && (curReq->dm != dm || (pageNo != kInvalidPageNo && curReq->pageNo != pageNo))) {
+            continue;
+        }
+        if (curReq->abortCookie) {
+            curReq->abortCookie->Abort();
+        }
+        curReq->abort = true;
     }
-    if (curReq->abortCookie) {
-        curReq->abortCookie->Abort();
+}
+
+// called when the view changes (e.g. after scrolling) to stop wasting
+// time on pages that are no longer visible
+void RenderCache::AbortInvisibleRequests() {
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = curReqs[i];
+        if (!curReq || curReq->abort || curReq->renderCb) {
+            continue;
+        }
+        if (curReq->dm->PageVisibleNearby(curReq->pageNo)) {
+            continue;
+        }
+        if (curReq->abortCookie) {
+            curReq->abortCookie->Abort();
+        }
+        curReq->abort = true;
+        nCancelled++;
     }
-    curReq->abort = true;
 }
 
 DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
-    RenderCache* cache = (RenderCache*)data;
+    auto threadData = (RenderThreadData*)data;
+    RenderCache* cache = threadData->cache;
+    int threadIdx = threadData->threadIdx;
+    delete threadData;
+    SetThreadName("RenderCacheThread");
+
     PageRenderRequest req;
     RenderedBitmap* bmp;
 
     for (;;) {
-        if (cache->ClearCurrentRequest()) {
-            DWORD waitResult = WaitForSingleObject(cache->startRendering, INFINITE);
-            // Is it not a page render request?
-            if (WAIT_OBJECT_0 != waitResult) {
-                continue;
-            }
-        }
-
-        if (!cache->GetNextRequest(&req)) {
+        if (!cache->GetNextRequest(&req, threadIdx)) {
+            WaitForSingleObject(cache->startRendering, INFINITE);
             continue;
         }
 
         if (!req.dm->PageVisibleNearby(req.pageNo) && !req.renderCb) {
+            cache->ClearCurrentRequest(threadIdx, false);
             continue;
         }
 
@@ -659,6 +919,7 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
             if (req.renderCb) {
                 req.renderCb->Call(nullptr);
             }
+            cache->ClearCurrentRequest(threadIdx, false);
             continue;
         }
 
@@ -679,6 +940,7 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
             if (req.renderCb) {
                 req.renderCb->Call(nullptr);
             }
+            cache->ClearCurrentRequest(threadIdx, false);
             continue;
         }
         auto durMs = TimeSinceInMs(timeStart);
@@ -699,6 +961,7 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
             cache->Add(req, bmp);
             req.dm->RepaintDisplay();
         }
+        cache->ClearCurrentRequest(threadIdx, true);
         ResetTempAllocator();
     }
     DestroyTempAllocator();
@@ -712,6 +975,15 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
     BitmapCacheEntry* entry = Find(dm, pageNo, dm->GetRotation(), zoom, &tile);
     int renderDelay = 0;
 
+    {
+        ScopedCritSec scope(&cacheAccess);
+        if (entry) {
+            nHits++;
+        } else {
+            nMisses++;
+        }
+    }
+
     if (!entry) {
         if (!isRemoteSession) {
             if (renderedReplacement) {
@@ -881,6 +1153,7 @@ int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageI
     }
     FreeNotVisible();
 #endif
+    AbortInvisibleRequests();
 
     return renderDelayMin;
 }
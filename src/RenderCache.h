@@ -8,12 +8,16 @@ constexpr int RENDER_DELAY_FAILED = std::numeric_limits<int>::max() - 2;
 
 #define INVALID_TILE_RES ((USHORT) - 1)
 
-#define MAX_PAGE_REQUESTS 8
-// keep this value reasonably low, else we'll run out of
-// GDI resources/memory when caching many larger bitmaps
-// TODO: this should be based on amount of memory taken by rendered pages
-// i.e. one big page can use as much memory as lots of small pages
-#define MAX_BITMAPS_CACHED 64
+#define MAX_PAGE_REQUESTS 32
+// upper limit for number of render threads, the actual number
+// depends on number of cpu cores
+#define MAX_RENDER_THREADS 8
+// the cache is limited by memory used by bitmaps (see RenderCache::GetMaxCacheBytes())
+// this only limits the number of bitmaps so that we don't run out of GDI
+// handles when caching lots of small bitmaps
+#define MAX_BITMAPS_CACHED 1024
+// number of buckets in RenderCache::cacheIndex
+#define RENDER_CACHE_BUCKETS 256
 
 struct PageInfo;
 
@@ -48,8 +52,14 @@ struct BitmapCacheEntry {
 
     // owned by the BitmapCacheEntry
     RenderedBitmap* bitmap = nullptr;
+    // memory used by bitmap, counted against RenderCache::GetMaxCacheBytes()
+    i64 bitmapBytes = 0;
     bool outOfDate = false;
     int refs = 1;
+    // value of RenderCache::useCounter when last accessed, for LRU eviction
+    u64 lastUsed = 0;
+    // next entry in the same RenderCache::cacheIndex bucket
+    BitmapCacheEntry* nextInBucket = nullptr;
 
     BitmapCacheEntry(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile,
                      RenderedBitmap* bitmap) {
@@ -84,18 +94,56 @@ struct PageRenderRequest {
     const OnBitmapRendered* renderCb = nullptr;
 };
 
+// for tuning the cache
+struct RenderCacheStats {
+    // a bitmap at the right zoom was available when painting a tile
+    i64 hits = 0;
+    i64 misses = 0;
+    // bitmaps freed to stay within the memory budget
+    i64 evictions = 0;
+    i64 cacheBytes = 0;
+    i64 maxCacheBytes = 0;
+    int nBitmaps = 0;
+
+    int nRenderThreads = 0;
+    int queueDepth = 0;
+    int maxQueueDepth = 0;
+    // requests that finished rendering and time from being queued to being rendered
+    i64 nRendered = 0;
+    i64 totalLatencyMs = 0;
+    int maxLatencyMs = 0;
+    // requests dropped because their page is no longer visible
+    i64 nCancelled = 0;
+};
+
 struct RenderCache {
-    BitmapCacheEntry* cache[MAX_BITMAPS_CACHED]{};
-    int cacheCount = 0;
+    Vec<BitmapCacheEntry*> cache;
+    // entries of cache hashed by (dm, pageNo)
+    BitmapCacheEntry* cacheIndex[RENDER_CACHE_BUCKETS]{};
+    // sum of bitmapBytes of all entries in cache
+    i64 cacheBytes = 0;
+    u64 useCounter = 0;
+    i64 physicalMemBytes = 0;
+    i64 nHits = 0;
+    i64 nMisses = 0;
+    i64 nEvictions = 0;
     // make sure to never ask for requestAccess in a cacheAccess
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION cacheAccess;
 
     PageRenderRequest requests[MAX_PAGE_REQUESTS]{};
     int requestCount = 0;
-    PageRenderRequest* curReq = nullptr;
+    // request currently being rendered by a given render thread
+    PageRenderRequest* curReqs[MAX_RENDER_THREADS]{};
     CRITICAL_SECTION requestAccess;
-    HANDLE renderThread = nullptr;
+    HANDLE renderThreads[MAX_RENDER_THREADS]{};
+    int nRenderThreads = 0;
+
+    int maxQueueDepth = 0;
+    i64 nRendered = 0;
+    i64 totalLatencyMs = 0;
+    int maxLatencyMs = 0;
+    i64 nCancelled = 0;
 
     Size maxTileSize{};
     bool isRemoteSession = false;
@@ -124,8 +172,12 @@ struct RenderCache {
     // painted, 0 if something has been painted and RENDER_DELAY_FAILED on failure
     int Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageInfo* pageInfo, bool* renderOutOfDateCue);
 
-    bool ClearCurrentRequest();
-    bool GetNextRequest(PageRenderRequest* req);
+    void GetStats(RenderCacheStats* stats);
+    i64 GetMaxCacheBytes() const;
+
+    void ClearCurrentRequest(int threadIdx, bool rendered);
+    bool GetNextRequest(PageRenderRequest* req, int threadIdx);
+    bool IsEngineBusy(EngineBase* engine) const;
     void Add(PageRenderRequest& req, RenderedBitmap* bmp);
 
     USHORT GetTileRes(DisplayModel* dm, int pageNo) const;
@@ -140,13 +192,16 @@ struct RenderCache {
     bool Render(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile = nullptr,
                 RectF* pageRect = nullptr, const OnBitmapRendered* renderCb = nullptr);
     void ClearQueueForDisplayModel(DisplayModel* dm, int pageNo = kInvalidPageNo, TilePosition* tile = nullptr);
-    void AbortCurrentRequest();
+    void AbortCurrentRequests(DisplayModel* dm = nullptr, int pageNo = kInvalidPageNo);
+    void AbortInvisibleRequests();
 
     static DWORD WINAPI RenderCacheThread(LPVOID data);
 
     BitmapCacheEntry* Find(DisplayModel* dm, int pageNo, int rotation, float zoom = kInvalidZoom,
                            TilePosition* tile = nullptr);
     bool DropCacheEntry(BitmapCacheEntry* entry);
+    void IndexAdd(BitmapCacheEntry* entry);
+    void IndexRemove(BitmapCacheEntry* entry);
     void FreePage(DisplayModel* dm = nullptr, int pageNo = -1, TilePosition* tile = nullptr);
     void FreeNotVisible();
 
@@ -4,6 +4,7 @@
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
+#include "utils/Timer.h"
 #include "utils/UITask.h"
 #include "utils/WinUtil.h"
 #include "utils/ThreadUtil.h"
@@ -41,6 +42,10 @@ StrVec gDdeOpenOnStartup;
 
 Kind kNotifFindProgress = "findProgress";
 
+// FindThread has the text of that many pages extracted in the background
+// while it searches the current page
+constexpr int kFindPagesToReadAhead = 8;
+
 // don't show the Search UI for document types that don't
 // support extracting text and/or navigating to a specific
 // text selection; default to showing it, since most users
@@ -188,6 +193,23 @@ static void ShowSearchResult(MainWindow* win, TextSel* result, bool addNavPt) {
     ScheduleRepaint(win, 0);
 }
 
+// "Found text at page %s", with the match number once all matches are known
+static TempStr GetFoundTextMsgTemp(MainWindow* win, bool loopedAround) {
+    DisplayModel* dm = win->AsFixed();
+    auto textSearch = dm->textSearch;
+    auto pageNo = textSearch->GetSearchHitStartPageNo();
+    TempStr label = win->ctrl->GetPageLabeTemp(pageNo);
+    TempStr msg = str::FormatTemp(_TRA("Found text at page %s"), label);
+    if (loopedAround) {
+        msg = str::FormatTemp(_TRA("Found text at page %s (again)"), label);
+    }
+    int hitNo, nHits;
+    if (dm->searchHits && dm->searchHits->GetHitNo(textSearch->startPage, textSearch->startGlyph, &hitNo, &nHits)) {
+        msg = str::FormatTemp("%s (%d / %d)", msg, hitNo, nHits);
+    }
+    return msg;
+}
+
 void ClearSearchResult(MainWindow* win) {
     DeleteOldSelectionInfo(win, true);
     ScheduleRepaint(win, 0);
@@ -274,14 +296,11 @@ struct FindThreadData {
         } else if (!success && loopedAround) {
             NotificationUpdateMessage(wnd, _TRA("No matches were found"), 0);
         } else {
-            auto pageNo = win->AsFixed()->textSearch->GetSearchHitStartPageNo();
-            TempStr label = win->ctrl->GetPageLabeTemp(pageNo);
-            TempStr buf = str::FormatTemp(_TRA("Found text at page %s"), label);
+            TempStr msg = GetFoundTextMsgTemp(win, loopedAround);
             if (loopedAround) {
-                buf = str::FormatTemp(_TRA("Found text at page %s (again)"), label);
                 MessageBeep(MB_ICONINFORMATION);
             }
-            NotificationUpdateMessage(wnd, buf, 0, loopedAround);
+            NotificationUpdateMessage(wnd, msg, 0, loopedAround);
         }
     }
 
@@ -318,6 +337,117 @@ struct FindEndTaskData {
     }
 };
 
+// once a new search has found its first match, all other matches are collected
+// in the background, so that FindNext/FindPrev can go to them right away
+// and the notification can show the number of matches
+struct FindAllThreadData {
+    MainWindow* win = nullptr;
+    DisplayModel* dm = nullptr;
+    TextSearchHits* hits = nullptr;
+};
+
+static void FindAllEndTask(FindAllThreadData* d) {
+    AutoDelete delData(d);
+    auto win = d->win;
+    if (!IsMainWindowValid(win) || win->AsFixed() != d->dm || d->dm->searchHits != d->hits || win->findThread) {
+        return;
+    }
+    auto wnd = GetNotificationForGroup(win->hwndCanvas, kNotifFindProgress);
+    auto textSearch = d->dm->textSearch;
+    if (wnd && textSearch->result.len > 0) {
+        NotificationUpdateMessage(wnd, GetFoundTextMsgTemp(win, false), 0);
+    }
+}
+
+static void FindAllUpdateProgress(TextSearchHits* hits, ProgressUpdateData* data) {
+    if (data->wasCancelled) {
+        *data->wasCancelled = hits->cancelled.Get();
+    }
+}
+
+static void FindAllThread(FindAllThreadData* d) {
+    DisplayModel* dm = d->dm;
+    // the DisplayModel waits for this thread before deleting textCache
+    TextSearch search(dm->GetEngine(), dm->textCache);
+    search.progressCb = MkFunc1<TextSearchHits, ProgressUpdateData*>(FindAllUpdateProgress, d->hits);
+    auto t = TimeGet();
+    if (search.FindAll(d->hits)) {
+        logf("FindAllThread: %d matches in %.2f ms\n", d->hits->Count(), TimeSinceInMs(t));
+        auto fn = MkFunc0<FindAllThreadData>(FindAllEndTask, d);
+        uitask::Post(fn, "TaskFindAllEnd");
+    } else {
+        delete d;
+    }
+    DestroyTempAllocator();
+}
+
+static void StartFindAll(MainWindow* win, const WCHAR* text) {
+    DisplayModel* dm = win->AsFixed();
+    bool caseSensitive = dm->textSearch->caseSensitive;
+    if (dm->searchHits && dm->searchHits->IsFor(text, caseSensitive)) {
+        return;
+    }
+    delete dm->searchHits;
+    auto hits = new TextSearchHits(text, caseSensitive);
+    dm->searchHits = hits;
+    auto d = new FindAllThreadData;
+    d->win = win;
+    d->dm = dm;
+    d->hits = hits;
+    auto fn = MkFunc0(FindAllThread, d);
+    hits->thread = StartThread(fn, "FindAllThread");
+}
+
+// with all matches known, there's no need to search for the next one
+static bool ShowNextSearchHit(MainWindow* win, TextSearch::Direction direction, const char* text, bool showProgress) {
+    DisplayModel* dm = win->AsFixed();
+    TextSearchHits* hits = dm ? dm->searchHits : nullptr;
+    if (!hits || !hits->IsComplete() || hits->Count() == 0) {
+        return false;
+    }
+    auto textSearch = dm->textSearch;
+    if (!hits->IsFor(ToWStrTemp(text), textSearch->caseSensitive) || textSearch->result.len == 0) {
+        return false;
+    }
+    // same condition as in FindThread for continuing from the last result
+    int pageNo = textSearch->startPage;
+    if (!win->ctrl->ValidPageNo(pageNo) || !dm->GetPageInfo(pageNo)->visibleRatio) {
+        return false;
+    }
+
+    bool forward = direction == TextSearch::Direction::Forward;
+    int idx = hits->FindHit(pageNo, textSearch->startGlyph, forward);
+    bool loopedAround = idx < 0;
+    if (loopedAround) {
+        idx = forward ? 0 : hits->Count() - 1;
+    }
+    TextSearchHit hit;
+    if (!hits->GetHit(idx, &hit)) {
+        return false;
+    }
+    textSearch->SetDirection(direction);
+    textSearch->SetCurrentHit(hit);
+    ShowSearchResult(win, &textSearch->result, false);
+
+    auto wnd = GetNotificationForGroup(win->hwndCanvas, kNotifFindProgress);
+    TempStr msg = GetFoundTextMsgTemp(win, loopedAround);
+    if (loopedAround) {
+        MessageBeep(MB_ICONINFORMATION);
+    }
+    if (wnd) {
+        NotificationUpdateMessage(wnd, msg, 0, loopedAround);
+    } else if (showProgress) {
+        NotificationCreateArgs args;
+        args.hwndParent = win->hwndCanvas;
+        args.msg = msg;
+        args.timeoutMs = 0;
+        args.onRemoved = MkFunc1Void(RemoveNotification);
+        args.groupId = kNotifFindProgress;
+        ShowNotification(args);
+    }
+    return true;
+}
+
 static void FindEndTask(FindEndTaskData* d) {
     auto win = d->win;
     auto ftd = d->ftd;
@@ -340,6 +470,9 @@ static void FindEndTask(FindEndTaskData* d) {
     } else if (textSel) {
         ShowSearchResult(win, textSel, wasModifiedCanceled);
         ftd->HideUI(true, loopedAround);
+        if (ftd->wasModified) {
+            StartFindAll(win, ftd->text);
+        }
     } else {
         // nothing found or search canceled
         ClearSearchResult(win);
@@ -373,6 +506,7 @@ static void FindThread(FindThreadData* ftd) {
 
     TextSel* rect;
     textSearch->progressCb = MkFunc1<FindThreadData, ProgressUpdateData*>(UpdateSearchProgress, ftd);
+    textSearch->pagesToReadAhead = kFindPagesToReadAhead;
     textSearch->SetDirection(ftd->direction);
     if (ftd->wasModified || !ctrl->ValidPageNo(textSearch->GetCurrentPageNo()) ||
         !dm->GetPageInfo(textSearch->GetCurrentPageNo())->visibleRatio) {
@@ -390,6 +524,11 @@ static void FindThread(FindThreadData* ftd) {
             rect = textSearch->FindFirst(startPage, ftd->text);
         }
     }
+    if (win->findCancelled) {
+        // don't keep extracting pages for a search that no longer happens
+        Vec<int> noPages;
+        dm->textCache->ExtractPagesAsync(noPages);
+    }
 
     // wait for FindTextOnThread to return so that
     // FindEndTask closes the correct handle to
@@ -446,6 +585,15 @@ void FindTextOnThread(MainWindow* win, TextSearch::Direction direction, const ch
     if (str::IsEmpty(text)) {
         return;
     }
+    if (!wasModified && ShowNextSearchHit(win, direction, text, showProgress)) {
+        return;
+    }
+    DisplayModel* dm = win->AsFixed();
+    if (wasModified && dm && dm->searchHits && !dm->searchHits->IsFor(ToWStrTemp(text), dm->textSearch->caseSensitive)) {
+        // stop collecting matches of the previous search
+        delete dm->searchHits;
+        dm->searchHits = nullptr;
+    }
     FindThreadData* ftd = new FindThreadData(win, direction, text, wasModified);
     ftd->ShowUI(showProgress);
     win->findThread = nullptr;
@@ -53,7 +53,7 @@ Rect SelectionOnPage::GetRect(DisplayModel* dm) const {
 Vec<SelectionOnPage>* SelectionOnPage::FromRectangle(DisplayModel* dm, Rect rect) {
     Vec<SelectionOnPage>* sel = new Vec<SelectionOnPage>();
 
-    for (int pageNo = dm->GetEngine()->PageCount(); pageNo >= 1; --pageNo) {
+    for (int pageNo = dm->PageCount(); pageNo >= 1; --pageNo) {
         PageInfo* pageInfo = dm->GetPageInfo(pageNo);
         ReportIf(!(!pageInfo || 0.0 == pageInfo->visibleRatio || pageInfo->shown));
         if (!pageInfo || !pageInfo->shown) {
@@ -318,10 +318,13 @@ void OnSelectAll(MainWindow* win, bool textOnly) {
         for (pageNo = 1; !dm->GetPageInfo(pageNo)->shown; pageNo++) {
             ;
         }
-        dm->textSelection->StartAt(pageNo, 0);
+        int firstPage = pageNo;
         for (pageNo = win->ctrl->PageCount(); !dm->GetPageInfo(pageNo)->shown; pageNo--) {
             ;
         }
+        // selecting needs the text of all pages
+        dm->textCache->ExtractPages(firstPage, pageNo);
+        dm->textSelection->StartAt(firstPage, 0);
         dm->textSelection->SelectUpTo(pageNo, -1);
         win->selectionRect = Rect::FromXY(INT_MIN / 2, INT_MIN / 2, INT_MAX, INT_MAX);
         UpdateTextSelection(win);
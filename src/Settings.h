@@ -68,6 +68,9 @@ struct FixedPageUI {
     bool invertColors;
     // if true, hides the scrollbars but retains ability to scroll
     bool hideScrollbars;
+    // how much of physical memory (in percent) can be used for caching
+    // rendered pages. valid values are between 1 and 50
+    int renderCacheMemoryPercent;
 };
 
 // customization options for eBookUI
@@ -531,10 +534,11 @@ static const FieldInfo gFixedPageUIFields[] = {
     {offsetof(FixedPageUI, gradientColors), SettingType::ColorArray, 0},
     {offsetof(FixedPageUI, invertColors), SettingType::Bool, false},
     {offsetof(FixedPageUI, hideScrollbars), SettingType::Bool, false},
+    {offsetof(FixedPageUI, renderCacheMemoryPercent), SettingType::Int, 10},
 };
-static const StructInfo gFixedPageUIInfo = {sizeof(FixedPageUI), 8, gFixedPageUIFields,
+static const StructInfo gFixedPageUIInfo = {sizeof(FixedPageUI), 9, gFixedPageUIFields,
                                             "TextColor\0BackgroundColor\0SelectionColor\0WindowMargin\0PageSpacing\0Gra"
-                                            "dientColors\0InvertColors\0HideScrollbars"};
+                                            "dientColors\0InvertColors\0HideScrollbars\0RenderCacheMemoryPercent"};
 
 static const FieldInfo gEBookUIFields[] = {
     {offsetof(EBookUI, fontSize), SettingType::Float, (intptr_t)"0"},
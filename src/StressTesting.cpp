@@ -2,13 +2,24 @@
    License: GPLv3 */
 
 #include "utils/BaseUtil.h"
+
+#include <psapi.h>
+
 #include "utils/DirIter.h"
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/HtmlParserLookup.h"
+#include "utils/StrSearch.h"
 #include "utils/Timer.h"
 #include "utils/WinUtil.h"
+#include "utils/GdiPlusUtil.h"
+#include "mui/Mui.h"
 #include "utils/StrQueue.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Archive.h"
+#include "utils/ZipUtil.h"
+
+#include <zlib.h>
 
 #include "wingui/UIModels.h"
 
@@ -22,14 +33,22 @@
 #include "DisplayModel.h"
 #include "RenderCache.h"
 #include "ProgressUpdateUI.h"
+#include "EbookBase.h"
+#include "PalmDbReader.h"
+#include "EbookDoc.h"
+#include "MobiDoc.h"
+#include "HtmlFormatter.h"
+#include "EbookFormatter.h"
 #include "TextSelection.h"
 #include "TextSearch.h"
+#include "TextSearchIndex.h"
 #include "Notifications.h"
 #include "SumatraPDF.h"
 #include "MainWindow.h"
 #include "WindowTab.h"
 #include "Flags.h"
 #include "SearchAndDDE.h"
+#include "PdfSync.h"
 #include "StressTesting.h"
 
 #include "utils/Log.h"
@@ -63,7 +82,99 @@ static bool IsFullRange(Vec<PageRange>& ranges) {
     return isFull;
 }
 
-static void BenchLoadRender(EngineBase* engine, int pagenum) {
+// with -bench-json <path> the results of -bench are also written as json,
+// so that scripts can compare them between builds
+struct BenchPageResult {
+    int pageNo = 0;
+    // -1 if the step failed
+    double loadMs = -1;
+    double renderMs = -1;
+    double textMs = -1;
+};
+
+struct BenchFileResult {
+    const char* path = nullptr;
+    Kind engineKind = nullptr;
+    bool loaded = false;
+    double loadMs = 0;
+    // -1 if the engine doesn't lay out pages
+    double layoutMs = -1;
+    int pageCount = 0;
+    double totalMs = 0;
+    // growth of the working set while the document was open
+    // (the peak is only reported for the whole run, as it never goes down)
+    i64 workingSetDelta = 0;
+    Vec<BenchPageResult> pages;
+};
+
+static str::Str* gBenchJson = nullptr;
+
+static u64 GetMemoryUsage(bool peak) {
+    PROCESS_MEMORY_COUNTERS pmc{};
+    pmc.cb = sizeof(pmc);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return 0;
+    }
+    return (u64)(peak ? pmc.PeakWorkingSetSize : pmc.WorkingSetSize);
+}
+
+static void AppendJsonStr(str::Str& s, const char* v) {
+    if (!v) {
+        s.Append("null");
+        return;
+    }
+    s.AppendChar('"');
+    for (const char* c = v; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            s.AppendChar('\\');
+            s.AppendChar(*c);
+        } else if ((u8)*c < 0x20) {
+            s.AppendFmt("\\u%04x", (int)(u8)*c);
+        } else {
+            s.AppendChar(*c);
+        }
+    }
+    s.AppendChar('"');
+}
+
+static void AppendBenchFileJson(str::Str& s, const BenchFileResult& r) {
+    if (s.LastChar() == '}') {
+        s.Append(",");
+    }
+    s.Append("\n  {\"path\": ");
+    AppendJsonStr(s, r.path);
+    s.Append(", \"engine\": ");
+    AppendJsonStr(s, r.engineKind);
+    s.AppendFmt(", \"loaded\": %s, \"loadMs\": %.2f", r.loaded ? "true" : "false", r.loadMs);
+    s.AppendFmt(", \"layoutMs\": %.2f, \"pageCount\": %d", r.layoutMs, r.pageCount);
+
+    double renderMs = 0;
+    int nRendered = 0;
+    s.Append(", \"pages\": [");
+    for (int i = 0; i < r.pages.Size(); i++) {
+        const BenchPageResult& p = r.pages[i];
+        s.AppendFmt("%s\n    {\"page\": %d, \"loadMs\": %.2f, \"renderMs\": %.2f, \"textMs\": %.2f}",
+                    i > 0 ? "," : "", p.pageNo, p.loadMs, p.renderMs, p.textMs);
+        if (p.renderMs >= 0) {
+            renderMs += p.renderMs;
+            nRendered++;
+        }
+    }
+    s.Append(r.pages.IsEmpty() ? "]" : "\n  ]");
+    double pagesPerSec = renderMs > 0 ? nRendered * 1000.0 / renderMs : 0;
+    s.AppendFmt(", \"renderedPagesPerSec\": %.2f, \"totalMs\": %.2f", pagesPerSec, r.totalMs);
+    s.AppendFmt(", \"workingSetDelta\": %lld}", r.workingSetDelta);
+}
+
+static void BenchLoadRender(EngineBase* engine, int pagenum, BenchFileResult* res) {
+    BenchPageResult pageRes;
+    pageRes.pageNo = pagenum;
+    defer {
+        if (res) {
+            res->pages.Append(pageRes);
+        }
+    };
+
     auto t = TimeGet();
     bool ok = engine->BenchLoadPage(pagenum);
 
@@ -73,6 +184,7 @@ static void BenchLoadRender(EngineBase* engine, int pagenum) {
     }
     double timeMs = TimeSinceInMs(t);
     logf("pageload   %3d: %.2f ms\n", pagenum, timeMs);
+    pageRes.loadMs = timeMs;
 
     t = TimeGet();
     RenderPageArgs args(pagenum, 1.0, 0);
@@ -85,6 +197,18 @@ static void BenchLoadRender(EngineBase* engine, int pagenum) {
     delete rendered;
     timeMs = TimeSinceInMs(t);
     logf("pagerender %3d: %.2f ms\n", pagenum, timeMs);
+    pageRes.renderMs = timeMs;
+
+    // text extraction is only measured for -bench-json
+    if (!res) {
+        return;
+    }
+    t = TimeGet();
+    PageText pageText = engine->ExtractPageText(pagenum);
+    if (pageText.text) {
+        pageRes.textMs = TimeSinceInMs(t);
+    }
+    FreePageText(&pageText);
 }
 
 static void BenchChmLoadOnly(const char* filePath) {
@@ -106,6 +230,498 @@ static void BenchChmLoadOnly(const char* filePath) {
     logf("Finished (in %.2f ms): %s\n", TimeSinceInMs(total), filePath);
 }
 
+// tiles are rendered at 2x zoom, 4x4 tiles per page, for at most kBenchTilesMaxPages
+constexpr int kBenchTilesMaxPages = 16;
+constexpr int kBenchTilesPerSide = 4;
+constexpr float kBenchTilesZoom = 2.f;
+
+struct BenchTile {
+    int pageNo = 0;
+    RectF rect;
+};
+
+struct BenchTilesData {
+    EngineBase* engine = nullptr;
+    Vec<BenchTile> tiles;
+    AtomicInt nextTile;
+    AtomicInt nFailed;
+};
+
+static void BenchTilesThread(BenchTilesData* d) {
+    int n = d->tiles.Size();
+    while (true) {
+        int idx = d->nextTile.Inc() - 1;
+        if (idx >= n) {
+            return;
+        }
+        BenchTile& tile = d->tiles[idx];
+        RenderPageArgs args(tile.pageNo, kBenchTilesZoom, 0, &tile.rect);
+        RenderedBitmap* bmp = d->engine->RenderPage(args);
+        if (!bmp) {
+            d->nFailed.Inc();
+        }
+        delete bmp;
+    }
+}
+
+static double BenchTilesWithThreads(BenchTilesData* d, int nThreads) {
+    d->nextTile.Set(0);
+    d->nFailed.Set(0);
+    Vec<HANDLE> threads;
+    auto t = TimeGet();
+    for (int i = 0; i < nThreads; i++) {
+        auto fn = MkFunc0<BenchTilesData>(BenchTilesThread, d);
+        HANDLE h = StartThread(fn, "BenchTilesThread");
+        if (h) {
+            threads.Append(h);
+        }
+    }
+    for (HANDLE h : threads) {
+        WaitForSingleObject(h, INFINITE);
+        CloseHandle(h);
+    }
+    return TimeSinceInMs(t);
+}
+
+// measures how rendering scales with number of threads
+static void BenchTiles(EngineBase* engine) {
+    BenchTilesData d;
+    d.engine = engine;
+    int nPages = std::min(engine->PageCount(), kBenchTilesMaxPages);
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        // warm up: loads the page and caches the content so that we only measure rasterization
+        RenderPageArgs args(pageNo, 0.1f, 0);
+        delete engine->RenderPage(args);
+
+        RectF mb = engine->PageMediabox(pageNo);
+        float dx = mb.dx / kBenchTilesPerSide;
+        float dy = mb.dy / kBenchTilesPerSide;
+        for (int y = 0; y < kBenchTilesPerSide; y++) {
+            for (int x = 0; x < kBenchTilesPerSide; x++) {
+                BenchTile tile;
+                tile.pageNo = pageNo;
+                tile.rect = RectF(mb.x + x * dx, mb.y + y * dy, dx, dy);
+                d.tiles.Append(tile);
+            }
+        }
+    }
+    int nTiles = d.tiles.Size();
+    if (nTiles == 0) {
+        return;
+    }
+
+    int nCpus = GetLogicalCpuCount();
+    Vec<int> threadCounts;
+    for (int n : {1, 2, 4}) {
+        if (n == 1 || n <= nCpus) {
+            threadCounts.Append(n);
+        }
+    }
+    if (nCpus > 4) {
+        threadCounts.Append(nCpus);
+    }
+    for (int nThreads : threadCounts) {
+        double timeMs = BenchTilesWithThreads(&d, nThreads);
+        double tilesPerSec = timeMs > 0 ? (double)nTiles * 1000.0 / timeMs : 0;
+        logf("tiles %2d threads: %d tiles in %.2f ms, %.2f tiles/sec, %d failed\n", nThreads, nTiles, timeMs,
+             tilesPerSec, d.nFailed.Get());
+    }
+}
+
+// words to search for are picked from the text of at most that many pages
+constexpr int kBenchSearchMaxWords = 8;
+constexpr int kBenchSearchMaxMatches = 10000;
+
+// finds all matches of s, like repeatedly pressing F3
+static void BenchSearchWord(EngineBase* engine, DocumentTextCache* textCache, const char* s) {
+    int nPages = engine->PageCount();
+    auto t = TimeGet();
+    Vec<bool> pagesToSkip;
+    for (int i = 0; i < nPages; i++) {
+        pagesToSkip.Append(false);
+    }
+    int nCandidates = textCache->SkipPagesWithout(ToWStrTemp(s), pagesToSkip);
+    double indexMs = TimeSinceInMs(t);
+
+    TextSearch search(engine, textCache);
+    t = TimeGet();
+    double firstMs = 0;
+    int nMatches = 0;
+    TextSel* sel = search.FindFirst(1, ToWStrTemp(s));
+    while (sel && nMatches < kBenchSearchMaxMatches) {
+        if (nMatches == 0) {
+            firstMs = TimeSinceInMs(t);
+        }
+        nMatches++;
+        sel = search.FindNext();
+    }
+    double allMs = TimeSinceInMs(t);
+    logf("search '%s': index lookup in %.2f ms, %d of %d pages to search\n", s, indexMs, nCandidates, nPages);
+    logf("search '%s': %d matches, first in %.2f ms, all in %.2f ms\n", s, nMatches, firstMs, allMs);
+}
+
+// throughput of the search kernels over the lower-cased text of the whole document
+static void BenchSearchKernels(EngineBase* engine, DocumentTextCache* textCache) {
+    Vec<WCHAR> text;
+    for (int pageNo = 1; pageNo <= engine->PageCount(); pageNo++) {
+        int pageLen = 0;
+        const WCHAR* s = textCache->GetTextForPage(pageNo, &pageLen);
+        text.Append(s, (size_t)pageLen);
+        text.Append('\n');
+    }
+    int len = text.Size();
+    if (len == 0) {
+        return;
+    }
+    str::FoldCaseInPlace(text.LendData(), len);
+    const WCHAR* toFind = L"qxzjvkw";
+    int toFindLen = str::Leni(toFind);
+    str::FindImpl impls[] = {str::FindImpl::Scalar, str::FindImpl::Best};
+    const char* names[] = {"scalar", "best"};
+    for (int i = 0; i < (int)dimof(impls); i++) {
+        str::FindOptions opts;
+        opts.impl = impls[i];
+        auto t = TimeGet();
+        str::FindInWStr(text.LendData(), len, 0, toFind, toFindLen, &opts);
+        double ms = TimeSinceInMs(t);
+        double gb = (double)len * sizeof(WCHAR) / (1024.0 * 1024.0 * 1024.0);
+        logf("search kernel (%s): %d chars in %.2f ms, %.2f GB/s\n", names[i], len, ms, ms > 0 ? gb * 1000.0 / ms : 0);
+    }
+}
+
+// measures building the text search index and searching with it
+static void BenchSearch(EngineBase* engine) {
+    int nPages = engine->PageCount();
+    StrVec words;
+    {
+        DocumentTextCache textCache(engine);
+        auto t = TimeGet();
+        bool saved = textCache.RebuildIndex();
+        logf("search index: built in %.2f ms%s\n", TimeSinceInMs(t), saved ? "" : " (not saved)");
+        logf("text cache: %d pages in %d KB\n", textCache.nPagesWithText, textCache.debugSize / 1024);
+        BenchSearchKernels(engine, &textCache);
+
+        // pick the longest word from pages evenly spread over the document
+        int nWords = std::min(nPages, kBenchSearchMaxWords);
+        for (int i = 0; i < nWords; i++) {
+            int pageNo = 1 + (int)((i * (i64)nPages) / nWords);
+            const WCHAR* text = textCache.GetTextForPage(pageNo);
+            const WCHAR* best = nullptr;
+            int bestLen = 0;
+            for (const WCHAR* s = text; *s;) {
+                const WCHAR* end = s;
+                while (isWordChar(*end)) {
+                    end++;
+                }
+                if (end - s > bestLen) {
+                    best = s;
+                    bestLen = (int)(end - s);
+                }
+                s = *end ? end + 1 : end;
+            }
+            if (bestLen >= 3) {
+                words.Append(ToUtf8Temp(str::DupTemp(best, bestLen)));
+            }
+        }
+    }
+    // a word that most likely isn't in the document
+    words.Append("qxzjvkw");
+
+    // searches on a fresh cache so that text has to be extracted
+    // for the pages the index doesn't rule out
+    for (char* word : words) {
+        DocumentTextCache textCache(engine);
+        BenchSearchWord(engine, &textCache, word);
+    }
+}
+
+constexpr int kBenchPdfSyncRecordsPerPage = 500;
+constexpr int kBenchPdfSyncSearches = 10000;
+
+// forward and inverse search with a generated .pdfsync file that has
+// kBenchPdfSyncRecordsPerPage records on every page of the document.
+// the second half of the pages comes from an included file
+static void BenchPdfSync(EngineBase* engine) {
+    int nPages = engine->PageCount();
+    if (nPages < 1) {
+        return;
+    }
+    TempStr tmpPath = GetTempFilePathTemp("SumPdfSync");
+    if (!tmpPath) {
+        return;
+    }
+    file::Delete(tmpPath);
+    // Synchronizer::Create() looks for <name>.pdfsync next to the document
+    TempStr syncPath = str::JoinTemp(path::GetPathNoExtTemp(tmpPath), ".pdfsync");
+
+    int nLinesMain = 0;
+    int nLinesIncluded = 0;
+    str::Str s;
+    s.Append("bench\nversion 1\n");
+    int record = 1;
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        RectF mbox = engine->PageMediabox(pageNo);
+        bool isIncluded = pageNo > nPages / 2;
+        if (pageNo == nPages / 2 + 1) {
+            s.Append("(chapter\n");
+        }
+        s.AppendFmt("s %d\n", pageNo);
+        for (int i = 0; i < kBenchPdfSyncRecordsPerPage; i++) {
+            int lineNo = isIncluded ? ++nLinesIncluded : ++nLinesMain;
+            // a grid of 20 points per row
+            double x = 36 + (i % 20) * (mbox.dx - 72) / 20;
+            double y = 36 + (i / 20) * (mbox.dy - 72) / (kBenchPdfSyncRecordsPerPage / 20);
+            s.AppendFmt("l %d %d\n", record, lineNo);
+            s.AppendFmt("p %d %d %d\n", record, (int)(x * 65781.76), (int)(y * 65781.76));
+            record++;
+        }
+    }
+    s.Append(")\n");
+    if (!file::WriteFile(syncPath, s.AsByteSlice())) {
+        logf("pdfsync: failed to write '%s'\n", syncPath);
+        return;
+    }
+    defer {
+        file::Delete(syncPath);
+    };
+
+    Synchronizer* sync = nullptr;
+    Synchronizer::Create(tmpPath, engine, &sync);
+    if (!sync) {
+        return;
+    }
+    defer {
+        delete sync;
+    };
+
+    // the first search parses the file and builds the index
+    AutoFreeStr srcPath;
+    int line, col;
+    auto t = TimeGet();
+    sync->DocToSource(1, Point(72, 72), srcPath, &line, &col);
+    logf("pdfsync: %d records, %d KB, index built in %.2f ms\n", record - 1, (int)(s.size() / 1024), TimeSinceInMs(t));
+
+    // deterministic pseudo-random positions
+    u32 rnd = 1;
+    auto next = [&rnd](int max) -> int {
+        rnd = rnd * 1103515245 + 12345;
+        return (int)((rnd >> 8) % (u32)max);
+    };
+
+    int nFound = 0;
+    t = TimeGet();
+    for (int i = 0; i < kBenchPdfSyncSearches; i++) {
+        int pageNo = 1 + next(nPages);
+        Rect mbox = engine->PageMediabox(pageNo).Round();
+        Point pt(next(std::max(mbox.dx, 1)), next(std::max(mbox.dy, 1)));
+        if (sync->DocToSource(pageNo, pt, srcPath, &line, &col) == PDFSYNCERR_SUCCESS) {
+            nFound++;
+        }
+    }
+    double ms = TimeSinceInMs(t);
+    logf("pdfsync: %d inverse searches (%d found) in %.2f ms, %.2f us per search\n", kBenchPdfSyncSearches, nFound, ms,
+         ms * 1000.0 / kBenchPdfSyncSearches);
+
+    nFound = 0;
+    Vec<Rect> rects;
+    t = TimeGet();
+    for (int i = 0; i < kBenchPdfSyncSearches; i++) {
+        bool isIncluded = nLinesMain == 0 || (i % 2) == 1;
+        const char* srcFile = isIncluded ? "chapter.tex" : "bench.tex";
+        int lineNo = 1 + next(isIncluded ? nLinesIncluded : nLinesMain);
+        int pageNo = 0;
+        if (sync->SourceToDoc(srcFile, lineNo, 0, &pageNo, rects) == PDFSYNCERR_SUCCESS) {
+            nFound++;
+        }
+    }
+    ms = TimeSinceInMs(t);
+    logf("pdfsync: %d forward searches (%d found) in %.2f ms, %.2f us per search\n", kBenchPdfSyncSearches, nFound, ms,
+         ms * 1000.0 / kBenchPdfSyncSearches);
+}
+
+static const u8* FindBytes(const u8* s, const u8* end, const char* toFind) {
+    size_t n = str::Len(toFind);
+    while (s + n <= end) {
+        s = (const u8*)memchr(s, toFind[0], end - s - n + 1);
+        if (!s) {
+            return nullptr;
+        }
+        if (memcmp(s, toFind, n) == 0) {
+            return s;
+        }
+        s++;
+    }
+    return nullptr;
+}
+
+// throughput of zlib's inflate (zlib-ng when built with --with-zlib-ng) over
+// FlateDecode streams in a PDF or the files in a .cbz / .zip archive
+static void BenchInflate(const char* path, Kind kind) {
+    int nStreams = 0;
+    i64 nCompressed = 0;
+    i64 nUncompressed = 0;
+    double totalMs = 0;
+
+    if (kind == kindFilePDF) {
+        ByteSlice d = file::ReadFile(path);
+        defer {
+            d.Free();
+        };
+        // we don't parse the PDF, we inflate everything between stream and
+        // endstream. Streams that are not FlateDecode fail the zlib header check
+        const u8* end = d.data() + d.size();
+        const u8* s = d.data();
+        while ((s = FindBytes(s, end, "stream")) != nullptr) {
+            s += 6;
+            if (s - 9 >= d.data() && memcmp(s - 9, "end", 3) == 0) {
+                continue;
+            }
+            if (s < end && *s == '\r') {
+                s++;
+            }
+            if (s < end && *s == '\n') {
+                s++;
+            }
+            const u8* streamEnd = FindBytes(s, end, "endstream");
+            if (!streamEnd) {
+                break;
+            }
+            ByteSlice compressed((u8*)s, streamEnd - s);
+            auto t = TimeGet();
+            ByteSlice uncompressed = Ungzip(compressed);
+            double ms = TimeSinceInMs(t);
+            if (!uncompressed.empty()) {
+                nStreams++;
+                nCompressed += compressed.size();
+                nUncompressed += uncompressed.size();
+                totalMs += ms;
+            }
+            uncompressed.Free();
+            s = streamEnd + 9;
+        }
+    } else if (kind == kindFileCbz || kind == kindFileZip) {
+        MultiFormatArchive* archive = OpenZipArchive(path, false);
+        if (!archive) {
+            logf("Error: failed to open %s\n", path);
+            return;
+        }
+        auto t = TimeGet();
+        for (auto* fi : archive->GetFileInfos()) {
+            ByteSlice data = archive->GetFileDataById(fi->fileId);
+            if (!data.empty()) {
+                nStreams++;
+                nUncompressed += data.size();
+            }
+            data.Free();
+        }
+        totalMs = TimeSinceInMs(t);
+        nCompressed = file::GetSize(path);
+        delete archive;
+    } else {
+        logf("inflate: only PDF and .cbz / .zip files are supported\n");
+        return;
+    }
+
+    double mb = (double)nUncompressed / (1024.0 * 1024.0);
+    logf("inflate (zlib %s): %d streams, %lld => %lld bytes in %.2f ms, %.2f MB/s\n", ZLIB_VERSION, nStreams,
+         nCompressed, nUncompressed, totalMs, totalMs > 0 ? mb * 1000.0 / totalMs : 0);
+}
+
+// reads the file as if it was on a 100 MBit/s network share and measures
+// how long it takes until the first page is rendered and until all pages
+// are loaded, first with a full load and then with progressive loading
+static void BenchFirstPage(const char* path) {
+    constexpr int kThrottleKBps = 12 * 1024;
+    constexpr int kThrottleLatencyMs = 2;
+    SetMupdfReadThrottle(kThrottleKBps, kThrottleLatencyMs);
+    // progressive loading is enabled by default, so leave it that way
+    bool modes[] = {false, true};
+    for (bool progressive : modes) {
+        SetMupdfProgressiveLoading(progressive);
+        auto t = TimeGet();
+        EngineBase* engine = CreateEngineFromFile(path, nullptr, true);
+        if (!engine) {
+            logf("Error: failed to load %s\n", path);
+            break;
+        }
+        double loadMs = TimeSinceInMs(t);
+        RenderPageArgs args(1, 1.0, 0);
+        RenderedBitmap* bmp = engine->RenderPage(args);
+        double firstPageMs = TimeSinceInMs(t);
+        delete bmp;
+        bool wasProgressive = engine->FinishLayout();
+        double allPagesMs = TimeSinceInMs(t);
+        const char* mode = progressive ? (wasProgressive ? "progressive" : "not progressive") : "full";
+        logf("firstpage (%s, %d KB/s, %d ms latency): load: %.2f ms, first page: %.2f ms, all pages: %.2f ms\n",
+             mode, kThrottleKBps, kThrottleLatencyMs, loadMs, firstPageMs, allPagesMs);
+        SafeEngineRelease(&engine);
+    }
+    SetMupdfReadThrottle(0, 0);
+}
+
+// lays out an ebook with the text measuring methods used by ebook engines
+// and compares how long it takes and how many pages each produces
+static void BenchLayout(const char* path, Kind kind) {
+    EpubDoc* epubDoc = nullptr;
+    Fb2Doc* fb2Doc = nullptr;
+    MobiDoc* mobiDoc = nullptr;
+    ByteSlice html;
+    if (EpubDoc::IsSupportedFileType(kind)) {
+        epubDoc = EpubDoc::CreateFromFile(path);
+        html = epubDoc ? epubDoc->GetHtmlData() : ByteSlice();
+    } else if (Fb2Doc::IsSupportedFileType(kind)) {
+        fb2Doc = Fb2Doc::CreateFromFile(path);
+        html = fb2Doc ? fb2Doc->GetXmlData() : ByteSlice();
+    } else if (MobiDoc::IsSupportedFileType(kind)) {
+        mobiDoc = MobiDoc::CreateFromFile(path);
+        html = mobiDoc ? mobiDoc->GetHtmlData() : ByteSlice();
+    } else {
+        logf("layout: only EPUB, FB2 and MOBI files are supported\n");
+        return;
+    }
+    if (html.empty()) {
+        logf("Error: failed to load %s\n", path);
+        delete epubDoc;
+        delete fb2Doc;
+        delete mobiDoc;
+        return;
+    }
+
+    struct {
+        mui::TextRenderMethod method;
+        const char* name;
+    } methods[] = {
+        {mui::TextRenderMethod::GdiplusQuick, "gdi+ quick"},
+        {mui::TextRenderMethod::Gdi, "gdi"},
+        {mui::TextRenderMethod::FreeType, "freetype"},
+    };
+    for (auto& m : methods) {
+        PoolAllocator textAllocator;
+        HtmlFormatterArgs* args = CreateFormatterDefaultArgs(820, 920, &textAllocator);
+        args->htmlStr = html;
+        args->textRenderMethod = m.method;
+        HtmlFormatter* formatter = nullptr;
+        if (epubDoc) {
+            formatter = new EpubFormatter(args, epubDoc);
+        } else if (fb2Doc) {
+            formatter = new Fb2Formatter(args, fb2Doc);
+        } else {
+            formatter = new MobiFormatter(args, mobiDoc);
+        }
+        auto t = TimeGet();
+        Vec<HtmlPage*>* pages = formatter->FormatAllPages();
+        double layoutMs = TimeSinceInMs(t);
+        logf("layout (%s): %d pages in %.2f ms\n", m.name, pages->Size(), layoutMs);
+        DeleteVecMembers(*pages);
+        delete pages;
+        delete formatter;
+        delete args;
+    }
+    delete epubDoc;
+    delete fb2Doc;
+    delete mobiDoc;
+}
+
 static void BenchFile(const char* path, const char* pagesSpec) {
     if (!file::Exists(path)) {
         return;
@@ -125,9 +741,38 @@ static void BenchFile(const char* path, const char* pagesSpec) {
         return;
     }
 
+    if (str::EqI(pagesSpec, "inflate")) {
+        logf("Starting: %s\n", path);
+        BenchInflate(path, kind);
+        return;
+    }
+
+    if (str::EqI(pagesSpec, "firstpage")) {
+        logf("Starting: %s\n", path);
+        BenchFirstPage(path);
+        return;
+    }
+
+    if (str::EqI(pagesSpec, "layout")) {
+        logf("Starting: %s\n", path);
+        BenchLayout(path, kind);
+        return;
+    }
+
     auto total = TimeGet();
     logf("Starting: %s\n", path);
 
+    BenchFileResult res;
+    res.path = path;
+    BenchFileResult* resOut = gBenchJson ? &res : nullptr;
+    defer {
+        if (gBenchJson) {
+            res.totalMs = TimeSinceInMs(total);
+            AppendBenchFileJson(*gBenchJson, res);
+        }
+    };
+
+    u64 workingSetStart = GetMemoryUsage(false);
     auto t = TimeGet();
     EngineBase* engine = CreateEngineFromFile(path, nullptr, true);
     if (!engine) {
@@ -137,13 +782,31 @@ static void BenchFile(const char* path, const char* pagesSpec) {
 
     double timeMs = TimeSinceInMs(t);
     logf("load: %.2f ms\n", timeMs);
+    res.loaded = true;
+    res.engineKind = engine->kind;
+    res.loadMs = timeMs;
+    t = TimeGet();
+    if (engine->FinishLayout()) {
+        res.layoutMs = TimeSinceInMs(t);
+        logf("layout: %.2f ms\n", res.layoutMs);
+    }
     int pages = engine->PageCount();
     logf("page count: %d\n", pages);
+    res.pageCount = pages;
 
     if (!pagesSpec) {
         for (int i = 1; i <= pages; i++) {
-            BenchLoadRender(engine, i);
+            BenchLoadRender(engine, i, resOut);
         }
+    } else if (str::EqI(pagesSpec, "tiles")) {
+        BenchTiles(engine);
+        pagesSpec = nullptr;
+    } else if (str::EqI(pagesSpec, "search")) {
+        BenchSearch(engine);
+        pagesSpec = nullptr;
+    } else if (str::EqI(pagesSpec, "pdfsync")) {
+        BenchPdfSync(engine);
+        pagesSpec = nullptr;
     }
 
     ReportIf(pagesSpec && !IsBenchPagesInfo(pagesSpec));
@@ -152,12 +815,13 @@ static void BenchFile(const char* path, const char* pagesSpec) {
         for (size_t i = 0; i < ranges.size(); i++) {
             for (int j = ranges.at(i).start; j <= ranges.at(i).end; j++) {
                 if (1 <= j && j <= pages) {
-                    BenchLoadRender(engine, j);
+                    BenchLoadRender(engine, j, resOut);
                 }
             }
         }
     }
 
+    res.workingSetDelta = (i64)GetMemoryUsage(false) - (i64)workingSetStart;
     SafeEngineRelease(&engine);
 
     logf("Finished (in %.2f ms): %s\n", TimeSinceInMs(total), path);
@@ -185,25 +849,42 @@ static void CollectFilesToBench(char* dir, StrVec& files) {
     }
 }
 
-static void BenchDir(char* dir) {
+static void BenchDir(char* dir, const char* pagesSpec) {
     StrVec files;
     CollectFilesToBench(dir, files);
     for (int i = 0; i < files.Size(); i++) {
-        BenchFile(files.At(i), nullptr);
+        BenchFile(files.At(i), pagesSpec);
     }
 }
 
-void BenchFileOrDir(StrVec& pathsToBench) {
+void BenchFileOrDir(StrVec& pathsToBench, const char* jsonPath) {
+    str::Str json;
+    if (jsonPath) {
+        json.Append("{\"files\": [");
+        gBenchJson = &json;
+    }
+    defer {
+        gBenchJson = nullptr;
+    };
+
     int n = pathsToBench.Size() / 2;
     for (int i = 0; i < n; i++) {
         char* path = pathsToBench.At(2 * i);
         if (file::Exists(path)) {
             BenchFile(path, pathsToBench.At(2 * i + 1));
         } else if (dir::Exists(path)) {
-            BenchDir(path);
+            BenchDir(path, pathsToBench.At(2 * i + 1));
         } else {
             logf("Error: file or dir %s doesn't exist", path);
         }
+    }
+    if (!jsonPath) {
+        return;
+    }
+    json.Append(json.LastChar() == '}' ? "\n]" : "]");
+    json.AppendFmt(", \"peakMemory\": %llu}\n", GetMemoryUsage(true));
+    if (!file::WriteFile(jsonPath, json.AsByteSlice())) {
+        logf("Error: failed to write %s\n", jsonPath);
     }
 }
 
@@ -480,8 +1161,22 @@ static void Start(StressTest* st, TestFileProvider* fileProvider, int cycles) {
     TickTimer(st);
 }
 
+static void LogRenderCacheStats() {
+    RenderCacheStats stats;
+    gRenderCache->GetStats(&stats);
+    float mbUsed = (float)stats.cacheBytes / (1024.f * 1024.f);
+    float mbMax = (float)stats.maxCacheBytes / (1024.f * 1024.f);
+    logf("render cache: hits: %d, misses: %d, evictions: %d, bitmaps: %d, used: %.2f MB of %.2f MB\n",
+         (int)stats.hits, (int)stats.misses, (int)stats.evictions, stats.nBitmaps, mbUsed, mbMax);
+    float avgLatencyMs = stats.nRendered > 0 ? (float)stats.totalLatencyMs / (float)stats.nRendered : 0.f;
+    logf("render queue: threads: %d, max depth: %d, rendered: %d, cancelled: %d, latency avg: %.2f ms, max: %d ms\n",
+         stats.nRenderThreads, stats.maxQueueDepth, (int)stats.nRendered, (int)stats.nCancelled, avgLatencyMs,
+         stats.maxLatencyMs);
+}
+
 static void Finished(StressTest* st, bool success) {
     st->win->stressTest = nullptr; // make sure we're not double-deleted
+    LogRenderCacheStats();
 
     if (success) {
         int secs = SecsSinceSystemTime(st->stressStartTime);
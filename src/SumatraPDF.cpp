@@ -134,6 +134,8 @@ static StrVec gAllowedFileTypes;
 static void CloseDocumentInCurrentTab(MainWindow*, bool keepUIEnabled, bool deleteModel);
 static void OnSidebarSplitterMove(Splitter::MoveEvent*);
 static void OnFavSplitterMove(Splitter::MoveEvent*);
+static void NotifyWhenDocLaidOut(WindowTab*, EngineBase*);
+static void ShowFinishedDocLayout(MainWindow*, WindowTab*);
 
 EBookUI* GetEBookUI() {
     return &gGlobalPrefs->eBookUI;
@@ -1300,6 +1302,10 @@ static void ReplaceDocumentInCurrentTab(LoadArgs* args, DocController* ctrl, Fil
         return;
     }
 
+    if (win->AsFixed()) {
+        NotifyWhenDocLaidOut(tab, win->AsFixed()->GetEngine());
+    }
+
     TempStr unsupported = win->ctrl->GetPropertyTemp(kPropUnsupportedFeatures);
     if (unsupported) {
         const char* s = _TRA("This document uses unsupported features (%s) and might not render properly");
@@ -1322,6 +1328,99 @@ static void ReplaceDocumentInCurrentTab(LoadArgs* args, DocController* ctrl, Fil
     }
 }
 
+// remembers the state of the current tab's view, so that
+// it can be restored after replacing its DocController
+static FileState* NewDisplayStateForReload(MainWindow* win) {
+    WindowTab* tab = win->CurrentTab();
+    FileState* fs = NewDisplayState(tab->filePath);
+    tab->ctrl->GetDisplayState(fs);
+    UpdateDisplayStateWindowRect(win, fs);
+    UpdateSidebarDisplayState(tab, fs);
+    // Set the windows state based on the actual window's placement
+    int wstate = WIN_STATE_NORMAL;
+    if (win->isFullScreen) {
+        wstate = WIN_STATE_FULLSCREEN;
+    } else {
+        if (IsZoomed(win->hwndFrame)) {
+            wstate = WIN_STATE_MAXIMIZED;
+        } else if (IsIconic(win->hwndFrame)) {
+            wstate = WIN_STATE_MINIMIZED;
+        }
+    }
+    fs->windowState = wstate;
+    fs->useDefaultState = false;
+    return fs;
+}
+
+struct DocLayoutData {
+    WindowTab* tab = nullptr;
+    EngineBase* engine = nullptr;
+};
+
+// an ebook is shown before all of its pages have been laid out (with an estimated
+// page count) and a linearized PDF before the sizes of all of its pages are known.
+// Once layout is done, re-create its DisplayModel with the final page count and
+// sizes and ToC, keeping the rendered pages and the scroll position
+static void ShowFinishedDocLayout(MainWindow* win, WindowTab* tab) {
+    EngineBase* engine = tab->AsFixed()->GetEngine();
+    logf("ShowFinishedDocLayout: '%s'\n", tab->filePath);
+    FileState* fs = NewDisplayStateForReload(win);
+    if (!tab->ctrl->HasToc()) {
+        // the ToC might not have been loaded yet, so decide
+        // again whether to show it, as when loading the document
+        FileState* prevFs = gFileHistory.FindByPath(tab->filePath);
+        bool usePrev = prevFs && gGlobalPrefs->rememberStatePerDocument && !prevFs->useDefaultState;
+        fs->showToc = usePrev ? prevFs->showToc : showTocByDefault(tab->filePath);
+    }
+    // the old DisplayModel is only deleted (and not used) after this
+    engine->FinishLayout();
+    engine->AddRef();
+    DocController* ctrl = CreateControllerForEngineOrFile(engine, tab->filePath, nullptr, win);
+    LoadArgs args(tab->filePath, win);
+    args.showWin = true;
+    args.placeWindow = false;
+    ReplaceDocumentInCurrentTab(&args, ctrl, fs);
+    DeleteDisplayState(fs);
+}
+
+static void DocLayoutFinished(DocLayoutData* d) {
+    defer {
+        SafeEngineRelease(&d->engine);
+        delete d;
+    };
+    WindowTab* tab = d->tab;
+    // tab might have been closed or the document reloaded in the meantime
+    MainWindow* win = FindMainWindowByTab(tab);
+    if (!win || !tab->AsFixed() || tab->AsFixed()->GetEngine() != d->engine) {
+        return;
+    }
+    if (tab != win->CurrentTab() || tab->editAnnotsWindow) {
+        // ReplaceDocumentInCurrentTab only works for the current tab. Keep
+        // the laid out engine and only re-create the DisplayModel once the
+        // tab is selected (instead of loading the document again)
+        tab->layoutFinishedOnFocus = true;
+        return;
+    }
+    ShowFinishedDocLayout(win, tab);
+}
+
+static void PostDocLayoutFinished(DocLayoutData* d) {
+    auto fn = MkFunc0<DocLayoutData>(DocLayoutFinished, d);
+    uitask::Post(fn, "DocLayoutFinished");
+}
+
+static void NotifyWhenDocLaidOut(WindowTab* tab, EngineBase* engine) {
+    auto d = new DocLayoutData;
+    d->tab = tab;
+    d->engine = engine;
+    engine->AddRef();
+    auto fn = MkFunc0<DocLayoutData>(PostDocLayoutFinished, d);
+    if (!engine->NotifyWhenLaidOut(fn)) {
+        SafeEngineRelease(&d->engine);
+        delete d;
+    }
+}
+
 void ReloadDocument(MainWindow* win, bool autoRefresh) {
     WindowTab* tab = win->CurrentTab();
 
@@ -1369,23 +1468,7 @@ void ReloadDocument(MainWindow* win, bool autoRefresh) {
         return;
     }
 
-    FileState* fs = NewDisplayState(path);
-    tab->ctrl->GetDisplayState(fs);
-    UpdateDisplayStateWindowRect(win, fs);
-    UpdateSidebarDisplayState(tab, fs);
-    // Set the windows state based on the actual window's placement
-    int wstate = WIN_STATE_NORMAL;
-    if (win->isFullScreen) {
-        wstate = WIN_STATE_FULLSCREEN;
-    } else {
-        if (IsZoomed(win->hwndFrame)) {
-            wstate = WIN_STATE_MAXIMIZED;
-        } else if (IsIconic(win->hwndFrame)) {
-            wstate = WIN_STATE_MINIMIZED;
-        }
-    }
-    fs->windowState = wstate;
-    fs->useDefaultState = false;
+    FileState* fs = NewDisplayStateForReload(win);
 
     LoadArgs args(tab->filePath, win);
     args.showWin = true;
@@ -1398,6 +1481,8 @@ void ReloadDocument(MainWindow* win, bool autoRefresh) {
     }
 
     tab->reloadOnFocus = false;
+    // the reloaded document notifies about its own layout
+    tab->layoutFinishedOnFocus = false;
 
     if (gGlobalPrefs->showStartPage) {
         // refresh the thumbnail for this file
@@ -2121,6 +2206,9 @@ void LoadModelIntoTab(WindowTab* tab) {
             if (tab->reloadOnFocus) {
                 tab->reloadOnFocus = false;
                 ReloadDocument(win, true);
+            } else if (tab->layoutFinishedOnFocus && !tab->editAnnotsWindow && win->AsFixed()) {
+                tab->layoutFinishedOnFocus = false;
+                ShowFinishedDocLayout(win, tab);
             }
         }
     }
@@ -5750,6 +5838,10 @@ static LRESULT FrameOnCommand(MainWindow* win, HWND hwnd, UINT msg, WPARAM wp, L
             TogglePredictiveRender(win);
             break;
 
+        case CmdDebugDumpMupdfStore:
+            DumpMupdfSharedStore();
+            break;
+
         case CmdToggleLinks:
             gGlobalPrefs->showLinks = !gGlobalPrefs->showLinks;
             for (auto& w : gWindows) {
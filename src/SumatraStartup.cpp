@@ -1144,6 +1144,19 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
     DetectExternalViewers();
 
     gRenderCache = new RenderCache();
+    // show ebooks before all their pages have been laid out
+    // (the ui picks up the final page count in DocLayoutFinished)
+    SetEbookLazyLayout(true);
+    // and with their final page count if they've been laid out before
+    TempStr cacheDir = GetPathInAppDataDirTemp("sumatrapdfcache");
+    if (cacheDir) {
+        SetEbookPaginationCacheDir(path::JoinTemp(cacheDir, "pagination"));
+    }
+    // same for the page sizes, ToC and page labels of linearized PDFs
+    SetMupdfProgressiveLoading(true);
+    // fonts, glyphs and the store's memory budget are shared by all documents
+    SetMupdfSharedStore(true);
+    SetMupdfMapLargeFiles(flags.mapLargeFiles);
 
     LoadSettings();
     UpdateGlobalPrefs(flags);
@@ -1154,7 +1167,7 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
     }
 
     if (flags.pathsToBenchmark.Size() > 0) {
-        BenchFileOrDir(flags.pathsToBenchmark);
+        BenchFileOrDir(flags.pathsToBenchmark, flags.benchJsonPath);
     }
 
     if (flags.exitImmediately) {
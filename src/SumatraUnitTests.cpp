@@ -18,6 +18,7 @@
 #include "GlobalPrefs.h"
 #include "Flags.h"
 #include "Commands.h"
+#include "TextSearchIndex.h"
 
 #include <float.h>
 #include <math.h>
@@ -57,6 +58,23 @@ static void ParseCommandLineTest() {
         utassert(str::Eq("loadonly", i.pathsToBenchmark.At(1)));
     }
 
+    {
+        Flags i;
+        ParseFlags(L"SumatraPDF.exe -bench bar.pdf tiles", i);
+        utassert(2 == i.pathsToBenchmark.Size());
+        utassert(str::Eq("bar.pdf", i.pathsToBenchmark.At(0)));
+        utassert(str::Eq("tiles", i.pathsToBenchmark.At(1)));
+    }
+
+    {
+        Flags i;
+        ParseFlags(L"SumatraPDF.exe -bench corpus -bench-json results.json", i);
+        utassert(2 == i.pathsToBenchmark.Size());
+        utassert(str::Eq("corpus", i.pathsToBenchmark.At(0)));
+        utassert(nullptr == i.pathsToBenchmark.At(1));
+        utassert(str::Eq("results.json", i.benchJsonPath));
+    }
+
     {
         Flags i;
         ParseFlags(L"SumatraPDF.exe -bench bar.pdf 1 -set-color-range 0x123456 #abCDef", i);
@@ -146,6 +164,10 @@ static void BenchRangeTest() {
     utassert(IsBenchPagesInfo("1-3,4,6-9,13"));
     utassert(IsBenchPagesInfo("2-"));
     utassert(IsBenchPagesInfo("loadonly"));
+    utassert(IsBenchPagesInfo("search"));
+    utassert(IsBenchPagesInfo("pdfsync"));
+    utassert(IsBenchPagesInfo("firstpage"));
+    utassert(IsBenchPagesInfo("layout"));
 
     utassert(!IsBenchPagesInfo(""));
     utassert(!IsBenchPagesInfo("-2"));
@@ -293,6 +315,62 @@ void parseCommandsTest() {
     }
 }
 
+// returns a bit for every page that might contain s, starting with page 1
+static u32 textSearchIndexLookup(const TextSearchIndex* idx, const WCHAR* s, u32 pagesToSkipMask = 0) {
+    Vec<bool> pagesToSkip;
+    for (int i = 0; i < idx->nPages; i++) {
+        pagesToSkip.Append((pagesToSkipMask & (1 << i)) != 0);
+    }
+    int nFound = idx->SkipPagesWithout(s, pagesToSkip);
+    u32 res = 0;
+    int nNotSkipped = 0;
+    for (int i = 0; i < idx->nPages; i++) {
+        if (!pagesToSkip[i]) {
+            res |= 1 << i;
+            nNotSkipped++;
+        }
+    }
+    utassert(nFound == nNotSkipped);
+    return res;
+}
+
+static void textSearchIndexTest() {
+    const WCHAR* pages[] = {
+        L"The quick brown Fox",
+        L"jumps over the lazy dog",
+        L"",
+        L"\u6f22\u5b57\u691c\u7d22 fox",
+        L"\u4e2d\u6587",
+    };
+    PageText pagesText[dimof(pages)];
+    for (int i = 0; i < dimofi(pages); i++) {
+        pagesText[i].text = (WCHAR*)pages[i];
+        pagesText[i].len = str::Leni(pages[i]);
+    }
+    TextSearchIndex* idx = BuildTextSearchIndex(pagesText, dimofi(pages));
+    utassert(idx->nPages == dimofi(pages));
+
+    utassert(textSearchIndexLookup(idx, L"fox") == 0b01001);
+    utassert(textSearchIndexLookup(idx, L"FOX") == 0b01001);
+    utassert(textSearchIndexLookup(idx, L"the") == 0b00011);
+    utassert(textSearchIndexLookup(idx, L"lazy") == 0b00010);
+    utassert(textSearchIndexLookup(idx, L"cat") == 0);
+    utassert(textSearchIndexLookup(idx, L"xof") == 0);
+    // too short for a trigram, so no page can be skipped
+    utassert(textSearchIndexLookup(idx, L"ox") == 0b11111);
+    // pages skipped by the caller stay skipped
+    utassert(textSearchIndexLookup(idx, L"fox", 0b00001) == 0b01000);
+
+    // CJK characters are looked up individually
+    utassert(textSearchIndexLookup(idx, L"\u5b57") == 0b01000);
+    utassert(textSearchIndexLookup(idx, L"\u691c\u7d22") == 0b01000);
+    utassert(textSearchIndexLookup(idx, L"\u6587") == 0b10000);
+    utassert(textSearchIndexLookup(idx, L"\u5b57\u6587") == 0);
+    utassert(textSearchIndexLookup(idx, L"\u4e00") == 0);
+
+    delete idx;
+}
+
 void SumatraPDF_UnitTests() {
     parseCommandsTest();
     colorTest();
@@ -300,4 +378,5 @@ void SumatraPDF_UnitTests() {
     ParseCommandLineTest();
     versioncheck_test();
     hexstrTest();
+    textSearchIndexTest();
 }
@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/StrSearch.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/UIModels.h"
@@ -32,11 +33,13 @@ TextSearch::TextSearch(EngineBase* engine, DocumentTextCache* textCache) : TextS
 
 TextSearch::~TextSearch() {
     Clear();
+    str::FreePtr(&foldedText);
 }
 
 void TextSearch::Clear() {
     str::FreePtr(&findText);
     str::FreePtr(&anchor);
+    str::FreePtr(&foldedAnchor);
     str::FreePtr(&lastText);
     Reset();
 }
@@ -93,6 +96,11 @@ void TextSearch::SetText(const WCHAR* text) {
         anchor = str::Dup(text, 1);
     }
 
+    if (anchor) {
+        foldedAnchor = str::Dup(anchor);
+        str::FoldCaseInPlace(foldedAnchor, str::Leni(foldedAnchor));
+    }
+
     if (str::Len(this->findText) >= INT_MAX) {
         this->findText[(unsigned)INT_MAX - 1] = '\0';
     }
@@ -101,6 +109,7 @@ void TextSearch::SetText(const WCHAR* text) {
     }
 
     markAllPagesNonSkip(pagesToSkip);
+    usedIndex = false;
 }
 
 void TextSearch::SetSensitive(bool sensitive) {
@@ -108,8 +117,10 @@ void TextSearch::SetSensitive(bool sensitive) {
         return;
     }
     this->caseSensitive = sensitive;
+    searchedTextFor = nullptr;
 
     markAllPagesNonSkip(pagesToSkip);
+    usedIndex = false;
 }
 
 void TextSearch::SetDirection(TextSearch::Direction direction) {
@@ -253,6 +264,23 @@ static const WCHAR* GetNextIndex(const WCHAR* base, int offset, bool forward) {
     return c;
 }
 
+// page text is folded only once per page instead of on every comparison
+void TextSearch::UpdateSearchedText() {
+    if (searchedTextFor == pageText) {
+        return;
+    }
+    searchedTextFor = pageText;
+    searchedTextLen = str::Leni(pageText);
+    searchedText = pageText;
+    if (caseSensitive || !pageText) {
+        return;
+    }
+    str::FreePtr(&foldedText);
+    foldedText = str::Dup(pageText, (size_t)searchedTextLen);
+    str::FoldCaseInPlace(foldedText, searchedTextLen);
+    searchedText = foldedText;
+}
+
 bool TextSearch::FindTextInPage(int pageNo, TextSearch::PageAndOffset* finalGlyph) {
     if (str::IsEmpty(findText)) {
         return false;
@@ -265,20 +293,28 @@ bool TextSearch::FindTextInPage(int pageNo, TextSearch::PageAndOffset* finalGlyp
     // a findText = textCache->GetData(findPage) here.
     findPage = pageNo;
 
+    const WCHAR* toFind = caseSensitive ? anchor : foldedAnchor;
+    int toFindLen = str::Leni(toFind);
+    str::FindOptions opts;
+    opts.wordStart = matchWordStart;
+    opts.isWordChar = isWordChar;
+    if (anchor) {
+        UpdateSearchedText();
+    }
+
     const WCHAR* found;
     PageAndOffset fg;
     do {
         if (!anchor) {
             found = GetNextIndex(pageText, findIndex, forward);
-        } else if (forward) {
-            const WCHAR* s = pageText + findIndex;
-            if (caseSensitive) {
-                found = StrStr(s, anchor);
+        } else {
+            int idx;
+            if (forward) {
+                idx = str::FindInWStr(searchedText, searchedTextLen, findIndex, toFind, toFindLen, &opts);
             } else {
-                found = StrStrI(s, anchor);
+                idx = str::FindLastInWStr(searchedText, searchedTextLen, findIndex, toFind, toFindLen, &opts);
             }
-        } else {
-            found = StrRStrI(pageText, pageText + findIndex, anchor);
+            found = idx < 0 ? nullptr : pageText + idx;
         }
         if (!found) {
             return false;
@@ -304,11 +340,34 @@ bool TextSearch::FindTextInPage(int pageNo, TextSearch::PageAndOffset* finalGlyp
     return true;
 }
 
+// queues the next pagesToReadAhead pages that still have to be searched
+void TextSearch::ReadAhead(int pageNo) {
+    if (pagesToReadAhead <= 0) {
+        return;
+    }
+    int next = forward ? 1 : -1;
+    Vec<int> pages;
+    for (pageNo += next; 1 <= pageNo && pageNo <= nPages && pages.Size() < pagesToReadAhead; pageNo += next) {
+        if (!pagesToSkip[pageNo - 1]) {
+            pages.Append(pageNo);
+        }
+    }
+    textCache->ExtractPagesAsync(pages);
+}
+
 bool TextSearch::FindStartingAtPage(int pageNo) {
     if (str::IsEmpty(findText)) {
         return false;
     }
 
+    if (!usedIndex) {
+        usedIndex = true;
+        // pages not containing the anchor can't contain findText
+        if (anchor) {
+            textCache->SkipPagesWithout(anchor, pagesToSkip);
+        }
+    }
+
     int next = forward ? 1 : -1;
     while ((1 <= pageNo) && (pageNo <= nPages) && !WasCanceled(progressCb)) {
         UpdateProgress(progressCb, pageNo, nPages);
@@ -320,6 +379,7 @@ bool TextSearch::FindStartingAtPage(int pageNo) {
 
         Reset();
 
+        ReadAhead(pageNo);
         pageText = textCache->GetTextForPage(pageNo, &findIndex);
         if (pageText) {
             if (forward) {
@@ -357,6 +417,39 @@ TextSel* TextSearch::FindFirst(int page, const WCHAR* text) {
     return nullptr;
 }
 
+// finds all matches of hits->text from the first page on and adds them to
+// hits as they're found. Returns false if progressCb cancelled the search
+bool TextSearch::FindAll(TextSearchHits* hits) {
+    SetSensitive(hits->caseSensitive);
+    SetDirection(Direction::Forward);
+    TextSel* sel = FindFirst(1, hits->text);
+    while (sel) {
+        hits->Append(this);
+        sel = FindNext();
+    }
+    if (WasCanceled(progressCb)) {
+        return false;
+    }
+    hits->SetComplete();
+    return true;
+}
+
+// makes hit the current result, as if FindNext() had just found it
+void TextSearch::SetCurrentHit(const TextSearchHit& hit) {
+    Reset();
+    StartAt(hit.startPage, hit.startGlyph);
+    SelectUpTo(hit.endPage, hit.endGlyph);
+    searchHitStartAt = hit.startPage;
+    if (forward) {
+        findPage = hit.endPage;
+        findIndex = hit.endGlyph;
+    } else {
+        findPage = hit.startPage;
+        findIndex = hit.startGlyph;
+    }
+    pageText = textCache->GetTextForPage(findPage);
+}
+
 TextSel* TextSearch::FindNext() {
     ReportIf(!findText);
     if (!findText) {
@@ -384,3 +477,96 @@ TextSel* TextSearch::FindNext() {
     }
     return nullptr;
 }
+
+TextSearchHits::TextSearchHits(const WCHAR* text, bool caseSensitive) {
+    InitializeCriticalSection(&access);
+    this->text = str::Dup(text);
+    this->caseSensitive = caseSensitive;
+}
+
+TextSearchHits::~TextSearchHits() {
+    if (thread) {
+        cancelled.Set(true);
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+    str::Free(text);
+    DeleteCriticalSection(&access);
+}
+
+bool TextSearchHits::IsFor(const WCHAR* s, bool sensitive) const {
+    return caseSensitive == sensitive && str::Eq(text, s);
+}
+
+bool TextSearchHits::IsComplete() {
+    ScopedCritSec scope(&access);
+    return isComplete;
+}
+
+int TextSearchHits::Count() {
+    ScopedCritSec scope(&access);
+    return hits.Size();
+}
+
+bool TextSearchHits::GetHit(int idx, TextSearchHit* hitOut) {
+    ScopedCritSec scope(&access);
+    if (idx < 0 || idx >= hits.Size()) {
+        return false;
+    }
+    *hitOut = hits[idx];
+    return true;
+}
+
+static bool IsBefore(const TextSearchHit& hit, int pageNo, int glyph) {
+    return hit.startPage < pageNo || (hit.startPage == pageNo && hit.startGlyph < glyph);
+}
+
+// returns the index of the first match starting after pageNo/glyph
+// (resp. of the last one starting before it) or -1 if there's none
+int TextSearchHits::FindHit(int pageNo, int glyph, bool forward) {
+    ScopedCritSec scope(&access);
+    // hits are sorted by position
+    auto it = std::lower_bound(hits.begin(), hits.end(), 0, [pageNo, glyph](const TextSearchHit& hit, int) {
+        return IsBefore(hit, pageNo, glyph);
+    });
+    int idx = (int)(it - hits.begin());
+    if (!forward) {
+        return idx - 1;
+    }
+    if (idx < hits.Size() && hits[idx].startPage == pageNo && hits[idx].startGlyph == glyph) {
+        idx++;
+    }
+    return idx < hits.Size() ? idx : -1;
+}
+
+// for showing "match n of m", only once all matches are known
+bool TextSearchHits::GetHitNo(int pageNo, int glyph, int* hitNoOut, int* nHitsOut) {
+    int idx = FindHit(pageNo, glyph, false) + 1;
+    ScopedCritSec scope(&access);
+    if (!isComplete || idx >= hits.Size() || hits[idx].startPage != pageNo || hits[idx].startGlyph != glyph) {
+        return false;
+    }
+    *hitNoOut = idx + 1;
+    *nHitsOut = hits.Size();
+    return true;
+}
+
+void TextSearchHits::Append(TextSelection* sel) {
+    TextSearchHit hit;
+    hit.startPage = sel->startPage;
+    hit.startGlyph = sel->startGlyph;
+    hit.endPage = sel->endPage;
+    hit.endGlyph = sel->endGlyph;
+
+    ScopedCritSec scope(&access);
+    hit.firstRect = rects.Size();
+    hit.nRects = sel->result.len;
+    rectPages.Append(sel->result.pages, (size_t)sel->result.len);
+    rects.Append(sel->result.rects, (size_t)sel->result.len);
+    hits.Append(hit);
+}
+
+void TextSearchHits::SetComplete() {
+    ScopedCritSec scope(&access);
+    isComplete = true;
+}
@@ -1,6 +1,49 @@
 /* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+// a match found by TextSearch::FindAll()
+struct TextSearchHit {
+    int startPage = 0;
+    int startGlyph = 0;
+    int endPage = 0;
+    int endGlyph = 0;
+    // the match covers TextSearchHits::rects[firstRect] to rects[firstRect + nRects - 1]
+    int firstRect = 0;
+    int nRects = 0;
+};
+
+// all matches of a search text in document order. They're added by
+// TextSearch::FindAll() on a background thread while the ui thread
+// already reads them, so all access goes through access
+struct TextSearchHits {
+    TextSearchHits(const WCHAR* text, bool caseSensitive);
+    ~TextSearchHits();
+
+    bool IsFor(const WCHAR* text, bool caseSensitive) const;
+    bool IsComplete();
+    int Count();
+    bool GetHit(int idx, TextSearchHit* hitOut);
+    int FindHit(int pageNo, int glyph, bool forward);
+    bool GetHitNo(int pageNo, int glyph, int* hitNoOut, int* nHitsOut);
+    void Append(TextSelection* sel);
+    void SetComplete();
+
+    WCHAR* text = nullptr;
+    bool caseSensitive = false;
+
+    CRITICAL_SECTION access;
+    Vec<TextSearchHit> hits;
+    // page and rectangle (in page coordinates) of all matches
+    Vec<int> rectPages;
+    Vec<Rect> rects;
+    // set once the whole document has been searched
+    bool isComplete = false;
+
+    // the thread filling this, stopped by the destructor
+    HANDLE thread = nullptr;
+    AtomicBool cancelled;
+};
+
 struct TextSearch : public TextSelection {
     enum class Direction : bool { Backward = false, Forward = true };
 
@@ -12,11 +55,16 @@ struct TextSearch : public TextSelection {
     void SetLastResult(TextSelection* sel);
     TextSel* FindFirst(int page, const WCHAR* text);
     TextSel* FindNext();
+    bool FindAll(TextSearchHits* hits);
+    void SetCurrentHit(const TextSearchHit& hit);
 
     int GetCurrentPageNo() const;
     int GetSearchHitStartPageNo() const;
 
     ProgressUpdateCb progressCb;
+    // if > 0, text of that many pages ahead (in search direction)
+    // is extracted in the background while searching the current page
+    int pagesToReadAhead = 0;
 
     // Lightweight container for page and offset within the page to use as return value of MatchEnd
     struct PageAndOffset {
@@ -37,8 +85,10 @@ struct TextSearch : public TextSelection {
     bool matchWordEnd = false;
 
     void SetText(const WCHAR* text);
+    void UpdateSearchedText();
     bool FindTextInPage(int pageNo, PageAndOffset* finalGlyph);
     bool FindStartingAtPage(int pageNo);
+    void ReadAhead(int pageNo);
     PageAndOffset MatchEnd(const WCHAR* start) const;
 
     void Clear();
@@ -47,7 +97,17 @@ struct TextSearch : public TextSelection {
     const WCHAR* pageText = nullptr;
     int findIndex = 0;
 
+    // for case-insensitive search, anchor is looked up in a lower-cased
+    // copy of pageText (searchedText), the offsets are the same
+    WCHAR* foldedAnchor = nullptr;
+    WCHAR* foldedText = nullptr;
+    const WCHAR* searchedText = nullptr;
+    const WCHAR* searchedTextFor = nullptr;
+    int searchedTextLen = 0;
+
     WCHAR* lastText = nullptr;
     int nPages = 0;
     Vec<bool> pagesToSkip;
+    // set once pagesToSkip has been updated from textCache's index
+    bool usedIndex = false;
 };
@@ -0,0 +1,294 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ByteReader.h"
+#include "utils/ByteWriter.h"
+#include "utils/DirIter.h"
+#include "utils/FileUtil.h"
+#include "utils/WinUtil.h"
+
+#include "wingui/UIModels.h"
+
+#include "DocController.h"
+#include "EngineBase.h"
+#include "TextSearchIndex.h"
+
+#include "utils/Log.h"
+
+// bump the version when the file format or text normalization changes
+constexpr u32 kTextSearchIndexMagic = 0x58444953; // 'SIDX'
+constexpr u32 kTextSearchIndexVersion = 2;
+constexpr size_t kTextSearchIndexHeaderSize = 5 * sizeof(u32);
+// when there are more index files, the oldest ones are deleted
+constexpr int kMaxTextSearchIndexFiles = 64;
+
+// TextSearch only looks up the first word of the search text
+// (TextSearch::anchor), so only trigrams of word characters are indexed
+// (same as isWordChar() but any definition works as long as building
+// and looking up agree). CJK text (U+2E80 and up) isn't separated into
+// words by spaces, so for it the anchor is just the first character
+// (cf. isnoncjkwordchar in TextSearch.cpp). Such characters are indexed
+// on their own: their trigrams would never be looked up and, given the
+// size of the alphabet, would mostly be unique
+static bool IsTrigramChar(WCHAR c) {
+    return (IsCharAlphaNumericW(c) || c == '_') && (unsigned short)c < 0x2E80;
+}
+
+static bool IsCjkChar(WCHAR c) {
+    return (unsigned short)c >= 0x2E80;
+}
+
+static u64 MakeTrigram(const WCHAR* s) {
+    return ((u64)s[0] << 32) | ((u64)s[1] << 16) | (u64)s[2];
+}
+
+// a single CJK character can't collide with a trigram
+// as those never contain 0
+static u64 MakeCjkTrigram(WCHAR c) {
+    return (u64)c;
+}
+
+// appends the trigrams of lowercased s, in the order they occur
+static void CollectTrigrams(const WCHAR* s, int len, Vec<u64>& trigrams) {
+    int run = 0;
+    for (int i = 0; i < len; i++) {
+        if (IsCjkChar(s[i])) {
+            trigrams.Append(MakeCjkTrigram(s[i]));
+        }
+        run = IsTrigramChar(s[i]) ? run + 1 : 0;
+        if (run >= 3) {
+            trigrams.Append(MakeTrigram(s + i - 2));
+        }
+    }
+}
+
+struct TrigramPosting {
+    u64 trigram;
+    int pageNo;
+};
+
+TextSearchIndex* BuildTextSearchIndex(const PageText* pagesText, int nPages) {
+    auto idx = new TextSearchIndex();
+    idx->nPages = nPages;
+
+    Vec<TrigramPosting> all;
+    Vec<u64> pageTrigrams;
+    Vec<WCHAR> lowered;
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        const PageText& pageText = pagesText[pageNo - 1];
+        if (!pageText.text || pageText.len <= 0) {
+            continue;
+        }
+        lowered.Reset();
+        lowered.Append(pageText.text, (size_t)pageText.len);
+        CharLowerBuffW(lowered.LendData(), (DWORD)pageText.len);
+
+        pageTrigrams.Reset();
+        CollectTrigrams(lowered.LendData(), pageText.len, pageTrigrams);
+        if (pageTrigrams.IsEmpty()) {
+            continue;
+        }
+        std::sort(pageTrigrams.begin(), pageTrigrams.end());
+        u64* end = std::unique(pageTrigrams.begin(), pageTrigrams.end());
+        for (u64* t = pageTrigrams.begin(); t < end; t++) {
+            all.Append({*t, pageNo});
+        }
+    }
+
+    if (!all.IsEmpty()) {
+        std::sort(all.begin(), all.end(), [](const TrigramPosting& a, const TrigramPosting& b) {
+            if (a.trigram != b.trigram) {
+                return a.trigram < b.trigram;
+            }
+            return a.pageNo < b.pageNo;
+        });
+    }
+    for (TrigramPosting& p : all) {
+        if (idx->trigrams.IsEmpty() || idx->trigrams.Last() != p.trigram) {
+            idx->trigrams.Append(p.trigram);
+            idx->postingStart.Append(idx->postings.Size());
+        }
+        idx->postings.Append(p.pageNo);
+    }
+    idx->postingStart.Append(idx->postings.Size());
+    return idx;
+}
+
+int TextSearchIndex::SkipPagesWithout(const WCHAR* s, Vec<bool>& pagesToSkip) const {
+    int len = str::Leni(s);
+    ReportIf(pagesToSkip.Size() != nPages);
+    if (len == 0 || pagesToSkip.Size() != nPages) {
+        return nPages;
+    }
+    WCHAR* toFind = str::Dup(s);
+    defer {
+        str::Free(toFind);
+    };
+    CharLowerBuffW(toFind, (DWORD)len);
+
+    Vec<u64> toFindTrigrams;
+    CollectTrigrams(toFind, len, toFindTrigrams);
+
+    // only pages containing all trigrams of s can match. the trigrams might
+    // occur in different places on a page, so the search itself still
+    // has to confirm the remaining pages
+    const u64* first = trigrams.LendData();
+    const u64* last = first + trigrams.Size();
+    for (u64 trigram : toFindTrigrams) {
+        const u64* it = std::lower_bound(first, last, trigram);
+        const int* pages = nullptr;
+        int nPagesWith = 0;
+        if (it != last && *it == trigram) {
+            int n = (int)(it - first);
+            pages = postings.LendData() + postingStart[n];
+            nPagesWith = postingStart[n + 1] - postingStart[n];
+        }
+        // postings are sorted by page number
+        int pi = 0;
+        for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+            while (pi < nPagesWith && pages[pi] < pageNo) {
+                pi++;
+            }
+            if (pi == nPagesWith || pages[pi] != pageNo) {
+                pagesToSkip[pageNo - 1] = true;
+            }
+        }
+    }
+
+    int nFound = 0;
+    for (bool skip : pagesToSkip) {
+        nFound += skip ? 0 : 1;
+    }
+    return nFound;
+}
+
+template <typename T>
+static const u8* ReadArray(const u8* d, Vec<T>& v, size_t n) {
+    v.Append((const T*)d, n);
+    return d + n * sizeof(T);
+}
+
+template <typename T>
+static void WriteArray(ByteWriter& w, const Vec<T>& v) {
+    w.d.Append((const u8*)v.LendData(), v.size() * sizeof(T));
+}
+
+static bool IsValidIndex(const TextSearchIndex* idx) {
+    // SkipPagesWithout() relies on sorted trigrams and postings
+    for (int i = 1; i < idx->trigrams.Size(); i++) {
+        if (idx->trigrams[i] <= idx->trigrams[i - 1]) {
+            return false;
+        }
+    }
+    int nPostings = idx->postings.Size();
+    if (idx->postingStart[0] != 0 || idx->postingStart.Last() != nPostings) {
+        return false;
+    }
+    for (int i = 1; i < idx->postingStart.Size(); i++) {
+        if (idx->postingStart[i] < idx->postingStart[i - 1]) {
+            return false;
+        }
+    }
+    for (int i = 0; i < idx->trigrams.Size(); i++) {
+        int prevPageNo = 0;
+        for (int j = idx->postingStart[i]; j < idx->postingStart[i + 1]; j++) {
+            int pageNo = idx->postings[j];
+            if (pageNo <= prevPageNo || pageNo > idx->nPages) {
+                return false;
+            }
+            prevPageNo = pageNo;
+        }
+    }
+    return true;
+}
+
+TextSearchIndex* LoadTextSearchIndex(const char* path) {
+    ByteSlice d = file::ReadFile(path);
+    if (d.empty()) {
+        return nullptr;
+    }
+    defer {
+        d.Free();
+    };
+    if (d.size() < kTextSearchIndexHeaderSize) {
+        return nullptr;
+    }
+    ByteReader r(d);
+    if (r.DWordLE(0) != kTextSearchIndexMagic || r.DWordLE(4) != kTextSearchIndexVersion) {
+        logf("LoadTextSearchIndex: '%s' has unknown format\n", path);
+        return nullptr;
+    }
+    u32 nPages = r.DWordLE(8);
+    u32 nTrigrams = r.DWordLE(12);
+    u32 nPostings = r.DWordLE(16);
+    u64 expectedSize = (u64)kTextSearchIndexHeaderSize + (u64)nTrigrams * sizeof(u64) +
+                       ((u64)nTrigrams + 1) * sizeof(int) + (u64)nPostings * sizeof(int);
+    if (nPages == 0 || nPages > INT_MAX || d.size() != expectedSize) {
+        logf("LoadTextSearchIndex: '%s' is corrupted\n", path);
+        return nullptr;
+    }
+
+    auto idx = new TextSearchIndex();
+    idx->nPages = (int)nPages;
+    const u8* curr = d.data() + kTextSearchIndexHeaderSize;
+    curr = ReadArray(curr, idx->trigrams, nTrigrams);
+    curr = ReadArray(curr, idx->postingStart, (size_t)nTrigrams + 1);
+    ReadArray(curr, idx->postings, nPostings);
+    if (!IsValidIndex(idx)) {
+        logf("LoadTextSearchIndex: '%s' is corrupted\n", path);
+        delete idx;
+        return nullptr;
+    }
+    return idx;
+}
+
+// keeps only the kMaxTextSearchIndexFiles most recently written index files
+static void PruneTextSearchIndexDir(const char* dir) {
+    StrVec paths;
+    Vec<FILETIME> times;
+    DirIter di{dir};
+    for (DirIterEntry* de : di) {
+        if (path::Match(de->filePath, "*.idx")) {
+            paths.Append(de->filePath);
+            times.Append(de->fd->ftLastWriteTime);
+        }
+    }
+    while (paths.Size() > kMaxTextSearchIndexFiles) {
+        int oldest = 0;
+        for (int i = 1; i < paths.Size(); i++) {
+            if (CompareFileTime(&times[i], &times[oldest]) < 0) {
+                oldest = i;
+            }
+        }
+        file::Delete(paths.At(oldest));
+        paths.RemoveAt(oldest);
+        times.RemoveAt(oldest);
+    }
+}
+
+bool SaveTextSearchIndex(const TextSearchIndex* idx, const char* path) {
+    if (!idx || !path) {
+        return false;
+    }
+    size_t size = kTextSearchIndexHeaderSize + idx->trigrams.size() * (sizeof(u64) + sizeof(int)) +
+                  idx->postings.size() * sizeof(int);
+    ByteWriterLE w(size);
+    w.Write32(kTextSearchIndexMagic);
+    w.Write32(kTextSearchIndexVersion);
+    w.Write32((u32)idx->nPages);
+    w.Write32((u32)idx->trigrams.Size());
+    w.Write32((u32)idx->postings.Size());
+    WriteArray(w, idx->trigrams);
+    WriteArray(w, idx->postingStart);
+    WriteArray(w, idx->postings);
+
+    dir::CreateForFile(path);
+    bool ok = file::WriteFile(path, w.AsByteSlice());
+    if (!ok) {
+        logf("SaveTextSearchIndex: failed to write '%s'\n", path);
+        return false;
+    }
+    PruneTextSearchIndexDir(path::GetDirTemp(path));
+    return true;
+}
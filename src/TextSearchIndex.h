@@ -0,0 +1,25 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// Trigram index of a document, persisted in the cache directory under
+// the document's content fingerprint (see EngineBase::GetFingerprint()
+// and GetIndexPath() in TextSelection.cpp).
+// It allows TextSearch to skip pages that can't contain the search text
+// without having to extract their text first.
+struct TextSearchIndex {
+    int nPages = 0;
+    // sorted trigrams of the lowercased text of all pages (and single CJK
+    // characters). pages containing trigrams[i] are
+    // postings[postingStart[i]] to postings[postingStart[i + 1] - 1]
+    Vec<u64> trigrams;
+    Vec<int> postingStart;
+    Vec<int> postings;
+
+    // sets pagesToSkip for all pages not containing every trigram of s (ignoring case)
+    // returns the number of pages that might contain s
+    int SkipPagesWithout(const WCHAR* s, Vec<bool>& pagesToSkip) const;
+};
+
+TextSearchIndex* BuildTextSearchIndex(const PageText* pagesText, int nPages);
+TextSearchIndex* LoadTextSearchIndex(const char* path);
+bool SaveTextSearchIndex(const TextSearchIndex* idx, const char* path);
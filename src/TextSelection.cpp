@@ -2,14 +2,20 @@
    License: GPLv3 */
 
 #include "utils/BaseUtil.h"
+#include "utils/FileUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/UIModels.h"
 
 #include "DocController.h"
 #include "EngineBase.h"
+#include "AppTools.h"
 #include "TextSelection.h"
+#include "TextSearchIndex.h"
+
+#include "utils/Log.h"
 
 uint distSq(int x, int y) {
     return x * x + y * y;
@@ -19,26 +25,97 @@ bool isWordChar(WCHAR c) {
     return IsCharAlphaNumeric(c) || c == '_';
 }
 
+// coordinates are already rounded to whole points, so storing them relative
+// to the start of their run is lossless as long as they fit into a GlyphBox.
+// returns false if they don't (e.g. for huge glyphs)
+static bool CompactGlyphs(const Rect* coords, int len, PageGlyphs* glyphs) {
+    Vec<GlyphRun> runs;
+    GlyphBox* boxes = AllocArray<GlyphBox>(len);
+    for (int i = 0; i < len; i++) {
+        const Rect& r = coords[i];
+        if (r.dx < 0 || r.dx > UINT16_MAX) {
+            free(boxes);
+            return false;
+        }
+        GlyphRun* run = runs.IsEmpty() ? nullptr : &runs.Last();
+        int x = run ? r.x - run->x : 0;
+        if (!run || r.y != run->y || r.dy != run->dy || x < INT16_MIN || x > INT16_MAX) {
+            runs.Append({r.x, r.y, r.dy, i});
+            x = 0;
+        }
+        boxes[i] = {(i16)x, (u16)r.dx};
+    }
+    glyphs->nRuns = runs.Size();
+    glyphs->runs = runs.StealData();
+    glyphs->boxes = boxes;
+    return true;
+}
+
+static Rect* ExpandGlyphs(const PageGlyphs* glyphs, int len) {
+    Rect* coords = AllocArray<Rect>(len);
+    for (int i = 0; i < glyphs->nRuns; i++) {
+        const GlyphRun& run = glyphs->runs[i];
+        int end = i + 1 < glyphs->nRuns ? glyphs->runs[i + 1].firstGlyph : len;
+        for (int j = run.firstGlyph; j < end; j++) {
+            const GlyphBox& box = glyphs->boxes[j];
+            coords[j] = Rect(run.x + box.x, run.y, box.dx, run.dy);
+        }
+    }
+    return coords;
+}
+
+static int PageGlyphsSize(const PageGlyphs* glyphs, int len) {
+    return glyphs->nRuns * (int)sizeof(GlyphRun) + len * (int)sizeof(GlyphBox);
+}
+
+static void FreePageGlyphs(PageGlyphs* glyphs) {
+    free(glyphs->runs);
+    free(glyphs->boxes);
+    glyphs->runs = nullptr;
+    glyphs->boxes = nullptr;
+    glyphs->nRuns = 0;
+}
+
 DocumentTextCache::DocumentTextCache(EngineBase* engine) : engine(engine) {
     nPages = engine->PageCount();
     pagesText = AllocArray<PageText>(nPages);
-    debugSize = nPages * (sizeof(Rect*) + sizeof(WCHAR*) + sizeof(int));
+    pagesGlyphs = AllocArray<PageGlyphs>(nPages);
+    isExtracting = AllocArray<bool>(nPages);
+    debugSize = nPages * (sizeof(PageText) + sizeof(PageGlyphs));
 
     InitializeCriticalSection(&access);
+    InitializeCriticalSection(&extractAccess);
+    InitializeConditionVariable(&pagesQueued);
+    InitializeConditionVariable(&pageExtracted);
 }
 
 DocumentTextCache::~DocumentTextCache() {
     EnterCriticalSection(&access);
+    stopExtracting = true;
+    pagesToExtract.Reset();
+    WakeAllConditionVariable(&pagesQueued);
+    LeaveCriticalSection(&access);
+    // threads finish extracting the current page first
+    for (int i = 0; i < nExtractThreads; i++) {
+        WaitForSingleObject(extractThreads[i], INFINITE);
+        CloseHandle(extractThreads[i]);
+    }
 
-    int n = engine->PageCount();
-    for (int i = 0; i < n; i++) {
-        PageText* pageText = &pagesText[i];
-        free(pageText->coords);
-        free(pageText->text);
+    EnterCriticalSection(&access);
+
+    // not engine->PageCount(), which changes when a lazy layout finishes
+    for (int i = 0; i < nPages; i++) {
+        FreePageText(&pagesText[i]);
+        FreePageGlyphs(&pagesGlyphs[i]);
     }
     free(pagesText);
+    free(pagesGlyphs);
+    free(isExtracting);
+    delete index;
+    str::Free(indexPath);
     LeaveCriticalSection(&access);
     DeleteCriticalSection(&access);
+    DeleteCriticalSection(&extractAccess);
 }
 
 bool DocumentTextCache::HasTextForPage(int pageNo) const {
@@ -47,30 +124,281 @@ bool DocumentTextCache::HasTextForPage(int pageNo) const {
     return pageText->text != nullptr;
 }
 
-const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, Rect** coordsOut) {
+const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut) {
     ReportIf(pageNo < 1 || pageNo > nPages);
 
     ScopedCritSec scope(&access);
     PageText* pageText = &pagesText[pageNo - 1];
 
-    if (!pageText->text) {
-        *pageText = engine->ExtractPageText(pageNo);
+    while (!pageText->text) {
+        if (isExtracting[pageNo - 1]) {
+            // another thread is already extracting this page
+            SleepConditionVariableCS(&pageExtracted, &access, INFINITE);
+            continue;
+        }
+
+        // extract without holding access so that other pages
+        // can be extracted (and cached pages read) at the same time
+        isExtracting[pageNo - 1] = true;
+        LeaveCriticalSection(&access);
+        PageText extracted;
+        if (engine->allowsConcurrentTextExtraction) {
+            extracted = engine->ExtractPageText(pageNo);
+        } else {
+            ScopedCritSec scopeExtract(&extractAccess);
+            extracted = engine->ExtractPageText(pageNo);
+        }
+        PageGlyphs glyphs;
+        if (extracted.coords && extracted.len > 0 && CompactGlyphs(extracted.coords, extracted.len, &glyphs)) {
+            free(extracted.coords);
+            extracted.coords = nullptr;
+        }
+        EnterCriticalSection(&access);
+        isExtracting[pageNo - 1] = false;
+
+        *pageText = extracted;
+        pagesGlyphs[pageNo - 1] = glyphs;
         if (!pageText->text) {
             pageText->text = str::Dup(L"");
             pageText->len = 0;
         }
-        debugSize += (pageText->len + 1) * (int)(sizeof(WCHAR) + sizeof(Rect));
+        nPagesWithText++;
+        debugSize += (pageText->len + 1) * (int)sizeof(WCHAR) + PageGlyphsSize(&glyphs, pageText->len);
+        if (pageText->coords) {
+            debugSize += pageText->len * (int)sizeof(Rect);
+        }
+        WakeAllConditionVariable(&pageExtracted);
     }
 
     if (lenOut) {
         *lenOut = pageText->len;
     }
-    if (coordsOut) {
-        *coordsOut = pageText->coords;
-    }
     return pageText->text;
 }
 
+// frees the coordinates of the least recently used pages
+// not currently in use. must be called while holding access
+static void EvictMaterializedPages(DocumentTextCache* textCache) {
+    Vec<int>& pages = textCache->materializedPages;
+    for (int i = 0; i < pages.Size() && pages.Size() > MAX_MATERIALIZED_PAGES;) {
+        int pageNo = pages[i];
+        if (textCache->pagesGlyphs[pageNo - 1].nUsers > 0) {
+            i++;
+            continue;
+        }
+        PageText* pageText = &textCache->pagesText[pageNo - 1];
+        free(pageText->coords);
+        pageText->coords = nullptr;
+        textCache->debugSize -= pageText->len * (int)sizeof(Rect);
+        pages.RemoveAt(i);
+    }
+}
+
+Rect* DocumentTextCache::GetCoordsForPage(int pageNo, int* lenOut) {
+    GetTextForPage(pageNo, lenOut);
+
+    ScopedCritSec scope(&access);
+    PageText* pageText = &pagesText[pageNo - 1];
+    PageGlyphs* glyphs = &pagesGlyphs[pageNo - 1];
+    glyphs->nUsers++;
+    if (!glyphs->boxes) {
+        // the coordinates are kept as is (or the page has no text)
+        return pageText->coords;
+    }
+    materializedPages.Remove(pageNo);
+    materializedPages.Append(pageNo);
+    if (!pageText->coords) {
+        pageText->coords = ExpandGlyphs(glyphs, pageText->len);
+        debugSize += pageText->len * (int)sizeof(Rect);
+        EvictMaterializedPages(this);
+    }
+    return pageText->coords;
+}
+
+void DocumentTextCache::ReleaseCoordsForPage(int pageNo) {
+    ReportIf(pageNo < 1 || pageNo > nPages);
+
+    ScopedCritSec scope(&access);
+    PageGlyphs* glyphs = &pagesGlyphs[pageNo - 1];
+    ReportIf(glyphs->nUsers <= 0);
+    glyphs->nUsers--;
+    EvictMaterializedPages(this);
+}
+
+static void TextExtractThread(DocumentTextCache* textCache) {
+    for (;;) {
+        int pageNo;
+        {
+            ScopedCritSec scope(&textCache->access);
+            while (!textCache->stopExtracting && textCache->pagesToExtract.IsEmpty()) {
+                SleepConditionVariableCS(&textCache->pagesQueued, &textCache->access, INFINITE);
+            }
+            if (textCache->stopExtracting) {
+                return;
+            }
+            pageNo = textCache->pagesToExtract.PopAt(0);
+        }
+        textCache->GetTextForPage(pageNo);
+    }
+}
+
+void DocumentTextCache::ExtractPagesAsync(const Vec<int>& pages) {
+    ScopedCritSec scope(&access);
+    if (stopExtracting) {
+        return;
+    }
+    pagesToExtract.Reset();
+    for (int pageNo : pages) {
+        if (pageNo >= 1 && pageNo <= nPages && !pagesText[pageNo - 1].text) {
+            pagesToExtract.Append(pageNo);
+        }
+    }
+    if (pagesToExtract.IsEmpty()) {
+        return;
+    }
+
+    // threads are started on first use. only one thread is needed
+    // for engines that can't extract several pages at the same time
+    int nThreads = 1;
+    if (engine->allowsConcurrentTextExtraction) {
+        // leave one core for the ui thread
+        nThreads = limitValue(GetLogicalCpuCount() - 1, 1, MAX_TEXT_EXTRACT_THREADS);
+    }
+    while (nExtractThreads < nThreads) {
+        auto fn = MkFunc0<DocumentTextCache>(TextExtractThread, this);
+        HANDLE h = StartThread(fn, "TextExtractThread");
+        if (!h) {
+            break;
+        }
+        extractThreads[nExtractThreads++] = h;
+    }
+    WakeAllConditionVariable(&pagesQueued);
+}
+
+void DocumentTextCache::ExtractPages(int firstPage, int lastPage) {
+    firstPage = limitValue(firstPage, 1, nPages);
+    lastPage = limitValue(lastPage, 1, nPages);
+    Vec<int> pages;
+    for (int pageNo = firstPage; pageNo <= lastPage; pageNo++) {
+        pages.Append(pageNo);
+    }
+    ExtractPagesAsync(pages);
+
+    // help out from the other end, waiting for pages being extracted by the pool
+    for (int pageNo = lastPage; pageNo >= firstPage; pageNo--) {
+        GetTextForPage(pageNo);
+    }
+}
+
+static TempStr GetTextSearchIndexPathTemp(const u8 fingerprint[16]) {
+    TempStr dir = GetPathInAppDataDirTemp("sumatrapdfcache");
+    if (!dir) {
+        return nullptr;
+    }
+    AutoFreeStr hex = str::MemToHex(fingerprint, 16);
+    TempStr name = str::JoinTemp(hex, ".idx");
+    return path::JoinTemp(dir, "searchindex", name);
+}
+
+// must be called without holding access, as the fingerprint
+// might be a hash of the whole file (see EngineBase::GetFingerprint)
+// the returned path stays valid for the lifetime of the cache
+static const char* GetIndexPath(DocumentTextCache* textCache) {
+    {
+        ScopedCritSec scope(&textCache->access);
+        if (textCache->indexPath) {
+            return textCache->indexPath;
+        }
+    }
+    u8 digest[16]{};
+    if (!textCache->engine->GetFingerprint(digest)) {
+        return nullptr;
+    }
+    char* path = str::Dup(GetTextSearchIndexPathTemp(digest));
+    ScopedCritSec scope(&textCache->access);
+    if (textCache->indexPath) {
+        str::Free(path);
+    } else {
+        textCache->indexPath = path;
+    }
+    return textCache->indexPath;
+}
+
+// takes ownership of idx, which is loaded or built without holding access
+static void SetIndex(DocumentTextCache* textCache, TextSearchIndex* idx, bool replace) {
+    ScopedCritSec scope(&textCache->access);
+    if (textCache->index && !replace) {
+        delete idx;
+        return;
+    }
+    delete textCache->index;
+    textCache->index = idx;
+}
+
+int DocumentTextCache::SkipPagesWithout(const WCHAR* s, Vec<bool>& pagesToSkip) {
+    bool tryLoading = false;
+    {
+        ScopedCritSec scope(&access);
+        tryLoading = !triedLoadingIndex;
+        triedLoadingIndex = true;
+    }
+    if (tryLoading) {
+        const char* path = GetIndexPath(this);
+        TextSearchIndex* idx = path ? LoadTextSearchIndex(path) : nullptr;
+        if (idx && idx->nPages != nPages) {
+            logf("DocumentTextCache: index '%s' is for %d pages, expected %d\n", path, idx->nPages, nPages);
+            delete idx;
+            InvalidateIndex();
+        } else if (idx) {
+            SetIndex(this, idx, false);
+        }
+    }
+
+    // once all pages have been extracted (e.g. by a search without
+    // a match), building the index is cheap compared to that
+    bool build = false;
+    {
+        ScopedCritSec scope(&access);
+        build = !index && nPagesWithText == nPages;
+    }
+    if (build) {
+        // the text of extracted pages doesn't change, so it can be read without access
+        TextSearchIndex* idx = BuildTextSearchIndex(pagesText, nPages);
+        SaveTextSearchIndex(idx, GetIndexPath(this));
+        SetIndex(this, idx, false);
+    }
+
+    ScopedCritSec scope(&access);
+    if (!index) {
+        return nPages;
+    }
+    return index->SkipPagesWithout(s, pagesToSkip);
+}
+
+bool DocumentTextCache::RebuildIndex() {
+    InvalidateIndex();
+    ExtractPages(1, nPages);
+
+    TextSearchIndex* idx = BuildTextSearchIndex(pagesText, nPages);
+    bool ok = SaveTextSearchIndex(idx, GetIndexPath(this));
+    SetIndex(this, idx, true);
+    return ok;
+}
+
+void DocumentTextCache::InvalidateIndex() {
+    {
+        ScopedCritSec scope(&access);
+        delete index;
+        index = nullptr;
+        // don't re-load the index we're about to delete
+        triedLoadingIndex = true;
+    }
+    const char* path = GetIndexPath(this);
+    if (path) {
+        file::Delete(path);
+    }
+}
+
 TextSelection::TextSelection(EngineBase* engine, DocumentTextCache* textCache) : engine(engine), textCache(textCache) {
 }
 
@@ -91,9 +419,9 @@ void TextSelection::Reset() {
 // (i.e. when over the right half of a glyph, the returned index will be for the
 // glyph following it, which will be the first glyph (not) to be selected)
 static int FindClosestGlyph(TextSelection* ts, int pageNo, double x, double y) {
-    int textLen;
-    Rect* coords;
-    ts->textCache->GetTextForPage(pageNo, &textLen, &coords);
+    ScopedPageCoords pageCoords(ts->textCache, pageNo);
+    int textLen = pageCoords.len;
+    Rect* coords = pageCoords.coords;
     PointF pt = PointF(x, y);
 
     unsigned int maxDist = UINT_MAX;
@@ -145,8 +473,9 @@ static int FindClosestGlyph(TextSelection* ts, int pageNo, double x, double y) {
 
 static void FillResultRects(TextSelection* ts, int pageNo, int glyph, int length, StrVec* lines = nullptr) {
     int len;
-    Rect* coords;
-    const WCHAR* text = ts->textCache->GetTextForPage(pageNo, &len, &coords);
+    const WCHAR* text = ts->textCache->GetTextForPage(pageNo, &len);
+    ScopedPageCoords pageCoords(ts->textCache, pageNo);
+    Rect* coords = pageCoords.coords;
     ReportIf(len < glyph + length);
     Rect mediabox = ts->engine->PageMediabox(pageNo).Round();
     Rect *c = &coords[glyph], *end = c + length;
@@ -201,9 +530,9 @@ static void FillResultRects(TextSelection* ts, int pageNo, int glyph, int length
 }
 
 bool TextSelection::IsOverGlyph(int pageNo, double x, double y) {
-    int textLen;
-    Rect* coords;
-    textCache->GetTextForPage(pageNo, &textLen, &coords);
+    ScopedPageCoords pageCoords(textCache, pageNo);
+    int textLen = pageCoords.len;
+    Rect* coords = pageCoords.coords;
 
     int glyphIx = FindClosestGlyph(this, pageNo, x, y);
     Point pt = ToPoint(PointF(x, y));
@@ -1,19 +1,108 @@
 /* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+struct TextSearchIndex;
+
+#define MAX_TEXT_EXTRACT_THREADS 4
+// max number of pages whose glyph coordinates are kept expanded to Rect
+#define MAX_MATERIALIZED_PAGES 32
+
+// glyphs following each other on the same line (i.e. with the same y and dy)
+struct GlyphRun {
+    int x = 0;
+    int y = 0;
+    int dy = 0;
+    int firstGlyph = 0;
+};
+
+// x is relative to the start of the glyph's run
+struct GlyphBox {
+    i16 x;
+    u16 dx;
+};
+
+// glyph coordinates of a page in 4 instead of 16 bytes per glyph.
+// pageText.coords is only set while the page is materialized
+struct PageGlyphs {
+    GlyphRun* runs = nullptr;
+    int nRuns = 0;
+    GlyphBox* boxes = nullptr;
+    // number of ScopedPageCoords using the materialized coords
+    int nUsers = 0;
+};
+
 struct DocumentTextCache {
     EngineBase* engine = nullptr;
     int nPages = 0;
+    // text is kept for all extracted pages, coords only for materialized ones
+    // (or for pages whose coordinates don't fit into PageGlyphs)
     PageText* pagesText = nullptr;
+    PageGlyphs* pagesGlyphs = nullptr;
+    // materialized pages, least recently used first
+    Vec<int> materializedPages;
+    // set while a thread extracts the text of a page (outside of access)
+    bool* isExtracting = nullptr;
+    int nPagesWithText = 0;
     int debugSize = 0;
 
+    // pages to be extracted by extractThreads, see ExtractPagesAsync()
+    Vec<int> pagesToExtract;
+    HANDLE extractThreads[MAX_TEXT_EXTRACT_THREADS]{};
+    int nExtractThreads = 0;
+    bool stopExtracting = false;
+    CONDITION_VARIABLE pagesQueued;
+    CONDITION_VARIABLE pageExtracted;
+
+    // persisted full-text index, loaded on first use or built
+    // once the text of all pages has been extracted
+    TextSearchIndex* index = nullptr;
+    char* indexPath = nullptr;
+    bool triedLoadingIndex = false;
+
     CRITICAL_SECTION access;
+    // serializes ExtractPageText() calls for engines not allowing concurrent ones
+    CRITICAL_SECTION extractAccess;
 
     explicit DocumentTextCache(EngineBase* engine);
     ~DocumentTextCache();
 
     bool HasTextForPage(int pageNo) const;
-    const WCHAR* GetTextForPage(int pageNo, int* lenOut = nullptr, Rect** coordsOut = nullptr);
+    // the text stays valid for the lifetime of the cache.
+    // use ScopedPageCoords for the coordinates of the glyphs
+    const WCHAR* GetTextForPage(int pageNo, int* lenOut = nullptr);
+    // expands the glyph coordinates of a page, which stay valid
+    // until the matching ReleaseCoordsForPage() call
+    Rect* GetCoordsForPage(int pageNo, int* lenOut = nullptr);
+    void ReleaseCoordsForPage(int pageNo);
+
+    // extracts the given pages on a pool of threads in the background
+    // (in the given order), replacing the pages queued by a previous call
+    void ExtractPagesAsync(const Vec<int>& pages);
+    // extracts pages firstPage through lastPage on a pool of threads
+    // and returns once the text of all of them is available
+    void ExtractPages(int firstPage, int lastPage);
+
+    // sets pagesToSkip for pages that can't contain s, if an index is available
+    // returns the number of pages that might contain s
+    int SkipPagesWithout(const WCHAR* s, Vec<bool>& pagesToSkip);
+    // extracts the text of all pages and replaces the persisted index
+    bool RebuildIndex();
+    // deletes the persisted index e.g. when it's out of date
+    void InvalidateIndex();
+};
+
+struct ScopedPageCoords {
+    DocumentTextCache* textCache = nullptr;
+    int pageNo = 0;
+    Rect* coords = nullptr;
+    int len = 0;
+
+    ScopedPageCoords(DocumentTextCache* textCache, int pageNo) : textCache(textCache), pageNo(pageNo) {
+        coords = textCache->GetCoordsForPage(pageNo, &len);
+    }
+    ~ScopedPageCoords() {
+        textCache->ReleaseCoordsForPage(pageNo);
+    }
 };
 
 // TODO: replace with Vec<TextSel>
@@ -30,6 +30,9 @@ struct WindowTab {
     Rect canvasRc;
     // whether to auto-reload the document when the tab is selected
     bool reloadOnFocus = false;
+    // whether to re-create the DisplayModel when the tab is selected because
+    // the engine has finished laying out the document (see DocLayoutFinished)
+    bool layoutFinishedOnFocus = false;
     // FileWatcher token for unsubscribing
     WatchedFile* watcher = nullptr;
     // list of rectangles of the last rectangular, text or image selection
@@ -156,6 +156,7 @@ void GraphicsCacheEntry::Free() const {
 
 void Initialize() {
     InitializeCriticalSection(&gMuiCs);
+    InitializeFreeTypeFonts();
     gGraphicsCache = new Vec<GraphicsCacheEntry>();
     // allocate the first entry in gGraphicsCache for UI thread, ref count
     // ensures it stays alive forever
@@ -169,6 +170,7 @@ void Destroy() {
     }
     delete gGraphicsCache;
     delete gFontsCache;
+    FreeFreeTypeFonts();
     DeleteCriticalSection(&gMuiCs);
 }
 
@@ -1,7 +1,12 @@
 /* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
    License: Simplified BSD (see COPYING.BSD) */
 
+extern "C" {
+#include <mupdf/fitz.h>
+}
+
 #include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
@@ -37,6 +42,8 @@ using Gdiplus::Status;
 using Gdiplus::StringFormat;
 using Gdiplus::StringFormatFlagsDirectionRightToLeft;
 
+extern "C" void install_load_windows_font_funcs(fz_context* ctx);
+
 namespace mui {
 
 TextRenderGdi* TextRenderGdi::Create(Graphics* gfx) {
@@ -477,6 +484,293 @@ TextRenderHdc::~TextRenderHdc() {
     DeleteDC(hdc);
 }
 
+// FreeType fonts are shared by all TextRenderFreeType instances.
+// gFtCs protects gFtCtx, gFtFaces and everything reachable from them,
+// so calls into mupdf are never made on more than one thread at a time.
+constexpr int kFtPageSize = 256;
+constexpr int kFtPages = 0x10000 / kFtPageSize; // covers the BMP
+
+struct FtFace {
+    FtFace* next = nullptr;
+    WCHAR* name = nullptr;
+    bool bold = false;
+    bool italic = false;
+    // nullptr if FreeType couldn't load the font
+    fz_font* font = nullptr;
+    float ascender = 0;
+    float descender = 0;
+    // advances (in em units) of BMP code points, allocated lazily
+    float* advances[kFtPages] = {};
+};
+
+static CRITICAL_SECTION gFtCs;
+static fz_context* gFtCtx = nullptr;
+static FtFace* gFtFaces = nullptr;
+
+struct FtFontMetrics {
+    CachedFont* font = nullptr;
+    FtFace* face = nullptr;
+    float emPx = 0;
+    float lineSpacing = 0;
+    // advances (in pixels) of BMP code points, allocated lazily
+    float* advances[kFtPages] = {};
+
+    ~FtFontMetrics() {
+        for (float* page : advances) {
+            free(page);
+        }
+    }
+};
+
+void InitializeFreeTypeFonts() {
+    InitializeCriticalSection(&gFtCs);
+}
+
+void FreeFreeTypeFonts() {
+    FtFace* face = gFtFaces;
+    while (face) {
+        FtFace* next = face->next;
+        if (face->font) {
+            fz_drop_font(gFtCtx, face->font);
+        }
+        for (float* page : face->advances) {
+            free(page);
+        }
+        str::Free(face->name);
+        delete face;
+        face = next;
+    }
+    gFtFaces = nullptr;
+    fz_drop_context(gFtCtx);
+    gFtCtx = nullptr;
+    DeleteCriticalSection(&gFtCs);
+}
+
+// must be called inside gFtCs
+static float FtGlyphAdvance(fz_font* font, int cp) {
+    float res = 0;
+    fz_try(gFtCtx) {
+        int gid = fz_encode_character(gFtCtx, font, cp);
+        if (gid == 0 && cp >= 0x2e80) {
+            // GDI would substitute a CJK font which has (mostly) square glyphs
+            res = 1.f;
+        } else {
+            res = fz_advance_glyph(gFtCtx, font, gid, 0);
+        }
+    }
+    fz_catch(gFtCtx) {
+        fz_report_error(gFtCtx);
+    }
+    return res;
+}
+
+static FtFace* FtGetFace(const WCHAR* name, FontStyle style) {
+    bool bold = (style & Gdiplus::FontStyleBold) != 0;
+    bool italic = (style & Gdiplus::FontStyleItalic) != 0;
+
+    ScopedCritSec cs(&gFtCs);
+    for (FtFace* face = gFtFaces; face; face = face->next) {
+        if (face->bold == bold && face->italic == italic && str::Eq(face->name, name)) {
+            return face;
+        }
+    }
+
+    if (!gFtCtx) {
+        gFtCtx = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+        if (gFtCtx) {
+            install_load_windows_font_funcs(gFtCtx);
+        }
+    }
+
+    FtFace* face = new FtFace();
+    face->name = str::Dup(name);
+    face->bold = bold;
+    face->italic = italic;
+    if (gFtCtx) {
+        // the system font loader matches e.g. "Georgia,Bold" to Georgia-Bold.ttf
+        TempStr fontName = ToUtf8Temp(name);
+        if (bold && italic) {
+            fontName = str::JoinTemp(fontName, ",BoldItalic");
+        } else if (bold) {
+            fontName = str::JoinTemp(fontName, ",Bold");
+        } else if (italic) {
+            fontName = str::JoinTemp(fontName, ",Italic");
+        }
+        face->font = fz_load_system_font(gFtCtx, fontName, bold, italic, 0);
+    }
+    if (face->font) {
+        face->ascender = fz_font_ascender(gFtCtx, face->font);
+        face->descender = fz_font_descender(gFtCtx, face->font);
+    }
+    ListInsertFront(&gFtFaces, face);
+    return face;
+}
+
+// returns advances (in em units) of the code points page * kFtPageSize ... page * kFtPageSize + kFtPageSize - 1
+// must be called inside gFtCs
+static float* FtGetFaceAdvancesPage(FtFace* face, int page) {
+    float* res = face->advances[page];
+    if (res) {
+        return res;
+    }
+    res = AllocArray<float>(kFtPageSize);
+    int cp = page * kFtPageSize;
+    for (int i = 0; i < kFtPageSize; i++) {
+        res[i] = FtGlyphAdvance(face->font, cp + i);
+    }
+    face->advances[page] = res;
+    return res;
+}
+
+TextRenderFreeType* TextRenderFreeType::Create(Graphics* gfx) {
+    TextRenderFreeType* res = new TextRenderFreeType();
+    res->gfx = gfx;
+    if (gfx) {
+        res->gdiplus = TextRenderGdiplus::Create(gfx, MeasureTextQuick);
+    }
+    // default to red to make mistakes stand out
+    res->SetTextColor(Color(0xff, 0xff, 0x0, 0x0));
+    return res;
+}
+
+TextRenderFreeType::~TextRenderFreeType() {
+    DeleteVecMembers(fontMetrics);
+    delete textColorBrush;
+    delete gdiplus;
+}
+
+void TextRenderFreeType::SetFont(CachedFont* font) {
+    if (currFont == font) {
+        return;
+    }
+    currFont = font;
+    if (gdiplus) {
+        gdiplus->SetFont(font);
+    }
+    for (FtFontMetrics* m : fontMetrics) {
+        if (m->font == font) {
+            currMetrics = m;
+            return;
+        }
+    }
+
+    FtFontMetrics* m = new FtFontMetrics();
+    m->font = font;
+    m->face = FtGetFace(font->GetName(), font->GetStyle());
+    float dpi = gfx ? gfx->GetDpiY() : 96.f;
+    m->emPx = font->GetSize() * dpi / 72.f;
+    if (gfx) {
+        // same as other ITextRender implementations so that the layout matches
+        m->lineSpacing = font->font->GetHeight(gfx);
+    } else {
+        m->lineSpacing = (m->face->ascender - m->face->descender) * m->emPx;
+    }
+    fontMetrics.Append(m);
+    currMetrics = m;
+}
+
+void TextRenderFreeType::SetTextColor(Gdiplus::Color col) {
+    if (gdiplus) {
+        gdiplus->SetTextColor(col);
+    }
+    if (textColor.GetValue() == col.GetValue()) {
+        return;
+    }
+    textColor = col;
+    delete textColorBrush;
+    textColorBrush = new SolidBrush(col);
+}
+
+float TextRenderFreeType::GetCurrFontLineSpacing() {
+    ReportIf(!currMetrics);
+    return currMetrics->lineSpacing;
+}
+
+float* TextRenderFreeType::GetAdvancesPage(int page) {
+    FtFontMetrics* m = currMetrics;
+    float* res = AllocArray<float>(kFtPageSize);
+    {
+        ScopedCritSec cs(&gFtCs);
+        float* em = FtGetFaceAdvancesPage(m->face, page);
+        for (int i = 0; i < kFtPageSize; i++) {
+            res[i] = em[i] * m->emPx;
+        }
+    }
+    m->advances[page] = res;
+    return res;
+}
+
+RectF TextRenderFreeType::Measure(const WCHAR* s, size_t sLen) {
+    ReportIf(!currMetrics);
+    FtFontMetrics* m = currMetrics;
+    if (!m->face->font) {
+        if (gdiplus) {
+            // GDI+ objects mustn't be used by several threads at once and
+            // the CachedFont is shared by all formatters (the Graphics isn't)
+            ScopedCritSec cs(&gFtCs);
+            return gdiplus->Measure(s, sLen);
+        }
+        // a rough guess is the best we can do
+        return RectF(0.f, 0.f, (float)sLen * m->emPx / 2.f, m->lineSpacing);
+    }
+
+    float dx = 0;
+    for (size_t i = 0; i < sLen; i++) {
+        WCHAR c = s[i];
+        if (IS_HIGH_SURROGATE(c) && i + 1 < sLen && IS_LOW_SURROGATE(s[i + 1])) {
+            int cp = 0x10000 + (((int)c - 0xd800) << 10) + ((int)s[i + 1] - 0xdc00);
+            i++;
+            ScopedCritSec cs(&gFtCs);
+            dx += FtGlyphAdvance(m->face->font, cp) * m->emPx;
+            continue;
+        }
+        int page = c / kFtPageSize;
+        float* advances = m->advances[page];
+        if (!advances) {
+            advances = GetAdvancesPage(page);
+        }
+        dx += advances[c % kFtPageSize];
+    }
+    return RectF(0.f, 0.f, dx, m->lineSpacing);
+}
+
+RectF TextRenderFreeType::Measure(const char* s, size_t sLen) {
+    WCHAR* buf = ToWStrTemp(s, sLen);
+    size_t strLen = str::Len(buf);
+    return Measure(buf, strLen);
+}
+
+// text is drawn by GDI+ with the font FreeType has measured. Grid fitting would
+// change the glyph advances and the default format adds padding, so with both
+// turned off the drawn text should be within rounding of the measured width
+void TextRenderFreeType::Draw(const WCHAR* s, size_t sLen, const RectF bb, bool isRtl) {
+    ReportIf(!gdiplus || !currMetrics);
+    if (!gdiplus || !currMetrics) {
+        return;
+    }
+    if (!currMetrics->face->font) {
+        // measured by gdiplus as well
+        gdiplus->Draw(s, sLen, bb, isRtl);
+        return;
+    }
+    StringFormat sf(StringFormat::GenericTypographic());
+    Gdiplus::PointF pos = ToGdipPointF(bb.TL());
+    if (isRtl) {
+        sf.SetFormatFlags(sf.GetFormatFlags() | StringFormatFlagsDirectionRightToLeft);
+        pos.X += bb.dx;
+    }
+    Gdiplus::TextRenderingHint hint = gfx->GetTextRenderingHint();
+    gfx->SetTextRenderingHint(Gdiplus::TextRenderingHintAntiAlias);
+    gfx->DrawString(s, (INT)sLen, currFont->font, pos, &sf, textColorBrush);
+    gfx->SetTextRenderingHint(hint);
+}
+
+void TextRenderFreeType::Draw(const char* s, size_t sLen, const RectF bb, bool isRtl) {
+    WCHAR* buf = ToWStrTemp(s, sLen);
+    size_t strLen = str::Len(buf);
+    Draw(buf, strLen, bb, isRtl);
+}
+
 ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, int dy) {
     ITextRender* res = nullptr;
     if (TextRenderMethod::Gdiplus == method) {
@@ -491,6 +785,9 @@ ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, in
     if (TextRenderMethod::Hdc == method) {
         res = TextRenderHdc::Create(gfx, dx, dy);
     }
+    if (TextRenderMethod::FreeType == method) {
+        res = TextRenderFreeType::Create(gfx);
+    }
     ReportIf(!res);
     if (res) {
         res->method = method;
@@ -6,6 +6,7 @@ enum class TextRenderMethod {
     GdiplusQuick, // uses MeasureTextQuick
     Gdi,
     Hdc,
+    FreeType, // measures with cached FreeType glyph advances, draws with GDI+
     // TODO: implement TextRenderDirectDraw
     // TextRenderDirectDraw
 };
@@ -168,6 +169,57 @@ class TextRenderHdc : public ITextRender {
     ~TextRenderHdc() override;
 };
 
+struct FtFontMetrics;
+
+// Measures text by summing FreeType glyph advances (loaded through mupdf's
+// fz_font) instead of asking GDI / GDI+. Advances are cached per font in
+// pages of 256 code points so measuring is a table lookup per character
+// and doesn't need a HDC or Graphics (gfx can be nullptr if Draw() isn't used).
+// There's no shaping (kerning, ligatures), same as GetTextExtentPoint32.
+// Drawing is delegated to TextRenderGdiplus.
+class TextRenderFreeType : public ITextRender {
+  private:
+    // We don't own gfx and currFont
+    Gdiplus::Graphics* gfx = nullptr;
+    CachedFont* currFont = nullptr;
+    FtFontMetrics* currMetrics = nullptr;
+    Vec<FtFontMetrics*> fontMetrics;
+    Gdiplus::Color textColor{};
+    Gdiplus::Brush* textColorBrush = nullptr;
+    // measures and draws fonts FreeType can't load
+    TextRenderGdiplus* gdiplus = nullptr;
+
+    TextRenderFreeType() = default;
+
+    float* GetAdvancesPage(int page);
+
+  public:
+    static TextRenderFreeType* Create(Gdiplus::Graphics* gfx);
+
+    void SetFont(CachedFont* font) override;
+    void SetTextColor(Gdiplus::Color col) override;
+    void SetTextBgColor(Gdiplus::Color) override {
+    }
+
+    float GetCurrFontLineSpacing() override;
+
+    RectF Measure(const char* s, size_t sLen) override;
+    RectF Measure(const WCHAR* s, size_t sLen) override;
+
+    void Lock() override {
+    }
+    void Unlock() override {
+    }
+
+    void Draw(const char* s, size_t sLen, RectF bb, bool isRtl) override;
+    void Draw(const WCHAR* s, size_t sLen, RectF bb, bool isRtl) override;
+
+    ~TextRenderFreeType() override;
+};
+
+void InitializeFreeTypeFonts();
+void FreeFreeTypeFonts();
+
 ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, int dy);
 
 size_t StringLenForWidth(ITextRender* textMeasure, const WCHAR* s, size_t len, float dx);
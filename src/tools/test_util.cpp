@@ -23,6 +23,8 @@ extern void SettingsUtilTest();
 extern void SimpleLogTest();
 extern void SquareTreeTest();
 extern void StrFormatTest();
+extern void StrSearchBench();
+extern void StrSearchTest();
 extern void StrTest();
 extern void TrivialHtmlParser_UnitTests();
 extern void VecTest();
@@ -30,10 +32,15 @@ extern void WinUtilTest();
 extern void StrFormatTest();
 extern void StrVecTest();
 
-int main(int, char**) {
-    printf("Running unit tests\n");
-
+int main(int argc, char** argv) {
     InitDynCalls();
+    if (argc > 1 && str::Eq(argv[1], "-bench")) {
+        StrSearchBench();
+        DestroyTempAllocator();
+        return 0;
+    }
+
+    printf("Running unit tests\n");
     BaseUtilTest();
     ByteOrderTests();
     CryptoUtilTest();
@@ -47,6 +54,7 @@ int main(int, char**) {
     SimpleLogTest();
     SquareTreeTest();
     StrFormatTest();
+    StrSearchTest();
     StrTest();
     StrVecTest();
     TrivialHtmlParser_UnitTests();
@@ -6,6 +6,9 @@
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/CryptoUtil.h"
+#include "utils/Log.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Timer.h"
 
 #include "utils/Archive.h"
 
@@ -21,6 +24,64 @@ extern "C" {
 // 3 is for absolute worst case of WCHAR* where last char was partially written
 #define ZERO_PADDING_COUNT 3
 
+// files of a solid archive, uncompressed by a background thread in a single
+// sequential pass. Up to kSolidCacheMaxMem bytes are kept in memory, the
+// rest is spilled to a temporary file
+constexpr size_t kSolidCacheMaxMem = 256 * 1024 * 1024;
+
+struct SolidDecodeCache {
+    CRITICAL_SECTION access;
+    CONDITION_VARIABLE fileDecoded;
+
+    archive_opener_t opener = nullptr;
+    WCHAR* archivePath = nullptr;
+    bool useUnrarDll = false;
+    Vec<size_t> fileSizes;
+
+    // files are decoded in order so data for fileId < nDecoded is final
+    size_t nDecoded = 0;
+    bool finished = false;
+    bool stop = false;
+
+    // a file is either in memory or at spillPos in spillFile
+    // (or neither if it couldn't be uncompressed)
+    Vec<u8*> data;
+    Vec<i64> spillPos;
+    // only accessed by the decoding thread
+    size_t memSize = 0;
+    i64 spillSize = 0;
+    bool spillFailed = false;
+    HANDLE spillFile = INVALID_HANDLE_VALUE;
+
+    HANDLE thread = nullptr;
+
+    SolidDecodeCache();
+    ~SolidDecodeCache();
+};
+
+SolidDecodeCache::SolidDecodeCache() {
+    InitializeCriticalSection(&access);
+    InitializeConditionVariable(&fileDecoded);
+}
+
+SolidDecodeCache::~SolidDecodeCache() {
+    EnterCriticalSection(&access);
+    stop = true;
+    LeaveCriticalSection(&access);
+    if (thread) {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+    for (u8* d : data) {
+        free(d);
+    }
+    if (spillFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(spillFile);
+    }
+    str::Free(archivePath);
+    DeleteCriticalSection(&access);
+}
+
 FILETIME MultiFormatArchive::FileInfo::GetWinFileTime() const {
     FILETIME ft = {(DWORD)-1, (DWORD)-1};
     LocalFileTimeToFileTime((FILETIME*)&fileTime, &ft);
@@ -45,6 +106,9 @@ bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
             return true;
         }
     }
+    if (archivePath) {
+        archivePath_ = str::Dup(&allocator_, archivePath);
+    }
     ar_ = opener_(data);
     if (!ar_ || ar_at_eof(ar_)) {
         if (format == Format::Rar && archivePath) {
@@ -67,6 +131,9 @@ bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
         i->name = str::Dup(&allocator_, name);
         i->data = nullptr;
         fileInfos_.Append(i);
+        if (ar_entry_is_solid(ar_)) {
+            isSolid = true;
+        }
         // doesn't benchmark faster for .zip files but not much slower either
         // is probably faster for .tar.gz files
         if (loadOnOpen) {
@@ -87,6 +154,7 @@ bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
 }
 
 MultiFormatArchive::~MultiFormatArchive() {
+    delete solidCache_;
     ar_close_archive(ar_);
     ar_close(data_);
     for (auto& fi : fileInfos_) {
@@ -133,6 +201,11 @@ ByteSlice MultiFormatArchive::GetFileDataById(size_t fileId) {
         return res;
     }
 
+    ByteSlice cached;
+    if (GetFileDataFromSolidCache(fileId, fileInfo->fileSizeUncompressed, true, cached)) {
+        return cached;
+    }
+
     if (LoadedUsingUnrarDll()) {
         return GetFileDataByIdUnarrDll(fileId);
     }
@@ -160,6 +233,58 @@ ByteSlice MultiFormatArchive::GetFileDataById(size_t fileId) {
     return {data, size};
 }
 
+ByteSlice MultiFormatArchive::GetFileDataPartById(size_t fileId, size_t maxSize) {
+    if (fileId == (size_t)-1) {
+        return {};
+    }
+    ReportIf(fileId >= fileInfos_.size());
+
+    auto* fileInfo = fileInfos_[fileId];
+    ReportIf(fileInfo->fileId != fileId);
+
+    size_t size = std::min(fileInfo->fileSizeUncompressed, maxSize);
+    if (fileInfo->data != nullptr) {
+        // unlike GetFileDataById, fileInfo keeps ownership of the data
+        u8* data = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+        if (!data) {
+            return {};
+        }
+        memcpy(data, fileInfo->data, size);
+        return {data, size};
+    }
+
+    // a header is read directly if the background thread hasn't reached
+    // the file yet, so that probing image sizes doesn't wait for it
+    ByteSlice cached;
+    if (GetFileDataFromSolidCache(fileId, maxSize, false, cached)) {
+        return cached;
+    }
+
+    if (LoadedUsingUnrarDll()) {
+        // unrar.dll can only extract whole files
+        return GetFileDataByIdUnarrDll(fileId);
+    }
+
+    if (!ar_) {
+        return {};
+    }
+
+    // ar_entry_uncompress() can be called with less than the full
+    // uncompressed size and will stop inflating after size bytes
+    if (!ar_parse_entry_at(ar_, fileInfo->filePos)) {
+        return {};
+    }
+    u8* data = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+    if (!data) {
+        return {};
+    }
+    if (!ar_entry_uncompress(ar_, data, size)) {
+        free(data);
+        return {};
+    }
+    return {data, size};
+}
+
 const char* MultiFormatArchive::GetComment() {
     if (!ar_) {
         return nullptr;
@@ -385,6 +510,7 @@ bool MultiFormatArchive::OpenUnrarFallback(const char* rarPath) {
     if (!hArc || arcData.OpenResult != 0) {
         return false;
     }
+    isSolid = (arcData.Flags & ROADF_SOLID) != 0;
 
     size_t fileId = 0;
     while (true) {
@@ -425,3 +551,217 @@ bool MultiFormatArchive::OpenUnrarFallback(const char* rarPath) {
     rarFilePath_ = str::Dup(&allocator_, rarPath);
     return true;
 }
+
+///// background decoding of solid archives /////
+
+static bool SolidCacheShouldStop(SolidDecodeCache* cache) {
+    ScopedCritSec scope(&cache->access);
+    return cache->stop;
+}
+
+// returns position in the spill file or -1 on failure
+static i64 SolidCacheSpill(SolidDecodeCache* cache, const u8* data, size_t size) {
+    if (cache->spillFailed || size > (size_t)(DWORD)-1) {
+        return -1;
+    }
+    if (cache->spillFile == INVALID_HANDLE_VALUE) {
+        TempStr path = GetTempFilePathTemp("SumSolid");
+        DWORD flags = FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE;
+        if (path) {
+            cache->spillFile =
+                CreateFileW(ToWStrTemp(path), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, flags, nullptr);
+        }
+        if (cache->spillFile == INVALID_HANDLE_VALUE) {
+            cache->spillFailed = true;
+            return -1;
+        }
+    }
+    i64 pos = cache->spillSize;
+    OVERLAPPED ov{};
+    ov.Offset = (DWORD)pos;
+    ov.OffsetHigh = (DWORD)(pos >> 32);
+    DWORD nWritten = 0;
+    BOOL ok = WriteFile(cache->spillFile, data, (DWORD)size, &nWritten, &ov);
+    if (!ok || nWritten != size) {
+        return -1;
+    }
+    cache->spillSize += size;
+    return pos;
+}
+
+// data is nullptr if the file couldn't be uncompressed
+static void SolidCacheAddFile(SolidDecodeCache* cache, size_t fileId, u8* data, size_t size) {
+    i64 spillPos = -1;
+    if (data && cache->memSize + size > kSolidCacheMaxMem) {
+        spillPos = SolidCacheSpill(cache, data, size);
+        free(data);
+        data = nullptr;
+    }
+    if (data) {
+        cache->memSize += size;
+    }
+
+    ScopedCritSec scope(&cache->access);
+    cache->data[fileId] = data;
+    cache->spillPos[fileId] = spillPos;
+    cache->nDecoded = fileId + 1;
+    WakeAllConditionVariable(&cache->fileDecoded);
+}
+
+static void SolidDecodeWithUnarr(SolidDecodeCache* cache) {
+    ar_stream* stm = ar_open_file_w(cache->archivePath);
+    ar_archive* ar = stm ? cache->opener(stm) : nullptr;
+    size_t nFiles = cache->fileSizes.size();
+    // entries are parsed in the same order as in MultiFormatArchive::Open()
+    for (size_t fileId = 0; ar && fileId < nFiles && ar_parse_entry(ar); fileId++) {
+        if (SolidCacheShouldStop(cache)) {
+            break;
+        }
+        size_t size = ar_entry_get_size(ar);
+        u8* data = nullptr;
+        if (size == cache->fileSizes[fileId] && !addOverflows<size_t>(size, ZERO_PADDING_COUNT)) {
+            data = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+        }
+        if (data && !ar_entry_uncompress(ar, data, size)) {
+            free(data);
+            data = nullptr;
+        }
+        SolidCacheAddFile(cache, fileId, data, size);
+    }
+    ar_close_archive(ar);
+    ar_close(stm);
+}
+
+static void SolidDecodeWithUnrarDll(SolidDecodeCache* cache) {
+    Data uncompressedBuf;
+
+    RAROpenArchiveDataEx arcData = {nullptr};
+    arcData.ArcNameW = cache->archivePath;
+    arcData.OpenMode = RAR_OM_EXTRACT;
+    arcData.Callback = unrarCallback;
+    arcData.UserData = (LPARAM)&uncompressedBuf;
+
+    HANDLE hArc = RAROpenArchiveEx(&arcData);
+    if (!hArc || arcData.OpenResult != 0) {
+        return;
+    }
+
+    size_t nFiles = cache->fileSizes.size();
+    // headers are read in the same order as in MultiFormatArchive::OpenUnrarFallback()
+    for (size_t fileId = 0; fileId < nFiles; fileId++) {
+        if (SolidCacheShouldStop(cache)) {
+            break;
+        }
+        RARHeaderDataEx rarHeader{};
+        if (0 != RARReadHeaderEx(hArc, &rarHeader)) {
+            break;
+        }
+        size_t size = cache->fileSizes[fileId];
+        u8* data = nullptr;
+        if (size == rarHeader.UnpSize && rarHeader.UnpSizeHigh == 0 &&
+            !addOverflows<size_t>(size, ZERO_PADDING_COUNT)) {
+            data = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+        }
+        uncompressedBuf.d = data;
+        uncompressedBuf.curr = data;
+        uncompressedBuf.sz = data ? size : 0;
+        int res = RARProcessFile(hArc, data ? RAR_TEST : RAR_SKIP, nullptr, nullptr);
+        if (data && (res != 0 || DataLeft(uncompressedBuf) != 0)) {
+            free(data);
+            data = nullptr;
+        }
+        SolidCacheAddFile(cache, fileId, data, size);
+    }
+
+    RARCloseArchive(hArc);
+}
+
+static void SolidDecodeThread(SolidDecodeCache* cache) {
+    auto timeStart = TimeGet();
+    if (cache->useUnrarDll) {
+        SolidDecodeWithUnrarDll(cache);
+    } else {
+        SolidDecodeWithUnarr(cache);
+    }
+
+    ScopedCritSec scope(&cache->access);
+    logf("SolidDecodeThread: decoded %d files in %.2f ms\n", (int)cache->nDecoded, TimeSinceInMs(timeStart));
+    cache->finished = true;
+    WakeAllConditionVariable(&cache->fileDecoded);
+}
+
+void MultiFormatArchive::DecodeSolidInBackground() {
+    if (!isSolid || loadOnOpen || solidCache_) {
+        return;
+    }
+    // we need to open the archive again so that the background thread
+    // doesn't interfere with ar_, which is not possible for IStream
+    const char* path = LoadedUsingUnrarDll() ? rarFilePath_ : archivePath_;
+    if (!path) {
+        return;
+    }
+
+    auto* cache = new SolidDecodeCache();
+    cache->opener = opener_;
+    cache->archivePath = ToWStr(path);
+    cache->useUnrarDll = LoadedUsingUnrarDll();
+    for (auto* fi : fileInfos_) {
+        cache->fileSizes.Append(fi->fileSizeUncompressed);
+        cache->data.Append(nullptr);
+        cache->spillPos.Append(-1);
+    }
+    auto fn = MkFunc0<SolidDecodeCache>(SolidDecodeThread, cache);
+    cache->thread = StartThread(fn, "SolidDecodeThread");
+    if (!cache->thread) {
+        delete cache;
+        return;
+    }
+    solidCache_ = cache;
+}
+
+// returns false if the file has to be read from the archive
+// if wait is false, doesn't wait for the background thread to reach fileId
+bool MultiFormatArchive::GetFileDataFromSolidCache(size_t fileId, size_t maxSize, bool wait, ByteSlice& dataOut) {
+    auto* cache = solidCache_;
+    if (!cache) {
+        return false;
+    }
+
+    ScopedCritSec scope(&cache->access);
+    // uncompressing from the start of the solid block wouldn't be
+    // faster than waiting for the background thread to reach this file
+    while (wait && !cache->finished && fileId >= cache->nDecoded) {
+        SleepConditionVariableCS(&cache->fileDecoded, &cache->access, INFINITE);
+    }
+    if (fileId >= cache->nDecoded) {
+        return false;
+    }
+    u8* data = cache->data[fileId];
+    i64 spillPos = cache->spillPos[fileId];
+    if (!data && spillPos < 0) {
+        return false;
+    }
+
+    size_t size = std::min(cache->fileSizes[fileId], maxSize);
+    u8* res = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+    if (!res) {
+        return false;
+    }
+    if (data) {
+        memcpy(res, data, size);
+        dataOut = {res, size};
+        return true;
+    }
+
+    OVERLAPPED ov{};
+    ov.Offset = (DWORD)spillPos;
+    ov.OffsetHigh = (DWORD)(spillPos >> 32);
+    DWORD nRead = 0;
+    BOOL ok = ReadFile(cache->spillFile, res, (DWORD)size, &nRead, &ov);
+    if (!ok || nRead != size) {
+        free(res);
+        return false;
+    }
+    dataOut = {res, size};
+    return true;
+}
@@ -8,6 +8,8 @@ typedef struct ar_archive_s ar_archive;
 
 typedef ar_archive* (*archive_opener_t)(ar_stream*);
 
+struct SolidDecodeCache;
+
 class MultiFormatArchive {
   public:
     enum class Format { Zip, Rar, SevenZip, Tar };
@@ -38,12 +40,23 @@ class MultiFormatArchive {
 
     ByteSlice GetFileDataByName(const char* filename);
     ByteSlice GetFileDataById(size_t fileId);
+    // returns at most maxSize bytes from the start of the file, without
+    // uncompressing the rest (e.g. enough to read the header of an image)
+    ByteSlice GetFileDataPartById(size_t fileId, size_t maxSize);
 
     const char* GetComment();
 
+    // for solid archives, uncompresses all files in a single sequential pass
+    // on a background thread (random access would have to restart
+    // decompression at the start of the solid block for every file)
+    void DecodeSolidInBackground();
+
     // if true, will load and uncompress all files on open
     bool loadOnOpen = false;
 
+    // true if at least one file is part of a solid block
+    bool isSolid = false;
+
   protected:
     // used for allocating strings that are referenced by ArchFileInfo::name
     PoolAllocator allocator_;
@@ -52,12 +65,16 @@ class MultiFormatArchive {
     archive_opener_t opener_ = nullptr;
     ar_stream* data_ = nullptr;
     ar_archive* ar_ = nullptr;
+    // only set when opened from a file
+    const char* archivePath_ = nullptr;
+    SolidDecodeCache* solidCache_ = nullptr;
 
     // only set when we loaded file infos using unrar.dll fallback
     const char* rarFilePath_ = nullptr;
 
     bool OpenUnrarFallback(const char* rarPathUtf);
     ByteSlice GetFileDataByIdUnarrDll(size_t fileId);
+    bool GetFileDataFromSolidCache(size_t fileId, size_t maxSize, bool wait, ByteSlice& dataOut);
     bool LoadedUsingUnrarDll() const {
         return rarFilePath_ != nullptr;
     }
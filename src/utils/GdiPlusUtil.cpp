@@ -122,8 +122,9 @@ RectF MeasureTextStandard(Graphics* g, Font* f, const WCHAR* s, int len) {
 RectF MeasureTextQuick(Graphics* g, Font* f, const WCHAR* s, int len) {
     ReportIf(0 >= len);
 
-    static Vec<Font*> fontCache;
-    static Vec<bool> fixCache;
+    // per thread, as ebooks are laid out on several threads at once
+    thread_local static Vec<Font*> fontCache;
+    thread_local static Vec<bool> fixCache;
 
     Gdiplus::RectF bbox;
     g->MeasureString(s, len, f, Gdiplus::PointF(0, 0), &bbox);
@@ -593,7 +594,9 @@ static bool AvifSizeFromData(ByteReader r, Size& result) {
 }
 
 // adapted from http://cpansearch.perl.org/src/RJRAY/Image-Size-3.230/lib/Image/Size.pm
-Size BitmapSizeFromData(const ByteSlice& d) {
+// only parses the header, so d can be just the beginning of the image file
+// returns empty size if the size can't be determined that way
+Size BitmapSizeFromHeader(const ByteSlice& d) {
     Size result;
     bool ok = false;
     Kind kind = GuessFileTypeFromContent(d);
@@ -621,6 +624,14 @@ Size BitmapSizeFromData(const ByteSlice& d) {
     if (ok && !result.IsEmpty()) {
         return result;
     }
+    return {};
+}
+
+Size BitmapSizeFromData(const ByteSlice& d) {
+    Size result = BitmapSizeFromHeader(d);
+    if (!result.IsEmpty()) {
+        return result;
+    }
 
     // try expensive way of getting the info by decoding the image
     // (currently happens for animated GIF)
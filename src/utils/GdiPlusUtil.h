@@ -20,6 +20,7 @@ RectF MeasureText(Gdiplus::Graphics* g, Gdiplus::Font* f, const WCHAR* s, size_t
 void GetBaseTransform(Gdiplus::Matrix& m, Gdiplus::RectF pageRect, float zoom, int rotation);
 
 Gdiplus::Bitmap* BitmapFromDataWin(const ByteSlice& bmpData);
+Size BitmapSizeFromHeader(const ByteSlice&);
 Size BitmapSizeFromData(const ByteSlice&);
 CLSID GetEncoderClsid(const WCHAR* format);
 RenderedBitmap* LoadRenderedBitmapWin(const char* path);
@@ -0,0 +1,272 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/StrSearch.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#define STR_SEARCH_X86 1
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+// clang only allows intrinsics in functions compiled for the instruction set
+// while msvc allows them anywhere (we only call them after checking cpuid)
+#if defined(STR_SEARCH_X86) && defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_XSAVE __attribute__((target("xsave")))
+#else
+#define TARGET_AVX2
+#define TARGET_XSAVE
+#endif
+
+namespace str {
+
+void FoldCaseInPlace(WCHAR* s, int len) {
+    if (len > 0) {
+        CharLowerBuffW(s, (DWORD)len);
+    }
+}
+
+static bool IsMatchAt(const WCHAR* s, int len, int pos, const WCHAR* toFind, int toFindLen, const FindOptions* opts) {
+    if (memcmp(s + pos, toFind, toFindLen * sizeof(WCHAR)) != 0) {
+        return false;
+    }
+    if (!opts || !opts->isWordChar) {
+        return true;
+    }
+    auto isWordChar = opts->isWordChar;
+    if (opts->wordStart && pos > 0 && isWordChar(s[pos - 1]) && isWordChar(s[pos])) {
+        return false;
+    }
+    int end = pos + toFindLen;
+    if (opts->wordEnd && end < len && isWordChar(s[end - 1]) && isWordChar(s[end])) {
+        return false;
+    }
+    return true;
+}
+
+// the kernels below check start positions pos to lastStart (resp. the other way
+// round), callers make sure that s[lastStart + toFindLen - 1] is within s
+
+static int FindScalar(const WCHAR* s, int len, int pos, int lastStart, const WCHAR* toFind, int toFindLen,
+                      const FindOptions* opts) {
+    WCHAR first = toFind[0];
+    for (; pos <= lastStart; pos++) {
+        if (s[pos] == first && IsMatchAt(s, len, pos, toFind, toFindLen, opts)) {
+            return pos;
+        }
+    }
+    return -1;
+}
+
+static int FindLastScalar(const WCHAR* s, int len, int lastStart, const WCHAR* toFind, int toFindLen,
+                          const FindOptions* opts) {
+    WCHAR first = toFind[0];
+    for (int pos = lastStart; pos >= 0; pos--) {
+        if (s[pos] == first && IsMatchAt(s, len, pos, toFind, toFindLen, opts)) {
+            return pos;
+        }
+    }
+    return -1;
+}
+
+#if defined(STR_SEARCH_X86)
+
+// compares the first and last char of toFind against 8 (resp. 16 for AVX2)
+// start positions at once and only does a full comparison for candidates
+// where both match. movemask returns 2 bits per 16-bit char
+
+static int FindSse2(const WCHAR* s, int len, int pos, int lastStart, const WCHAR* toFind, int toFindLen,
+                    const FindOptions* opts) {
+    const __m128i first = _mm_set1_epi16((short)toFind[0]);
+    const __m128i last = _mm_set1_epi16((short)toFind[toFindLen - 1]);
+    for (; pos + 7 <= lastStart; pos += 8) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i*)(s + pos));
+        __m128i blockLast = _mm_loadu_si128((const __m128i*)(s + pos + toFindLen - 1));
+        __m128i eq = _mm_and_si128(_mm_cmpeq_epi16(first, blockFirst), _mm_cmpeq_epi16(last, blockLast));
+        u32 mask = (u32)_mm_movemask_epi8(eq);
+        while (mask != 0) {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            int candidate = pos + (int)(bit / 2);
+            if (IsMatchAt(s, len, candidate, toFind, toFindLen, opts)) {
+                return candidate;
+            }
+            mask &= ~(3u << bit);
+        }
+    }
+    return FindScalar(s, len, pos, lastStart, toFind, toFindLen, opts);
+}
+
+static int FindLastSse2(const WCHAR* s, int len, int lastStart, const WCHAR* toFind, int toFindLen,
+                        const FindOptions* opts) {
+    const __m128i first = _mm_set1_epi16((short)toFind[0]);
+    const __m128i last = _mm_set1_epi16((short)toFind[toFindLen - 1]);
+    int pos = lastStart - 7;
+    for (; pos >= 0; pos -= 8) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i*)(s + pos));
+        __m128i blockLast = _mm_loadu_si128((const __m128i*)(s + pos + toFindLen - 1));
+        __m128i eq = _mm_and_si128(_mm_cmpeq_epi16(first, blockFirst), _mm_cmpeq_epi16(last, blockLast));
+        u32 mask = (u32)_mm_movemask_epi8(eq);
+        while (mask != 0) {
+            unsigned long bit;
+            _BitScanReverse(&bit, mask);
+            int candidate = pos + (int)(bit / 2);
+            if (IsMatchAt(s, len, candidate, toFind, toFindLen, opts)) {
+                return candidate;
+            }
+            mask &= ~(3u << (bit & ~1u));
+        }
+    }
+    return FindLastScalar(s, len, pos + 7, toFind, toFindLen, opts);
+}
+
+TARGET_AVX2 static int FindAvx2(const WCHAR* s, int len, int pos, int lastStart, const WCHAR* toFind, int toFindLen,
+                                const FindOptions* opts) {
+    const __m256i first = _mm256_set1_epi16((short)toFind[0]);
+    const __m256i last = _mm256_set1_epi16((short)toFind[toFindLen - 1]);
+    for (; pos + 15 <= lastStart; pos += 16) {
+        __m256i blockFirst = _mm256_loadu_si256((const __m256i*)(s + pos));
+        __m256i blockLast = _mm256_loadu_si256((const __m256i*)(s + pos + toFindLen - 1));
+        __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi16(first, blockFirst), _mm256_cmpeq_epi16(last, blockLast));
+        u32 mask = (u32)_mm256_movemask_epi8(eq);
+        while (mask != 0) {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            int candidate = pos + (int)(bit / 2);
+            if (IsMatchAt(s, len, candidate, toFind, toFindLen, opts)) {
+                return candidate;
+            }
+            mask &= ~(3u << bit);
+        }
+    }
+    return FindSse2(s, len, pos, lastStart, toFind, toFindLen, opts);
+}
+
+TARGET_AVX2 static int FindLastAvx2(const WCHAR* s, int len, int lastStart, const WCHAR* toFind, int toFindLen,
+                                    const FindOptions* opts) {
+    const __m256i first = _mm256_set1_epi16((short)toFind[0]);
+    const __m256i last = _mm256_set1_epi16((short)toFind[toFindLen - 1]);
+    int pos = lastStart - 15;
+    for (; pos >= 0; pos -= 16) {
+        __m256i blockFirst = _mm256_loadu_si256((const __m256i*)(s + pos));
+        __m256i blockLast = _mm256_loadu_si256((const __m256i*)(s + pos + toFindLen - 1));
+        __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi16(first, blockFirst), _mm256_cmpeq_epi16(last, blockLast));
+        u32 mask = (u32)_mm256_movemask_epi8(eq);
+        while (mask != 0) {
+            unsigned long bit;
+            _BitScanReverse(&bit, mask);
+            int candidate = pos + (int)(bit / 2);
+            if (IsMatchAt(s, len, candidate, toFind, toFindLen, opts)) {
+                return candidate;
+            }
+            mask &= ~(3u << (bit & ~1u));
+        }
+    }
+    return FindLastSse2(s, len, pos + 15, toFind, toFindLen, opts);
+}
+
+TARGET_XSAVE static bool CpuSupportsAvx2() {
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool hasOsxsave = (info[2] & (1 << 27)) != 0;
+    bool hasAvx = (info[2] & (1 << 28)) != 0;
+    if (!hasOsxsave || !hasAvx) {
+        return false;
+    }
+    // the os must preserve ymm registers across context switches
+    if ((_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+#endif
+
+bool IsFindImplSupported(FindImpl impl) {
+    switch (impl) {
+        case FindImpl::Best:
+        case FindImpl::Scalar:
+            return true;
+#if defined(STR_SEARCH_X86)
+        case FindImpl::Sse2:
+            // all cpus we run on have SSE2
+            return true;
+        case FindImpl::Avx2: {
+            static int hasAvx2 = -1;
+            if (hasAvx2 < 0) {
+                hasAvx2 = CpuSupportsAvx2() ? 1 : 0;
+            }
+            return hasAvx2 == 1;
+        }
+#endif
+        default:
+            return false;
+    }
+}
+
+static FindImpl GetFindImpl(const FindOptions* opts) {
+    FindImpl impl = opts ? opts->impl : FindImpl::Best;
+    if (impl == FindImpl::Best) {
+        if (IsFindImplSupported(FindImpl::Avx2)) {
+            return FindImpl::Avx2;
+        }
+        if (IsFindImplSupported(FindImpl::Sse2)) {
+            return FindImpl::Sse2;
+        }
+        return FindImpl::Scalar;
+    }
+    if (!IsFindImplSupported(impl)) {
+        return FindImpl::Scalar;
+    }
+    return impl;
+}
+
+int FindInWStr(const WCHAR* s, int len, int startAt, const WCHAR* toFind, int toFindLen, const FindOptions* opts) {
+    if (!s || !toFind || toFindLen <= 0 || len < toFindLen) {
+        return -1;
+    }
+    int pos = std::max(startAt, 0);
+    int lastStart = len - toFindLen;
+    if (pos > lastStart) {
+        return -1;
+    }
+    switch (GetFindImpl(opts)) {
+#if defined(STR_SEARCH_X86)
+        case FindImpl::Avx2:
+            return FindAvx2(s, len, pos, lastStart, toFind, toFindLen, opts);
+        case FindImpl::Sse2:
+            return FindSse2(s, len, pos, lastStart, toFind, toFindLen, opts);
+#endif
+        default:
+            return FindScalar(s, len, pos, lastStart, toFind, toFindLen, opts);
+    }
+}
+
+int FindLastInWStr(const WCHAR* s, int len, int endAt, const WCHAR* toFind, int toFindLen, const FindOptions* opts) {
+    if (!s || !toFind || toFindLen <= 0 || len < toFindLen) {
+        return -1;
+    }
+    int lastStart = std::min(endAt - 1, len - toFindLen);
+    if (lastStart < 0) {
+        return -1;
+    }
+    switch (GetFindImpl(opts)) {
+#if defined(STR_SEARCH_X86)
+        case FindImpl::Avx2:
+            return FindLastAvx2(s, len, lastStart, toFind, toFindLen, opts);
+        case FindImpl::Sse2:
+            return FindLastSse2(s, len, lastStart, toFind, toFindLen, opts);
+#endif
+        default:
+            return FindLastScalar(s, len, lastStart, toFind, toFindLen, opts);
+    }
+}
+
+} // namespace str
@@ -0,0 +1,41 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Fast (SSE2 / AVX2 where available) search for UTF-16 strings.
+// The comparison is exact, so for case-insensitive search both the text
+// and the string to find have to be folded with FoldCaseInPlace() first.
+
+namespace str {
+
+enum class FindImpl : u8 {
+    Best = 0,
+    Scalar,
+    Sse2,
+    Avx2,
+};
+
+struct FindOptions {
+    // reject matches that start resp. end in the middle of a word,
+    // as determined by isWordChar
+    bool wordStart = false;
+    bool wordEnd = false;
+    bool (*isWordChar)(WCHAR c) = nullptr;
+    // only for testing and benchmarking
+    FindImpl impl = FindImpl::Best;
+};
+
+bool IsFindImplSupported(FindImpl impl);
+
+void FoldCaseInPlace(WCHAR* s, int len);
+
+// returns the offset of the first occurrence of toFind in s which
+// starts at or after startAt or -1 if there is none
+// (s doesn't have to be zero-terminated)
+int FindInWStr(const WCHAR* s, int len, int startAt, const WCHAR* toFind, int toFindLen,
+               const FindOptions* opts = nullptr);
+// returns the offset of the last occurrence of toFind in s
+// which starts before endAt or -1 if there is none
+int FindLastInWStr(const WCHAR* s, int len, int endAt, const WCHAR* toFind, int toFindLen,
+                   const FindOptions* opts = nullptr);
+
+} // namespace str
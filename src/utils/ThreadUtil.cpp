@@ -83,6 +83,13 @@ void RunAsync(const Func0& fn, const char* threadName) {
     SafeCloseHandle(&hThread);
 }
 
+int GetLogicalCpuCount() {
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    int n = (int)si.dwNumberOfProcessors;
+    return std::max(n, 1);
+}
+
 AtomicInt gDangerousThreadCount;
 
 bool AreDangerousThreadsPending() {
@@ -24,5 +24,7 @@ void SetThreadName(const char* threadName, DWORD threadId = 0);
 void RunAsync(const Func0&, const char* threadName = nullptr);
 HANDLE StartThread(const Func0&, const char* threadName = nullptr);
 
+int GetLogicalCpuCount();
+
 extern AtomicInt gDangerousThreadCount;
 bool AreDangerousThreadsPending();
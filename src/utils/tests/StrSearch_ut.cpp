@@ -0,0 +1,135 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/StrSearch.h"
+#include "utils/Timer.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+static str::FindImpl gFindImpls[] = {str::FindImpl::Scalar, str::FindImpl::Sse2, str::FindImpl::Avx2};
+static const char* gFindImplNames[] = {"scalar", "sse2", "avx2"};
+
+static bool IsLetter(WCHAR c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// straightforward versions to compare the optimized ones against
+static int FindReference(const WCHAR* s, int len, int startAt, const WCHAR* toFind, int n, const str::FindOptions& opts) {
+    for (int pos = std::max(startAt, 0); pos + n <= len; pos++) {
+        if (memcmp(s + pos, toFind, n * sizeof(WCHAR)) != 0) {
+            continue;
+        }
+        if (opts.wordStart && pos > 0 && IsLetter(s[pos - 1]) && IsLetter(s[pos])) {
+            continue;
+        }
+        if (opts.wordEnd && pos + n < len && IsLetter(s[pos + n - 1]) && IsLetter(s[pos + n])) {
+            continue;
+        }
+        return pos;
+    }
+    return -1;
+}
+
+static int FindLastReference(const WCHAR* s, int len, int endAt, const WCHAR* toFind, int n,
+                             const str::FindOptions& opts) {
+    int res = -1;
+    for (int pos = FindReference(s, len, 0, toFind, n, opts); pos >= 0 && pos < endAt;
+         pos = FindReference(s, len, pos + 1, toFind, n, opts)) {
+        res = pos;
+    }
+    return res;
+}
+
+static void StrSearchRandomTest(str::FindImpl impl) {
+    // small alphabet to get plenty of partial matches
+    WCHAR s[300];
+    WCHAR toFind[6];
+    for (int iter = 0; iter < 2000; iter++) {
+        int len = rand() % dimof(s);
+        for (int i = 0; i < len; i++) {
+            s[i] = (rand() % 5 == 0) ? ' ' : (WCHAR)('a' + rand() % 3);
+        }
+        int n = 1 + rand() % dimof(toFind);
+        for (int i = 0; i < n; i++) {
+            toFind[i] = (WCHAR)('a' + rand() % 3);
+        }
+        str::FindOptions opts;
+        opts.impl = impl;
+        opts.isWordChar = IsLetter;
+        opts.wordStart = rand() % 3 == 0;
+        opts.wordEnd = rand() % 3 == 0;
+
+        int startAt = len > 0 ? rand() % (len + 1) : 0;
+        int got = str::FindInWStr(s, len, startAt, toFind, n, &opts);
+        utassert(got == FindReference(s, len, startAt, toFind, n, opts));
+        got = str::FindLastInWStr(s, len, startAt, toFind, n, &opts);
+        utassert(got == FindLastReference(s, len, startAt, toFind, n, opts));
+    }
+}
+
+void StrSearchTest() {
+    const WCHAR* s = L"The quick brown fox jumps over the lazy dog. The end";
+    int len = (int)str::Len(s);
+    for (str::FindImpl impl : gFindImpls) {
+        if (!str::IsFindImplSupported(impl)) {
+            continue;
+        }
+        str::FindOptions opts;
+        opts.impl = impl;
+        utassert(str::FindInWStr(s, len, 0, L"The", 3, &opts) == 0);
+        utassert(str::FindInWStr(s, len, 1, L"The", 3, &opts) == 45);
+        utassert(str::FindInWStr(s, len, 46, L"The", 3, &opts) == -1);
+        utassert(str::FindInWStr(s, len, 0, L"end", 3, &opts) == len - 3);
+        utassert(str::FindInWStr(s, len, 0, L"cat", 3, &opts) == -1);
+        utassert(str::FindLastInWStr(s, len, len, L"The", 3, &opts) == 45);
+        utassert(str::FindLastInWStr(s, len, 45, L"The", 3, &opts) == 0);
+        utassert(str::FindLastInWStr(s, len, 0, L"The", 3, &opts) == -1);
+        utassert(str::FindLastInWStr(s, len, len, L"T", 1, &opts) == 45);
+
+        opts.isWordChar = IsLetter;
+        opts.wordStart = true;
+        utassert(str::FindInWStr(s, len, 0, L"he", 2, &opts) == -1);
+        opts.wordStart = false;
+        opts.wordEnd = true;
+        utassert(str::FindInWStr(s, len, 0, L"he", 2, &opts) == 1);
+
+        StrSearchRandomTest(impl);
+    }
+
+    WCHAR folded[] = L"Hello WORLD";
+    str::FoldCaseInPlace(folded, (int)str::Len(folded));
+    utassert(str::Eq(folded, L"hello world"));
+}
+
+// not part of the unit tests: reports search throughput of each implementation
+void StrSearchBench() {
+    constexpr int kLen = 8 * 1024 * 1024;
+    constexpr int kIterations = 8;
+    WCHAR* s = AllocArray<WCHAR>(kLen);
+    for (int i = 0; i < kLen; i++) {
+        s[i] = (rand() % 6 == 0) ? ' ' : (WCHAR)('a' + rand() % 26);
+    }
+    // a word that's not in the text, so the whole text is scanned
+    const WCHAR* toFind = L"sumatra1";
+    int n = (int)str::Len(toFind);
+    for (int i = 0; i < (int)dimof(gFindImpls); i++) {
+        str::FindImpl impl = gFindImpls[i];
+        if (!str::IsFindImplSupported(impl)) {
+            continue;
+        }
+        str::FindOptions opts;
+        opts.impl = impl;
+        auto t = TimeGet();
+        for (int j = 0; j < kIterations; j++) {
+            int pos = (j % 2 == 0) ? str::FindInWStr(s, kLen, 0, toFind, n, &opts)
+                                   : str::FindLastInWStr(s, kLen, kLen, toFind, n, &opts);
+            utassert(pos == -1);
+        }
+        double ms = TimeSinceInMs(t);
+        double gb = (double)kLen * sizeof(WCHAR) * kIterations / (1024.0 * 1024.0 * 1024.0);
+        printf("StrSearchBench: %s: %.2f GB/s\n", gFindImplNames[i], ms > 0 ? gb * 1000.0 / ms : 0);
+    }
+    free(s);
+}